@@ -161,6 +161,9 @@ _mp${FPGAMSHR.numMemoryPorts}""".replace("\n", "") + (if(FPGAMSHR.useROB) "_rob"
 
 	var outputDir = "."
 	val version = 0.11
+
+	/* Top level port of the profiling register map, set when the design is elaborated (see ProfilingMap) */
+	var profilingPort: AnyRef = null
 }
 
 class FPGAMSHR extends Module {
@@ -458,8 +461,13 @@ class FPGAMSHR extends Module {
 		// println(s"fpgamshrSubModuleAddr.bits.getWidth=$w")
 
 		val fpgamshrRegAxiProfiling = Wire(new AXI4LiteReadOnlyProfiling(Profiling.dataWidth, Profiling.regAddrWidth))
+		val portSuffix = (i: Int) => if (FPGAMSHR.numMemoryPorts > 1) s" $i" else ""
 		val fpgamshrProfilingInterface = ProfilingInterface(fpgamshrRegAxiProfiling.axi,
-															Vec(ArrayBuffer(totalCycleCounter) ++ cyclesExtMemNotReady ++ reqSent ++ respReceived))
+															Vec(ArrayBuffer(totalCycleCounter) ++ cyclesExtMemNotReady ++ reqSent ++ respReceived), "misc",
+															Seq("total cycles") ++
+															(0 until FPGAMSHR.numMemoryPorts).map(i => "mem cycles not ready" + portSuffix(i)) ++
+															(0 until FPGAMSHR.numMemoryPorts).map(i => "mem sent requests" + portSuffix(i)) ++
+															(0 until FPGAMSHR.numMemoryPorts).map(i => "mem received responses" + portSuffix(i)))
 		fpgamshrRegAxiProfiling.axi.RDATA  := fpgamshrProfilingInterface.bits
 		fpgamshrRegAxiProfiling.axi.RRESP  := 0.U
 		fpgamshrRegAxiProfiling.axi.RVALID := fpgamshrProfilingInterface.valid
@@ -471,9 +479,10 @@ class FPGAMSHR extends Module {
 		dummyAxiProfiling.axi.RVALID  := false.B
 		dummyAxiProfiling.axi.ARREADY := true.B
 
-		val fpgamshrSelector = ProfilingSelector(fpgamshrSubModuleAddr,
-												Array(fpgamshrRegAxiProfiling) ++ Seq.fill(3)(dummyAxiProfiling), snapshot=snapshot, clear=clear)
 		val fpgamshrAxiProfiling = Wire(new AXI4LiteReadOnlyProfiling(Profiling.dataWidth, Profiling.regAddrWidth + Profiling.subModuleAddrWidth))
+		val fpgamshrSelector = ProfilingSelector(fpgamshrSubModuleAddr,
+												Array(fpgamshrRegAxiProfiling) ++ Seq.fill(3)(dummyAxiProfiling), snapshot=snapshot, clear=clear,
+												port=fpgamshrAxiProfiling.axi)
 		fpgamshrAxiProfiling.axi.RDATA   := fpgamshrSelector.bits
 		fpgamshrAxiProfiling.axi.RRESP   := 0.U
 		fpgamshrAxiProfiling.axi.RVALID  := fpgamshrSelector.valid
@@ -483,7 +492,9 @@ class FPGAMSHR extends Module {
 		fpgamshrAxiProfiling.axi.ARREADY := fpgamshrSubModuleAddr.ready
 
 		val subModulesProfilingInterfaces = reqHandlers.map(_.axiProfiling) ++ reorderBuffers.map(_.axiProfiling) ++ Array(fpgamshrAxiProfiling)
-		val globalSelector = ProfilingSelector(inputProfilingReadEb.io.out, subModulesProfilingInterfaces, clear=clear, snapshot=snapshot)
+		val globalSelector = ProfilingSelector(inputProfilingReadEb.io.out, subModulesProfilingInterfaces, clear=clear, snapshot=snapshot,
+												port=io.axiProfiling)
+		FPGAMSHR.profilingPort = io.axiProfiling
 		val outputProfilingEb = ElasticBuffer(globalSelector)
 		io.axiProfiling.RDATA   := outputProfilingEb.bits
 		io.axiProfiling.RVALID  := outputProfilingEb.valid
@@ -15,6 +15,49 @@ object Profiling {
                                   Very informative but resource-hungry and harms critical path because of the large MUX when reading the profiling registers. */
 }
 
+/* Register map of the profiling address space for the host. Every ProfilingInterface and ProfilingSelector records
+   itself while the design is elaborated, keyed by the AXI port it is read through; emit() walks the tree from the top
+   level port and returns the counters as blocks (see FPGAMSHRVivadoBuilder, which writes them to output/sw). */
+object ProfilingMap {
+    sealed trait Node
+    case class Regs(name: String, items: Seq[String]) extends Node
+    case class Selector(subModuleAddrWidth: Int, children: Seq[AnyRef]) extends Node
+    /* A block: the same counters in every instance, instance i at register reg + i * stride */
+    case class Block(name: String, items: Seq[String], reg: Long, stride: Long, instances: Int)
+
+    private val nodes = new java.util.IdentityHashMap[AnyRef, Node]()
+
+    def regs(port: AnyRef, name: String, items: Seq[String], numRegs: Int) =
+        nodes.put(port, Regs(name, items.take(numRegs) ++ (items.length until numRegs).map(i => s"reg$i")))
+
+    def selector(port: AnyRef, addrWidth: Int, children: Seq[AnyRef]) =
+        nodes.put(port, Selector(addrWidth - log2Ceil(children.length), children))
+
+    def emit(top: AnyRef): Seq[Block] = {
+        val leaves = scala.collection.mutable.ArrayBuffer[(Regs, Long)]()
+        def walk(port: AnyRef, reg: Long): Unit = nodes.get(port) match {
+            case r: Regs => leaves += ((r, reg))
+            case Selector(width, children) =>
+                for ((child, i) <- children.zipWithIndex) walk(child, reg + (i.toLong << width))
+            case null => /* unused slot of a selector */
+        }
+        walk(top, 0)
+        /* instances of a leaf with the same name and items at a constant stride form one block */
+        val blocks = scala.collection.mutable.ArrayBuffer[Block]()
+        for ((r, reg) <- leaves) {
+            val i = blocks.indexWhere(b => b.name == r.name && b.items == r.items &&
+                                           (b.instances == 1 || reg == b.reg + b.stride * b.instances))
+            if (i >= 0) {
+                val b = blocks(i)
+                blocks(i) = b.copy(stride = if (b.instances == 1) reg - b.reg else b.stride, instances = b.instances + 1)
+            } else {
+                blocks += Block(r.name, r.items, reg, 0, 1)
+            }
+        }
+        blocks
+    }
+}
+
 object ProfilingInterface {
     def apply(inAddr: DecoupledIO[UInt], inRegs: Vec[UInt]) = {
         val m = Module(new ProfilingInterface(inAddr.bits.getWidth, Profiling.dataWidth, inRegs.length))
@@ -23,7 +66,9 @@ object ProfilingInterface {
         m.io.outData
     }
 
-    def apply(inAXI: AXI4LiteReadOnly[UInt], inRegs: Vec[UInt]) = {
+    /* name and items label the registers in the register map of the host */
+    def apply(inAXI: AXI4LiteReadOnly[UInt], inRegs: Vec[UInt], name: String = "regs", items: Seq[String] = Seq()) = {
+        ProfilingMap.regs(inAXI, name, items, inRegs.length)
         val m = Module(new ProfilingInterface(inAXI.ARADDR.getWidth, Profiling.dataWidth, inRegs.length))
         val inAddr = Wire(DecoupledIO(m.io.inAddr.bits.cloneType))
         inAddr.bits := inAXI.ARADDR
@@ -66,8 +111,12 @@ class ProfilingInterface(addrWidth: Int, dataWidth: Int, numInputs: Int) extends
 }
 
 object ProfilingSelector {
-    def apply(in: DecoupledIO[UInt], subModulesAXIProfiling: Seq[AXI4LiteReadOnlyProfiling], clear: Bool, snapshot: Bool): DecoupledIO[UInt] = {
+    /* port is the AXI port in drives from, it places the selector in the register map of the host */
+    def apply(in: DecoupledIO[UInt], subModulesAXIProfiling: Seq[AXI4LiteReadOnlyProfiling], clear: Bool, snapshot: Bool,
+              port: AnyRef = null): DecoupledIO[UInt] = {
         val numSubModules = subModulesAXIProfiling.length
+        if (port != null)
+            ProfilingMap.selector(port, in.bits.getWidth, subModulesAXIProfiling.map(_.axi))
         val selector = Module(new ProfilingSelector(in.bits.getWidth, Profiling.dataWidth, numSubModules))
         val width = in.bits.getWidth
         // println(s"in.bits.getWidth=$width")
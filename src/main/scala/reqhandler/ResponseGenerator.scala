@@ -156,7 +156,8 @@ class ResponseGenerator(idWidth: Int=ResponseGenerator.idWidth, memDataWidth: In
       val responsesSentOutCount = io.outs.map(out => ProfilingCounter(out.valid & out.ready, io.axiProfiling)).reduce(_ + _)
       val cyclesOutNotReady = ProfilingCounter(outValid & ~outReady, io.axiProfiling)
       val profilingRegisters = Array(acceptedInputsCount, responsesSentOutCount, cyclesOutNotReady)
-      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "respgen",
+        Seq("accepted inputs count", "responses sent out count", "cycles out not ready"))
       io.axiProfiling.axi.RDATA := profilingInterface.bits
       io.axiProfiling.axi.RVALID := profilingInterface.valid
       profilingInterface.ready := io.axiProfiling.axi.RREADY
@@ -290,7 +291,8 @@ class ResponseGeneratorOneOutputArbitraryEntriesPerRow(idWidth: Int=ResponseGene
         val responsesSentOutCount = ProfilingCounter(io.out.valid & io.out.ready, io.axiProfiling)
         val cyclesOutNotReady = ProfilingCounter(io.out.valid & ~io.out.ready, io.axiProfiling)
         val profilingRegisters = Array(acceptedInputsCount, responsesSentOutCount, cyclesOutNotReady)
-        val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+        val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "respgen",
+        Seq("accepted inputs count", "responses sent out count", "cycles out not ready"))
         io.axiProfiling.axi.RDATA := profilingInterface.bits
         io.axiProfiling.axi.RVALID := profilingInterface.valid
         profilingInterface.ready := io.axiProfiling.axi.RREADY
@@ -341,7 +341,11 @@ class CuckooMSHR(addrWidth: Int=MSHR.addrWidth, numMSHRPerHashTable: Int=MSHR.nu
       profilingRegisters ++= currentlyUsedMSHRHistogram
     }
     require(Profiling.regAddrWidth >= log2Ceil(profilingRegisters.length))
-    val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+    val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "mshr",
+      Seq("currently used MSHR", "max used MSHR", "collison trigger count", "cycles spent handling collisons", "stall trigger count",
+          "cycles spent stalling", "accepted allocs count", "accepted deallocs count", "cycles allocs stall", "cycles deallocs stall",
+          "enqueued mem reqs count", "cycles out LdBuf not ready", "accum used MSHR", "cycles allocs stall LdBuf") ++
+      (0 until log2Ceil(numMSHRTotal)).map(i => s"used MSHR >=${1 << i}"))
     io.axiProfiling.axi.RDATA := profilingInterface.bits
     io.axiProfiling.axi.RVALID := profilingInterface.valid
     profilingInterface.ready := io.axiProfiling.axi.RREADY
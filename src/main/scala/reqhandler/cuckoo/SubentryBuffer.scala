@@ -299,7 +299,11 @@ class SubentryBuffer(idWidth: Int=SubentryBuffer.idWidth, memDataWidth: Int=Sube
         val usedEntriesHistogram = (0 until log2Ceil(totalEntries)).map(i => ProfilingCounter(currentlyUsedEntries >= (1 << i).U, io.axiProfiling))
         profilingRegisters ++= usedEntriesHistogram
       }
-      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "subentry",
+        Seq("currently used entries", "max used entries", "currently used rows", "max used rows", "currently rows with NextRowPtr valid",
+            "max rows with NextRowPtr valid", "cycles RespGen stall", "cycles write pipeline stall", "cycles valid NextPtr input stall",
+            "NextPtr cache hits", "accum used entries", "accum used rows", "cycles FRQ stop alloc") ++
+        (0 until log2Ceil(totalEntries)).map(i => s"used entries >=${1 << i}"))
       io.axiProfiling.axi.RDATA := profilingInterface.bits
       io.axiProfiling.axi.RVALID := profilingInterface.valid
       profilingInterface.ready := io.axiProfiling.axi.RREADY
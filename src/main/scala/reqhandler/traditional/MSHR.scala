@@ -241,7 +241,11 @@ class MSHRTraditional(addrWidth: Int=MSHRTraditional.addrWidth, numMSHR: Int=MSH
         profilingRegisters ++= currentlyUsedMSHRHistogram
       }
       require(Profiling.regAddrWidth >= log2Ceil(profilingRegisters.length))
-      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "mshr",
+        Seq("currently used MSHR", "max used MSHR", "cycles MSHR full", "cycles LdBuf full", "stall trigger count",
+            "cycles spent stalling", "accepted allocs count", "accepted deallocs count", "cycles allocs stall", "cycles deallocs stall",
+            "enqueued mem reqs count", "cycles out LdBuf not ready") ++
+        (0 until log2Ceil(numMSHR)).map(i => s"used MSHR >=${1 << i}"))
       io.axiProfiling.axi.RDATA := profilingInterface.bits
       io.axiProfiling.axi.RVALID := profilingInterface.valid
       profilingInterface.ready := io.axiProfiling.axi.RREADY
@@ -99,7 +99,7 @@ class RequestHandlerBlockingCache(reqAddrWidth: Int=RequestHandlerTraditional.re
         profilingAddrDecoupledIO.bits := io.axiProfiling.axi.ARADDR
         profilingAddrDecoupledIO.valid := io.axiProfiling.axi.ARVALID
         io.axiProfiling.axi.ARREADY := profilingAddrDecoupledIO.ready
-        val profilingSelector = ProfilingSelector(profilingAddrDecoupledIO, subModulesProfilingInterfaces, io.axiProfiling.clear, io.axiProfiling.snapshot)
+        val profilingSelector = ProfilingSelector(profilingAddrDecoupledIO, subModulesProfilingInterfaces, io.axiProfiling.clear, io.axiProfiling.snapshot, port=io.axiProfiling.axi)
         io.axiProfiling.axi.RDATA := profilingSelector.bits
         io.axiProfiling.axi.RVALID := profilingSelector.valid
         profilingSelector.ready := io.axiProfiling.axi.RREADY
@@ -172,7 +172,7 @@ class RequestHandlerTraditionalMSHR(reqAddrWidth: Int=RequestHandlerTraditional.
         profilingAddrDecoupledIO.bits := io.axiProfiling.axi.ARADDR
         profilingAddrDecoupledIO.valid := io.axiProfiling.axi.ARVALID
         io.axiProfiling.axi.ARREADY := profilingAddrDecoupledIO.ready
-        val profilingSelector = ProfilingSelector(profilingAddrDecoupledIO, subModulesProfilingInterfaces, io.axiProfiling.clear, io.axiProfiling.snapshot)
+        val profilingSelector = ProfilingSelector(profilingAddrDecoupledIO, subModulesProfilingInterfaces, io.axiProfiling.clear, io.axiProfiling.snapshot, port=io.axiProfiling.axi)
         io.axiProfiling.axi.RDATA := profilingSelector.bits
         io.axiProfiling.axi.RVALID := profilingSelector.valid
         profilingSelector.ready := io.axiProfiling.axi.RREADY
@@ -85,7 +85,10 @@ class SubentryBufferTraditional(idWidth: Int=SubentryBufferTraditional.idWidth,
 
       val profilingRegisters = Array(snapshotUsedEntries, maxUsedEntries, currentlyUsedRows, maxUsedRows, rowsWithNextRowPtrValid,
                                      cyclesInFwStall, cyclesRespGenStall, cyclesWritePipelineStall) ++ usedEntriesHistogram
-      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "subentry",
+        Seq("currently used entries", "max used entries", "currently used rows", "max used rows", "rows with NextRowPtr valid",
+            "cycles in forward stall", "cycles RespGen stall", "cycles write pipeline stall") ++
+        (0 until log2Ceil(totalEntries)).map(i => s"used entries >=${1 << i}"))
       io.axiProfiling.axi.RDATA := profilingInterface.bits
       io.axiProfiling.axi.RVALID := profilingInterface.valid
       profilingInterface.ready := io.axiProfiling.axi.RREADY
@@ -34,7 +34,8 @@ class DummyCache(addrWidth: Int=Cache.addrWidth, idWidth: Int=Cache.idWidth, req
       val cyclesOutMissesStall = ProfilingCounter(io.outMisses.valid & ~io.outMisses.ready, io.axiProfiling)
       val cyclesOutDataStall = 0.U(Profiling.dataWidth.W)
       val profilingRegisters = Array(receivedRequestsCount, hitCount, cyclesOutMissesStall, cyclesOutDataStall)
-      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "cache",
+        Seq("received requests", "hits", "cycles out misses stall", "cycles out data stall"))
       io.axiProfiling.axi.RDATA := profilingInterface.bits
       io.axiProfiling.axi.RVALID := profilingInterface.valid
       profilingInterface.ready := io.axiProfiling.axi.RREADY
@@ -211,7 +212,8 @@ class RRCache(addrWidth: Int=Cache.addrWidth, idWidth: Int=Cache.idWidth, reqDat
       val cyclesOutMissesStall = ProfilingCounter(io.outMisses.valid & ~io.outMisses.ready, io.axiProfiling)
       val cyclesOutDataStall = ProfilingCounter(io.outData.valid & ~io.outData.ready, io.axiProfiling)
       val profilingRegisters = Array(receivedRequestsCount, hitCount, cyclesOutMissesStall, cyclesOutDataStall)
-      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+      val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "cache",
+        Seq("received requests", "hits", "cycles out misses stall", "cycles out data stall"))
       io.axiProfiling.axi.RDATA := profilingInterface.bits
       io.axiProfiling.axi.RVALID := profilingInterface.valid
       profilingInterface.ready := io.axiProfiling.axi.RREADY
@@ -49,7 +49,9 @@ class DummyReorderBufferAXI(addrWidth: Int=ReorderBufferAXI.addrWidth, dataWidth
     val profilingRegisters = ArrayBuffer(receivedRequestsCount, receivedResponsesCount, currentlyUsedEntries, maxUsedEntries,
       sentResponsesCount, cyclesFull, cyclesReqsInStalled, cyclesReqsOutStalled, cyclesRespOutStalled)// ++ usedEntriesHistogram
 
-    val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters))
+    val profilingInterface = ProfilingInterface(io.axiProfiling.axi, Vec(profilingRegisters), "input",
+      Seq("received requests", "received responses", "currently used entries", "max used entries", "sent responses",
+          "cycles full stall", "cycles reqs in stall", "cycles reqs out stall", "cycles resp out stall"))
     io.axiProfiling.axi.RDATA := profilingInterface.bits
     io.axiProfiling.axi.RVALID := profilingInterface.valid
     profilingInterface.ready := io.axiProfiling.axi.RREADY
@@ -289,7 +291,9 @@ class ReorderBufferAXI(addrWidth: Int=ReorderBufferAXI.addrWidth, dataWidth: Int
         sentResponsesCount, cyclesFullStalled, cyclesReqsInStalled, cyclesReqsOutStalled, cyclesRespInStalled, cyclesRespOutStalled)// ++ usedEntriesHistogram
 
       val innerAxiProfiling = Wire(new AXI4LiteReadOnlyProfiling(Profiling.dataWidth, Profiling.regAddrWidth))
-      val profilingInterface = ProfilingInterface(innerAxiProfiling.axi, Vec(profilingRegisters))
+      val profilingInterface = ProfilingInterface(innerAxiProfiling.axi, Vec(profilingRegisters), "input",
+        Seq("received requests", "received responses", "currently used entries", "max used entries", "sent responses",
+            "cycles full stall", "cycles reqs in stall", "cycles reqs out stall", "cycles resp in stall", "cycles resp out stall"))
       innerAxiProfiling.axi.RDATA := profilingInterface.bits
       innerAxiProfiling.axi.RVALID := profilingInterface.valid
       profilingInterface.ready := innerAxiProfiling.axi.RREADY
@@ -309,7 +313,7 @@ class ReorderBufferAXI(addrWidth: Int=ReorderBufferAXI.addrWidth, dataWidth: Int
       profilingAddrDecoupledIO.valid := io.axiProfiling.axi.ARVALID
       io.axiProfiling.axi.ARREADY := profilingAddrDecoupledIO.ready
       //println(s"profilingAddrDecoupledIO.bits.getWidth=${profilingAddrDecoupledIO.bits.getWidth}")
-      val profilingSelector = ProfilingSelector(profilingAddrDecoupledIO, subModulesProfilingInterfaces, io.axiProfiling.clear, io.axiProfiling.snapshot)
+      val profilingSelector = ProfilingSelector(profilingAddrDecoupledIO, subModulesProfilingInterfaces, io.axiProfiling.clear, io.axiProfiling.snapshot, port=io.axiProfiling.axi)
       io.axiProfiling.axi.RDATA := profilingSelector.bits
       io.axiProfiling.axi.RVALID := profilingSelector.valid
       profilingSelector.ready := io.axiProfiling.axi.RREADY
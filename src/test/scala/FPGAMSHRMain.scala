@@ -8,7 +8,7 @@ import fpgamshr.packaging._
 
 import org.scalatest.{Matchers, FlatSpec}
 
-import fpgamshr.profiling.{Profiling}
+import fpgamshr.profiling.{Profiling, ProfilingMap}
 import java.io.{File, BufferedWriter, FileWriter} // To generate the .tcl and .h files
 import scala.sys.process._ // for the ! operator
 import scala.language.postfixOps
@@ -99,9 +99,30 @@ object FPGAMSHRVivadoBuilder extends App {
   headerFile.write(s"#define CACHE_SIZE ${FPGAMSHR.cacheSizeBytes}\n")
   headerFile.write(s"#define CACHE_SIZE_REDUCTION_WIDTH ${FPGAMSHR.cacheSizeReductionWidth}\n")
   headerFile.write(s"#define NUM_REQ_HANDLERS ${FPGAMSHR.numReqHandlers}\n")
+  headerFile.write(s"#define USE_ROB ${if (FPGAMSHR.useROB) 1 else 0}\n")
   headerFile.write(s"#define PARAMS_H\n")
 
   headerFile.close()
+
+  /* Elaborate the design to record its profiling register map, read by sw/profiling.c */
+  chisel3.Driver.elaborate(() => new FPGAMSHR)
+  val mapFile = new MyFileWriter("output/sw/profiling_map.h")
+  mapFile.write(s"// Generated on ${currentDateTime} with Chisel code version ${FPGAMSHR.version}\n")
+  mapFile.write(s"// Profiling register map of ${FPGAMSHR.ipName}: block, counters, first register, stride, instances\n")
+  mapFile.write(s"#define PROFILING_MAP_H\n")
+  val blocks = if (Profiling.enable) ProfilingMap.emit(FPGAMSHR.profilingPort) else Seq()
+  for ((b, i) <- blocks.zipWithIndex) {
+    mapFile.write(s"static const char *profiling_map_items_${i}[] = {\n")
+    mapFile.write(b.items.map(item => s"""\t"${item}",\n""").mkString)
+    mapFile.write("};\n")
+  }
+  mapFile.write("static const struct prof_block profiling_map[] = {\n")
+  for ((b, i) <- blocks.zipWithIndex) {
+    mapFile.write(s"""\t{ "${b.name}", profiling_map_items_${i}, ${b.items.length}, ${b.reg}, ${b.stride}, ${b.instances} },\n""")
+  }
+  mapFile.write("};\n")
+  mapFile.close()
+
   "cp util/genprj.tcl util/constraint.xdc output/vivado" !
   // copy all files from sw to output/sw
   val f = (new File("sw")).listFiles.map(_.getName)
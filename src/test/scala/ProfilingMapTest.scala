@@ -0,0 +1,53 @@
+// See LICENSE for license details.
+
+package fpgamshr.profiling
+
+import org.scalatest.{Matchers, FlatSpec}
+
+/**
+  * Checks ProfilingMap.emit on a hand-built selector tree, without elaborating a design:
+  * {{{
+  * testOnly fpgamshr.profiling.ProfilingMapTest
+  * }}}
+  */
+class ProfilingMapTest extends FlatSpec with Matchers {
+  import ProfilingMap.Block
+
+  /* Stand-ins for the AXI ports, the map only keys on their identity */
+  class Port
+
+  /* top: 8 address bits, 4 slots of 64 registers
+       0, 64  two "cache" leaves
+       128    selector of 4 slots of 16 registers: "mshr" at 128 and 144, an unused slot, "mshr" at 176
+       192    "misc" leaf with fewer names than registers */
+  val top, cache0, cache1, inner, mshr0, mshr1, unused, mshr3, misc = new Port
+  val cacheItems = Seq("received requests", "hits")
+  ProfilingMap.selector(top, 8, Seq(cache0, cache1, inner, misc))
+  ProfilingMap.regs(cache0, "cache", cacheItems, 2)
+  ProfilingMap.regs(cache1, "cache", cacheItems, 2)
+  ProfilingMap.selector(inner, 6, Seq(mshr0, mshr1, unused, mshr3))
+  ProfilingMap.regs(mshr0, "mshr", Seq("max used MSHR"), 1)
+  ProfilingMap.regs(mshr1, "mshr", Seq("max used MSHR"), 1)
+  ProfilingMap.regs(mshr3, "mshr", Seq("max used MSHR"), 1)
+  ProfilingMap.regs(misc, "misc", Seq("total cycles"), 3)
+
+  val blocks = ProfilingMap.emit(top)
+
+  "ProfilingMap.emit" should "fold leaves at a constant stride into one block" in {
+    blocks(0) should be (Block("cache", cacheItems, 0, 64, 2))
+    blocks(1) should be (Block("mshr", Seq("max used MSHR"), 128, 16, 2))
+  }
+
+  it should "skip unused slots and start a new block when the stride breaks" in {
+    blocks(2) should be (Block("mshr", Seq("max used MSHR"), 176, 0, 1))
+  }
+
+  it should "name the registers without a name by their index" in {
+    blocks(3) should be (Block("misc", Seq("total cycles", "reg1", "reg2"), 192, 0, 1))
+    blocks.length should be (4)
+  }
+
+  it should "give an empty map for a port it does not know" in {
+    ProfilingMap.emit(new Port) should be (empty)
+  }
+}
@@ -0,0 +1,144 @@
+/*
+ * Buddy allocator over a power-of-two window of device memory.
+ *
+ * The window is split into blocks of 1 << BUDDY_MIN_ORDER bytes; an
+ * allocation gets the smallest power-of-two run of blocks that holds it.
+ * Only the bookkeeping lives on the host, nothing is written to the device.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "def.h"
+
+#define BUDDY_MIN_ORDER		20		// 1MB blocks
+#define BUDDY_MAX_ORDERS	24		// up to 8TB windows
+
+#define BUDDY_FREE		0x80	// state[]: head of a free run of 1 << (state & 0x7f) blocks
+#define BUDDY_NONE		0xff	// state[]: not the head of a run
+
+struct buddy {
+	uint64_t base;
+	int orders;				// window is 1 << (orders - 1) blocks
+	uint8_t *state;			// per block: order of the run it heads, BUDDY_FREE flag
+};
+
+static uint64_t buddy_blocks(struct buddy *b)
+{
+	return 1UL << (b->orders - 1);
+}
+
+// size must be a power of two and a multiple of the block size.
+int buddy_init(struct buddy *b, uint64_t base, uint64_t size)
+{
+	int order = __builtin_ctzl(size >> BUDDY_MIN_ORDER);
+	if ((size & (size - 1)) != 0 || (size >> BUDDY_MIN_ORDER) == 0 || order + 1 > BUDDY_MAX_ORDERS)
+		return -1;
+	b->base = base;
+	b->orders = order + 1;
+	b->state = malloc(buddy_blocks(b));
+	if (b->state == NULL)
+		return -1;
+	memset(b->state, BUDDY_NONE, buddy_blocks(b));
+	b->state[0] = BUDDY_FREE | order;
+	return 0;
+}
+
+void buddy_destroy(struct buddy *b)
+{
+	free(b->state);
+	b->state = NULL;
+}
+
+static int buddy_order(uint64_t size)
+{
+	uint64_t blocks = (size + (1UL << BUDDY_MIN_ORDER) - 1) >> BUDDY_MIN_ORDER;
+	return blocks <= 1 ? 0 : 64 - __builtin_clzl(blocks - 1);
+}
+
+// Split free runs until block idx heads a free run of the given order.
+static void buddy_split(struct buddy *b, uint64_t head, int from, uint64_t idx, int order)
+{
+	while (from > order) {
+		from--;
+		uint64_t half = 1UL << from;
+		if (idx >= head + half) {
+			b->state[head] = BUDDY_FREE | from;
+			head += half;
+		} else {
+			b->state[head + half] = BUDDY_FREE | from;
+		}
+	}
+	b->state[head] = BUDDY_FREE | order;
+}
+
+// Returns the device address of size bytes, or 0 when out of memory.
+uint64_t buddy_alloc(struct buddy *b, uint64_t size)
+{
+	int order = buddy_order(size);
+	uint64_t best = UINT64_MAX;
+	int best_order = b->orders;
+
+	if (size == 0 || order >= b->orders)
+		return 0;
+	// smallest free run that fits, lowest address first
+	for (uint64_t i = 0; i < buddy_blocks(b); ) {
+		uint8_t s = b->state[i];
+		int o = s & 0x7f;
+		if ((s & BUDDY_FREE) && o >= order && o < best_order) {
+			best = i;
+			best_order = o;
+		}
+		i += 1UL << o;
+	}
+	if (best == UINT64_MAX)
+		return 0;
+	buddy_split(b, best, best_order, best, order);
+	b->state[best] = order;
+	return b->base + (best << BUDDY_MIN_ORDER);
+}
+
+// Allocate exactly the run at addr, e.g. to restore the state of a previous
+// run or to keep the allocator away from a fixed region. Returns -1 if any
+// part of it is in use.
+int buddy_alloc_at(struct buddy *b, uint64_t addr, uint64_t size)
+{
+	int order = buddy_order(size);
+	uint64_t idx = (addr - b->base) >> BUDDY_MIN_ORDER;
+
+	if (addr < b->base || order >= b->orders || (idx & ((1UL << order) - 1)) != 0 ||
+		idx >= buddy_blocks(b))
+		return -1;
+	for (uint64_t i = 0; i < buddy_blocks(b); ) {
+		uint8_t s = b->state[i];
+		int o = s & 0x7f;
+		if (idx >= i && idx < i + (1UL << o)) {
+			if (!(s & BUDDY_FREE) || o < order)
+				return -1;
+			buddy_split(b, i, o, idx, order);
+			b->state[idx] = order;
+			return 0;
+		}
+		i += 1UL << o;
+	}
+	return -1;
+}
+
+void buddy_free(struct buddy *b, uint64_t addr)
+{
+	uint64_t idx = (addr - b->base) >> BUDDY_MIN_ORDER;
+	if (addr < b->base || idx >= buddy_blocks(b) || (b->state[idx] & BUDDY_FREE) || b->state[idx] == BUDDY_NONE)
+		return;
+	int order = b->state[idx];
+	// merge with the buddy as long as it is a free run of the same order
+	while (order + 1 < b->orders) {
+		uint64_t buddy = idx ^ (1UL << order);
+		if (b->state[buddy] != (BUDDY_FREE | order))
+			break;
+		b->state[buddy] = BUDDY_NONE;
+		b->state[idx] = BUDDY_NONE;
+		idx = MIN(idx, buddy);
+		order++;
+	}
+	b->state[idx] = BUDDY_FREE | order;
+}
@@ -1,22 +1,65 @@
 #ifndef DEF_H
 #define DEF_H
 
+#include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #define ADDR_BITS		33
 #define MEM_BASE_ADDR	0x00000000
 #define DDR_BASE_ADDR	0x200000000UL
 #define HBM_BASE_ADDR	0x00000000U
+#define HBM_CHANNEL_SIZE	MB(256)
+#define HBM_CHANNEL_NUM		16
 #define FPGAMSHR_EXISTS	1
 #define NUM_SPMV		4
 
-int qdmafd;
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-int qdma_read(uint64_t addr, void *data, size_t size) {
+#define KB(x)	((uint64_t)(x) * 1024)
+#define MB(x)	((uint64_t)(x) * 1024 * 1024)
+#define GB(x)	((uint64_t)(x) * 1024 * 1024 * 1024)
+
+#include "uring.c"
+
+int qdmafd = -1;
+static char qdma_path[256];
+// QDMA queue of the calling thread, see qdma_queue_open(); -1 uses qdmafd
+static __thread int qdma_queue_fd = -1;
+
+static inline int qdma_fd(void) {
+	return qdma_queue_fd >= 0 ? qdma_queue_fd : qdmafd;
+}
+
+// One element of a batched register access.
+struct qdma_iov {
+	uint64_t addr;
+	void *data;
+	size_t size;
+};
+
+// Transport backend: every qdma_read/qdma_write goes through qdma_ops, so the
+// host program can run either on the QDMA character device or on the
+// userspace stand-in device of qdma_emu.c.
+struct qdma_transport {
+	const char *name;
+	int (*read)(uint64_t addr, void *data, size_t size);
+	int (*write)(uint64_t addr, void *data, size_t size);
+	int (*readv)(const struct qdma_iov *iov, int n);
+	// fd that becomes readable when a DMA transfer or SpMV run may have
+	// completed, or -1 if the transport cannot signal completions
+	int (*event_fd)(void);
+	void (*close)(void);
+};
+
+static int qdma_dev_read(uint64_t addr, void *data, size_t size) {
 	// if (lseek(qdmafd, addr, SEEK_SET) < 0 ||
 		// read(qdmafd, data, size) < 0)
-	if (pread(qdmafd, data, size, addr) < 0)
+	if (pread(qdma_fd(), data, size, addr) < 0)
 	{
 		// perror("qdma_read");
 		return -1;
@@ -24,10 +67,10 @@ int qdma_read(uint64_t addr, void *data, size_t size) {
 	return 0;
 }
 
-int qdma_write(uint64_t addr, void *data, size_t size) {
+static int qdma_dev_write(uint64_t addr, void *data, size_t size) {
 	// if (lseek(qdmafd, addr, SEEK_SET) < 0 ||
 	// 	write(qdmafd, data, size) < 0)
-	if (pwrite(qdmafd, data, size, addr) < 0)
+	if (pwrite(qdma_fd(), data, size, addr) < 0)
 	{
 		// perror("qdma_write");
 		return -1;
@@ -35,4 +78,154 @@ int qdma_write(uint64_t addr, void *data, size_t size) {
 	return 0;
 }
 
+#define QDMA_URING_DEPTH	64
+
+static struct uring qdma_uring = { .fd = -1 };
+static int qdma_uring_state;		// 0: not set up yet, 1: usable, -1: unavailable
+static pthread_mutex_t qdma_uring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Issue all reads in one io_uring submission. Falls back to one pread per
+// element when io_uring is not available for the device.
+static int qdma_dev_readv(const struct qdma_iov *iov, int n) {
+	int done = 0, ret = 0;
+
+	pthread_mutex_lock(&qdma_uring_lock);
+	if (qdma_uring_state == 0)
+		qdma_uring_state = uring_init(&qdma_uring, QDMA_URING_DEPTH) < 0 ? -1 : 1;
+	while (qdma_uring_state > 0 && done < n) {
+		int queued = 0;
+		while (done + queued < n &&
+				uring_queue_rw(&qdma_uring, 0, qdmafd, iov[done + queued].data,
+								iov[done + queued].size, iov[done + queued].addr, done + queued) == 0)
+			queued++;
+		if (uring_submit(&qdma_uring, queued) < 0) {
+			qdma_uring_state = -1;
+			break;
+		}
+		for (int reaped = 0; reaped < queued; ) {
+			int res;
+			uint64_t i;
+			if (!uring_reap(&qdma_uring, &res, &i)) {
+				uring_submit(&qdma_uring, 1);
+				continue;
+			}
+			reaped++;
+			// a failure, e.g. a driver without read_iter support, or a short
+			// read: redo it synchronously
+			if (res != (ssize_t)iov[i].size &&
+					pread(qdmafd, iov[i].data, iov[i].size, iov[i].addr) != (ssize_t)iov[i].size)
+				ret = -1;
+		}
+		done += queued;
+	}
+	pthread_mutex_unlock(&qdma_uring_lock);
+
+	for (; done < n; done++) {
+		if (pread(qdmafd, iov[done].data, iov[done].size, iov[done].addr) != (ssize_t)iov[done].size)
+			ret = -1;
+	}
+	return ret;
+}
+
+// User interrupt node of the QDMA driver, given with "-w event:PATH". The
+// design must route the DMA IOC and SpMV ap_done interrupts to usr_irq.
+static char qdma_event_path[256];
+static int qdma_event_dev_fd = -1;
+
+static int qdma_dev_event_fd(void) {
+	if (qdma_event_dev_fd < 0 && qdma_event_path[0] != '\0') {
+		qdma_event_dev_fd = open(qdma_event_path, O_RDONLY);
+		if (qdma_event_dev_fd < 0) {
+			perror(qdma_event_path);
+			qdma_event_path[0] = '\0';
+		}
+	}
+	return qdma_event_dev_fd;
+}
+
+static void qdma_dev_close(void) {
+	if (qdma_event_dev_fd >= 0)
+		close(qdma_event_dev_fd);
+	qdma_event_dev_fd = -1;
+	if (qdma_uring_state > 0)
+		uring_exit(&qdma_uring);
+	qdma_uring_state = 0;
+	if (qdmafd >= 0)
+		close(qdmafd);
+	qdmafd = -1;
+}
+
+struct qdma_transport qdma_dev_ops = {
+	.name = "qdma",
+	.read = qdma_dev_read,
+	.write = qdma_dev_write,
+	.readv = qdma_dev_readv,
+	.event_fd = qdma_dev_event_fd,
+	.close = qdma_dev_close,
+};
+
+struct qdma_transport *qdma_ops = &qdma_dev_ops;
+
+int qdma_read(uint64_t addr, void *data, size_t size) {
+	return qdma_ops->read(addr, data, size);
+}
+
+int qdma_write(uint64_t addr, void *data, size_t size) {
+	return qdma_ops->write(addr, data, size);
+}
+
+// Read n (possibly scattered) locations with as few submissions as the transport allows.
+int qdma_readv(const struct qdma_iov *iov, int n) {
+	return qdma_ops->readv(iov, n);
+}
+
+int qdma_event_fd(void) {
+	return qdma_ops->event_fd ? qdma_ops->event_fd() : -1;
+}
+
+// Implemented in qdma_emu.c
+int qdma_emu_open(const char *spec);
+
+// Implemented in timing.c, the clock of every host timestamp
+uint64_t timing_now(void);
+
+// path is either a QDMA device node (e.g. /dev/qdma01000-MM-0) or
+// "emu[:options]" for the userspace stand-in device.
+int qdma_open(const char *path) {
+	if (strncmp(path, "emu", 3) == 0 && (path[3] == '\0' || path[3] == ':'))
+		return qdma_emu_open(path);
+	qdmafd = open(path, O_RDWR);
+	if (qdmafd < 0)
+		return -1;
+	qdma_ops = &qdma_dev_ops;
+	snprintf(qdma_path, sizeof(qdma_path), "%s", path);
+	return 0;
+}
+
+// Bind the calling thread to QDMA queue idx, i.e. the device node of
+// qdma_open() with its queue number replaced (/dev/qdma01000-MM-<idx>).
+// Threads without a queue of their own keep sharing the main one.
+// Returns -1 if the queue does not exist.
+int qdma_queue_open(int idx) {
+	char path[256 + 16];
+	char *p = strrchr(qdma_path, '-');
+	if (qdma_ops != &qdma_dev_ops || p == NULL)
+		return -1;
+	snprintf(path, sizeof(path), "%.*s-%d", (int)(p - qdma_path), qdma_path, idx);
+	if (strcmp(path, qdma_path) == 0)
+		return 0;
+	qdma_queue_fd = open(path, O_RDWR);
+	return qdma_queue_fd < 0 ? -1 : 0;
+}
+
+void qdma_queue_close(void) {
+	if (qdma_queue_fd >= 0)
+		close(qdma_queue_fd);
+	qdma_queue_fd = -1;
+}
+
+void qdma_close(void) {
+	qdma_ops->close();
+}
+
 #endif
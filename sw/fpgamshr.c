@@ -4,6 +4,8 @@
 #include <time.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
 #include "def.h"
 
 #define MEMORY_SPAN					(1 << ADDR_BITS)
@@ -11,6 +13,7 @@
 #define NUM_INPUTS					4
 #define NUM_MEMPORT					1
 #define ROB_DEPTH					0
+#define USE_ROB						(ROB_DEPTH > 0)
 #define MSHR_HASH_TABLES			4
 #define MSHR_PER_HASH_TABLE			(1024 * 1)
 #define SE_BUF_ENTRIES_PER_ROW		3
@@ -68,9 +71,20 @@
 #define ROB_CYCLES_FULL_STALLED						(5)
 #define ROB_CYCLES_REQS_IN_STALLED					(6)
 #define ROB_CYCLES_REQS_OUT_STALLED					(7)
+#if USE_ROB
+#define ROB_CYCLES_RESP_IN_STALLED					(8)
+#define ROB_CYCLES_RESP_OUT_STALLED					(9)
+#define ROB_REGS									10
+#else
 #define ROB_CYCLES_RESP_OUT_STALLED					(8)
+#define ROB_REGS									9
+#endif
 
 static uint64_t _fpgamshr_base;
+// The snapshot latch is shared by the sampler thread, the snapshots and the
+// profiling reads: a trigger and the reads of what it latched hold this lock,
+// so no other trigger can overwrite the values halfway through a read.
+static pthread_mutex_t _fpgamshr_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
 
 uint64_t FPGAMSHR_Read_reg(uint32_t offset) {
 	uint64_t data;
@@ -110,6 +124,14 @@ void FPGAMSHR_Profiling_snapshot() {
 	FPGAMSHR_Write_reg(0, 2);
 }
 
+void FPGAMSHR_Snapshot_lock() {
+	pthread_mutex_lock(&_fpgamshr_snapshot_lock);
+}
+
+void FPGAMSHR_Snapshot_unlock() {
+	pthread_mutex_unlock(&_fpgamshr_snapshot_lock);
+}
+
 void FPGAMSHR_Invalidate_cache() {
 	// *(volatile uint32_t*)fpgamshr_base = 4;
 	FPGAMSHR_Write_reg(0, 4);
@@ -144,10 +166,155 @@ void FPGAMSHR_SetMaxSubentryRow(uint64_t subRowNum) {
 	FPGAMSHR_Write_reg(32, subRowNum);
 }
 
-void FPGAMSHR_Get_stats_log(const char *benchname) {
-	// get snapshot
+#if FPGAMSHR_EXISTS
+static const char *items_cache[] = {
+	"received requests",
+	"hits",
+	"cycles out misses stall",
+	"cycles out data stall",
+	"cycles hits on out misses stall",
+	"cycles pipeline stalls",
+};
+
+static const char *items_mshr[] = {
+	"currently used MSHR",
+	"max used MSHR",
+#if MSHR_HASH_TABLES > 0
+	"collison trigger count",
+	"cycles spent handling collisons",
+#else // MSHR_HASH_TABLES > 0
+	"cycles MSHR full",
+	"cycles LdBuf full",
+#endif // MSHR_HASH_TABLES > 0
+	"stall trigger count",
+	"cycles spent stalling",
+	"accepted allocs count",
+	"accepted deallocs count",
+	"cycles allocs stall",
+	"cycles deallocs stall",
+	"enqueued mem reqs count",
+	"cycles out LdBuf not ready",
+	"accum used MSHR",
+	"cycles allocs stall LdBuf"
+};
+
+static const char *items_subentry[] = {
+	"currently used entries",
+	"max used entries",
+	"currently used rows",
+	"max used rows",
+	"currently rows with NextRowPtr valid",
+	"max rows with NextRowPtr valid",
+	"cycles RespGen stall",
+	"cycles write pipeline stall",
+	"cycles valid NextPtr input stall",
+	"NextPtr cache hits",
+	"accum used entries",
+	"accum used rows",
+	"cycles FRQ stop alloc"
+};
+
+static const char *items_respgen[] = {
+	"accepted inputs count",
+	"responses sent out count",
+	"cycles out not ready"
+};
+#endif // FPGAMSHR_EXISTS
+
+// Registers of ReorderBufferAXI, or of the dummy buffer of designs built
+// without a reorder buffer, which has no "cycles resp in stall".
+static const char *items_input[] = {
+	"received requests",
+	"received responses",
+	"currently used entries",
+	"max used entries",
+	"sent responses",
+	"cycles full stall",
+	"cycles reqs in stall",
+	"cycles reqs out stall",
+#if USE_ROB
+	"cycles resp in stall",
+#endif
+	"cycles resp out stall"
+};
+
+// for NUM_MEMPORT == 1
+static const char *items_misc[] = {
+	"total cycles",
+	"mem cycles not ready",
+	"mem sent requests",
+	"mem received responses"
+};
+
+// One profiling snapshot, read in one batch by FPGAMSHR_Read_stats(). Only
+// uint64_t arrays, so it is also a flat array of counters in block order.
+struct fpgamshr_stats {
+#if FPGAMSHR_EXISTS
+	uint64_t cache[NUM_REQ_HANDLERS][6];
+	uint64_t mshr[NUM_REQ_HANDLERS][14];
+	uint64_t subentry[NUM_REQ_HANDLERS][13];
+	uint64_t respgen[NUM_REQ_HANDLERS][3];
+#endif
+	uint64_t input[NUM_INPUTS][ROB_REGS];
+	uint64_t misc[1 + NUM_MEMPORT * 3];
+};
+
+// Where the blocks of struct fpgamshr_stats are in the register map.
+struct fpgamshr_stats_block {
+	const char *name;
+	const char **items;
+	uint32_t reg;			// first register of instance 0
+	uint32_t stride;		// registers between instances
+	uint32_t instances;
+	uint32_t words;			// counters per instance
+	size_t offset;			// in struct fpgamshr_stats
+};
+
+#define STATS_BLOCK(name, reg, stride, field) \
+	{ #name, items_##name, reg, stride, sizeof(((struct fpgamshr_stats *)0)->field) / sizeof(((struct fpgamshr_stats *)0)->field[0]), \
+		sizeof(((struct fpgamshr_stats *)0)->field[0]) / sizeof(uint64_t), offsetof(struct fpgamshr_stats, field) }
+
+static const struct fpgamshr_stats_block fpgamshr_stats_blocks[] = {
+#if FPGAMSHR_EXISTS
+	STATS_BLOCK(cache, 0, REGS_PER_REQ_HANDLER, cache),
+	STATS_BLOCK(mshr, REGS_PER_REQ_HANDLER_MODULE, REGS_PER_REQ_HANDLER, mshr),
+	STATS_BLOCK(subentry, 2 * REGS_PER_REQ_HANDLER_MODULE, REGS_PER_REQ_HANDLER, subentry),
+	STATS_BLOCK(respgen, RESP_GEN_ACCEPTED_INPUTS_OFFSET, REGS_PER_REQ_HANDLER, respgen),
+#endif
+	STATS_BLOCK(input, NUM_REQ_HANDLERS * REGS_PER_REQ_HANDLER, REGS_PER_REQ_HANDLER, input),
+	{ "misc", items_misc, (NUM_INPUTS + NUM_REQ_HANDLERS) * REGS_PER_REQ_HANDLER, 0, 1,
+		1 + NUM_MEMPORT * 3, offsetof(struct fpgamshr_stats, misc) },
+};
+
+#define FPGAMSHR_STATS_BLOCKS	(sizeof(fpgamshr_stats_blocks) / sizeof(fpgamshr_stats_blocks[0]))
+
+// Take a profiling snapshot and read all of its counters with one batch.
+int FPGAMSHR_Read_stats(struct fpgamshr_stats *s) {
+	struct qdma_iov iov[NUM_REQ_HANDLERS * 4 + NUM_INPUTS + 1];
+	int n = 0;
+
+	FPGAMSHR_Snapshot_lock();
 	FPGAMSHR_Profiling_snapshot();
+	for (int b = 0; b < FPGAMSHR_STATS_BLOCKS; b++) {
+		const struct fpgamshr_stats_block *blk = &fpgamshr_stats_blocks[b];
+		for (int i = 0; i < blk->instances; i++) {
+			iov[n].addr = _fpgamshr_base + (uint64_t)(blk->reg + i * blk->stride) * sizeof(uint64_t);
+			iov[n].data = (char *)s + blk->offset + i * blk->words * sizeof(uint64_t);
+			iov[n].size = blk->words * sizeof(uint64_t);
+			n++;
+		}
+	}
+	if (qdma_readv(iov, n) < 0) {
+		perror("FPGAMSHR read statistic");
+		FPGAMSHR_Snapshot_unlock();
+		return -1;
+	}
+	FPGAMSHR_Snapshot_unlock();
+	return 0;
+}
 
+// Write a snapshot to a timestamp-named CSV file.
+void FPGAMSHR_Write_stats_log(const char *benchname, const struct fpgamshr_stats *s) {
 	time_t now;
 	time(&now);
 	struct tm *t = localtime(&now);
@@ -155,45 +322,9 @@ void FPGAMSHR_Get_stats_log(const char *benchname) {
 	snprintf(filename, sizeof(filename), "%s_%02d%02d%02d%02d%02d.csv", benchname, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
 	FILE *flog = fopen(filename, "w");
 	int i;
-#if FPGAMSHR_EXISTS
-	uint64_t stats_cache[NUM_REQ_HANDLERS][6];
-	uint64_t stats_mshr[NUM_REQ_HANDLERS][14];
-	uint64_t stats_subentry[NUM_REQ_HANDLERS][13];
-	uint64_t stats_respgen[NUM_REQ_HANDLERS][3];
-
-	for (i = 0; i < NUM_REQ_HANDLERS; i++) {
-		uint64_t handler_offset = i * REGS_PER_REQ_HANDLER;
-		if (qdma_read(_fpgamshr_base + handler_offset * sizeof(uint64_t),
-			stats_cache[i], sizeof(stats_cache[i])) < 0) {
-			perror("FPGAMSHR read cache statistic");
-		}
-		if (qdma_read(_fpgamshr_base + (handler_offset + REGS_PER_REQ_HANDLER_MODULE) * sizeof(uint64_t),
-			stats_mshr[i], sizeof(stats_mshr[i])) < 0) {
-			perror("FPGAMSHR read mshr statistic");
-		}
-		if (qdma_read(_fpgamshr_base + (handler_offset + 2 * REGS_PER_REQ_HANDLER_MODULE) * sizeof(uint64_t),
-			stats_subentry[i], sizeof(stats_subentry[i])) < 0) {
-			perror("FPGAMSHR read subentry statistic");
-		}
-		if (qdma_read(_fpgamshr_base + (handler_offset + RESP_GEN_ACCEPTED_INPUTS_OFFSET) * sizeof(uint64_t),
-			stats_respgen[i], sizeof(stats_respgen[i])) < 0) {
-			perror("FPGAMSHR read respgen statistic");
-		}
-	}
-#endif
-
-	uint64_t stats_input[NUM_INPUTS][9];
-	uint64_t misc_statistic[1 + NUM_MEMPORT * 3];
-
-	for (i = 0; i < NUM_INPUTS; i++) {
-		if (qdma_read(_fpgamshr_base + (NUM_REQ_HANDLERS + i) * REGS_PER_REQ_HANDLER * sizeof(uint64_t),
-			stats_input[i], sizeof(stats_input[i])) < 0) {
-			perror("FPGAMSHR read input statistic");
-		}
-	}
-	if (qdma_read(_fpgamshr_base + (NUM_INPUTS + NUM_REQ_HANDLERS) * REGS_PER_REQ_HANDLER * sizeof(uint64_t),
-		misc_statistic, sizeof(misc_statistic)) < 0) {
-		perror("FPGAMSHR read misc statistic");
+	if (flog == NULL) {
+		perror(filename);
+		return;
 	}
 
 	// output to log files
@@ -202,116 +333,55 @@ void FPGAMSHR_Get_stats_log(const char *benchname) {
 		fprintf(flog, ",%d", i);
 	}
 	fprintf(flog, "\n\nCache");
-	const char *items_cache[] = {
-		"received requests",
-		"hits",
-		"cycles out misses stall",
-		"cycles out data stall",
-		"cycles hits on out misses stall",
-		"cycles pipeline stalls",
-	};
-	for (i = 0; i < sizeof(stats_cache[0])/sizeof(stats_cache[0][0]); i++) {
+	for (i = 0; i < sizeof(s->cache[0])/sizeof(s->cache[0][0]); i++) {
 		fprintf(flog, "\n%s", items_cache[i]);
 		for (int j = 0; j < NUM_REQ_HANDLERS; j++) {
-			fprintf(flog, ",%lu", stats_cache[j][i]);
+			fprintf(flog, ",%lu", s->cache[j][i]);
 		}
 		if (i == 1) {
 			fprintf(flog, "\nhit rate");
 			for (int j = 0; j < NUM_REQ_HANDLERS; j++) {
-				fprintf(flog, ",%lf", (double)stats_cache[j][1]/stats_cache[j][0]);
+				fprintf(flog, ",%lf", (double)s->cache[j][1]/s->cache[j][0]);
 			}
 		}
 	}
 
 #if MSHR_PER_HASH_TABLE > 0
 	fprintf(flog, "\n\nMSHR");
-	const char *items_mshr[] = {
-		"currently used MSHR",
-		"max used MSHR",
-	#if MSHR_HASH_TABLES > 0
-		"collison trigger count",
-		"cycles spent handling collisons",
-	#else // MSHR_HASH_TABLES > 0
-		"cycles MSHR full",
-		"cycles LdBuf full",
-	#endif // MSHR_HASH_TABLES > 0
-		"stall trigger count",
-		"cycles spent stalling",
-		"accepted allocs count",
-		"accepted deallocs count",
-		"cycles allocs stall",
-		"cycles deallocs stall",
-		"enqueued mem reqs count",
-		"cycles out LdBuf not ready",
-		"accum used MSHR",
-		"cycles allocs stall LdBuf"
-	};
-	for (i = 0; i < sizeof(stats_mshr[0])/sizeof(stats_mshr[0][0]); i++) {
+	for (i = 0; i < sizeof(s->mshr[0])/sizeof(s->mshr[0][0]); i++) {
 		fprintf(flog, "\n%s", items_mshr[i]);
 		for (int j = 0; j < NUM_REQ_HANDLERS; j++) {
-			fprintf(flog, ",%lu", stats_mshr[j][i]);
+			fprintf(flog, ",%lu", s->mshr[j][i]);
 		}
 	}
 
 	fprintf(flog, "\n\nSubentry buffer");
-	const char *items_subentry[] = {
-		"currently used entries",
-		"max used entries",
-		"currently used rows",
-		"max used rows",
-		"currently rows with NextRowPtr valid",
-		"max rows with NextRowPtr valid",
-		"cycles RespGen stall",
-		"cycles write pipeline stall",
-		"cycles valid NextPtr input stall",
-		"NextPtr cache hits",
-		"accum used entries",
-		"accum used rows",
-		"cycles FRQ stop alloc"
-	};
-	for (i = 0; i < sizeof(stats_subentry[0])/sizeof(stats_subentry[0][0]); i++) {
+	for (i = 0; i < sizeof(s->subentry[0])/sizeof(s->subentry[0][0]); i++) {
 		fprintf(flog, "\n%s", items_subentry[i]);
 		for (int j = 0; j < NUM_REQ_HANDLERS; j++) {
-			fprintf(flog, ",%lu", stats_subentry[j][i]);
+			fprintf(flog, ",%lu", s->subentry[j][i]);
 		}
 	}
 
 	fprintf(flog, "\n\nResponse Generator");
-	const char *items_respgen[] = {
-		"accepted inputs count",
-		"responses sent out count",
-		"cycles out not ready"
-	};
-	for (i = 0; i < sizeof(stats_respgen[0])/sizeof(stats_respgen[0][0]); i++) {
+	for (i = 0; i < sizeof(s->respgen[0])/sizeof(s->respgen[0][0]); i++) {
 		fprintf(flog, "\n%s", items_respgen[i]);
 		for (int j = 0; j < NUM_REQ_HANDLERS; j++) {
-			fprintf(flog, ",%lu", stats_respgen[j][i]);
+			fprintf(flog, ",%lu", s->respgen[j][i]);
 		}
 	}
 #endif // MSHR_PER_HASH_TABLE > 0
 #endif // FPGAMSHR_EXISTS
 
 	fprintf(flog, "\n\nROB Input");
-	const char *items_input[] = {
-		"received requests",
-		"received responses",
-		"currently used entries",
-		"max used entries",
-		"sent responses",
-		"cycles full stall",
-		"cycles reqs in stall",
-		"cycles reqs out stall",
-		// "cycles resp in stall",
-		"cycles resp out stall"
-	};
-	for (i = 0; i < sizeof(stats_input[0])/sizeof(stats_input[0][0]); i++) {
+	for (i = 0; i < sizeof(s->input[0])/sizeof(s->input[0][0]); i++) {
 		fprintf(flog, "\n%s", items_input[i]);
 		for (int j = 0; j < NUM_INPUTS; j++) {
-			fprintf(flog, ",%lu", stats_input[j][i]);
+			fprintf(flog, ",%lu", s->input[j][i]);
 		}
 	}
 
-	fprintf(flog, "\n\ntotal cycles,%lu\n", misc_statistic[0]);
+	fprintf(flog, "\n\ntotal cycles,%lu\n", s->misc[0]);
 
 	// const char *items_mem[] = {
 	// 	"cycles not ready",
@@ -321,116 +391,117 @@ void FPGAMSHR_Get_stats_log(const char *benchname) {
 	// for (i = 0; i < sizeof(items_mem)/sizeof(items_mem[0]); i++) {
 	// 	fprintf(flog, "\n%s", items_mem[i]);
 	// 	for (int j = 0; j < NUM_MEMPORT; j++) {
-	// 		fprintf(flog, ",%lu", misc_statistic[1 + j + i * NUM_MEMPORT]);
+	// 		fprintf(flog, ",%lu", s->misc[1 + j + i * NUM_MEMPORT]);
 	// 	}
 	// }
 	fprintf(flog, "\nMemory Interface\nPC#,cycles not ready,sent requests,received responses");
 	for (i = 0; i < NUM_MEMPORT; i++) {
 		fprintf(flog, "\n%d", i);
 		for (int j = 0; j < 3; j++) {
-			fprintf(flog, ",%lu", misc_statistic[1 + i + j * NUM_MEMPORT]);
+			fprintf(flog, ",%lu", s->misc[1 + i + j * NUM_MEMPORT]);
 		}
 	}
 	fprintf(flog, "\n");
 	fclose(flog);
 }
 
-#define MAX_FPGAMSHR_RUNTIME_LOG_NUM 10000
-static uint64_t fpgamshr_runtime_log_cache[MAX_FPGAMSHR_RUNTIME_LOG_NUM][NUM_REQ_HANDLERS][4];
-static uint64_t fpgamshr_runtime_log_mshr[MAX_FPGAMSHR_RUNTIME_LOG_NUM][NUM_REQ_HANDLERS][14];
-static uint64_t fpgamshr_runtime_log_misc[MAX_FPGAMSHR_RUNTIME_LOG_NUM][1 + NUM_MEMPORT * 3];
-static int fpgamshr_runtime_log_idx = 0;
-
-void FPGAMSHR_Get_runtime_log() {
-	if (fpgamshr_runtime_log_idx >= MAX_FPGAMSHR_RUNTIME_LOG_NUM)
-		return;
+void FPGAMSHR_Get_stats_log(const char *benchname) {
+	struct fpgamshr_stats s;
+	FPGAMSHR_Read_stats(&s);
+	FPGAMSHR_Write_stats_log(benchname, &s);
+}
 
+static const char *items_runtime_cache[] = {
+	"received requests",
+	"hits",
+	// "cycles out misses stall",
+	// "cycles out data stall",
+};
+
+static const char *items_runtime_mshr[] = {
+	"currently used MSHR",
+	"max used MSHR",
+	"collison trigger count",
+	"cycles spent handling collisons",
+	"stall trigger count",
+	"cycles spent stalling",
+	"accepted allocs count",
+	"accepted deallocs count",
+	"cycles allocs stall",
+	"cycles deallocs stall",
+	"enqueued mem reqs count",
+	"cycles out LdBuf not ready",
+	"accum used MSHR",
+	// "cycles allocs stall LdBuf"
+};
+
+// Counters of one runtime sample, taken by the sampler thread (see sampler.c).
+// Only uint64_t arrays, so it is also a flat array of counters.
+struct fpgamshr_runtime {
+	uint64_t cache[NUM_REQ_HANDLERS][4];
+	uint64_t mshr[NUM_REQ_HANDLERS][14];
+	uint64_t misc[1 + NUM_MEMPORT * 3];
+};
+
+// Take a profiling snapshot and read the counters of a runtime sample with one batch.
+int FPGAMSHR_Read_runtime(struct fpgamshr_runtime *r) {
+	struct qdma_iov iov[NUM_REQ_HANDLERS * 2 + 1];
+	int n = 0;
+
+	FPGAMSHR_Snapshot_lock();
 	FPGAMSHR_Profiling_snapshot();
-
 	for (int i = 0; i < NUM_REQ_HANDLERS; i++) {
-	// for (int i = 0; i < 1; i++) {
 		uint64_t handler_offset = i * REGS_PER_REQ_HANDLER;
-		if (qdma_read(_fpgamshr_base + handler_offset * sizeof(uint64_t),
-			fpgamshr_runtime_log_cache[fpgamshr_runtime_log_idx][i], sizeof(fpgamshr_runtime_log_cache[fpgamshr_runtime_log_idx][i])) < 0) {
-			perror("FPGAMSHR read cache statistic");
-		}
-		if (qdma_read(_fpgamshr_base + (handler_offset + REGS_PER_REQ_HANDLER_MODULE) * sizeof(uint64_t),
-			fpgamshr_runtime_log_mshr[fpgamshr_runtime_log_idx][i], sizeof(fpgamshr_runtime_log_mshr[fpgamshr_runtime_log_idx][i])) < 0) {
-			perror("FPGAMSHR read MSHR statistic");
-		}
+		iov[n].addr = _fpgamshr_base + handler_offset * sizeof(uint64_t);
+		iov[n].data = r->cache[i];
+		iov[n].size = sizeof(r->cache[i]);
+		n++;
+		iov[n].addr = _fpgamshr_base + (handler_offset + REGS_PER_REQ_HANDLER_MODULE) * sizeof(uint64_t);
+		iov[n].data = r->mshr[i];
+		iov[n].size = sizeof(r->mshr[i]);
+		n++;
 	}
-	if (qdma_read(_fpgamshr_base + (NUM_INPUTS + NUM_REQ_HANDLERS) * REGS_PER_REQ_HANDLER * sizeof(uint64_t),
-		fpgamshr_runtime_log_misc[fpgamshr_runtime_log_idx], sizeof(fpgamshr_runtime_log_misc[fpgamshr_runtime_log_idx])) < 0) {
-		perror("FPGAMSHR read misc statistic");
+	iov[n].addr = _fpgamshr_base + (NUM_INPUTS + NUM_REQ_HANDLERS) * REGS_PER_REQ_HANDLER * sizeof(uint64_t);
+	iov[n].data = r->misc;
+	iov[n].size = sizeof(r->misc);
+	if (qdma_readv(iov, n + 1) < 0) {
+		perror("FPGAMSHR read runtime statistic");
+		FPGAMSHR_Snapshot_unlock();
+		return -1;
 	}
-	fpgamshr_runtime_log_idx++;
+	FPGAMSHR_Snapshot_unlock();
+	return 0;
 }
 
-void FPGAMSHR_Output_runtime_log(const char *benchname) {
-	time_t now;
-	time(&now);
-	struct tm *t = localtime(&now);
-	char filename[256];
-	snprintf(filename, sizeof(filename), "runtime_%s_%02d%02d%02d%02d%02d.csv", benchname, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
-	FILE *flog = fopen(filename, "w");
-
-	printf("Get %d log(s)\n", fpgamshr_runtime_log_idx);
-
-	const char *items_cache[] = {
-		"received requests",
-		"hits",
-		// "cycles out misses stall",
-		// "cycles out data stall",
-	};
-	const char *items_mshr[] = {
-		"currently used MSHR",
-		"max used MSHR",
-		"collison trigger count",
-		"cycles spent handling collisons",
-		"stall trigger count",
-		"cycles spent stalling",
-		"accepted allocs count",
-		"accepted deallocs count",
-		"cycles allocs stall",
-		"cycles deallocs stall",
-		"enqueued mem reqs count",
-		"cycles out LdBuf not ready",
-		"accum used MSHR",
-		// "cycles allocs stall LdBuf"
-	};
-
+// Columns of the runtime log: the counters summed over the request handlers.
+void FPGAMSHR_Write_runtime_header(FILE *flog) {
 	fprintf(flog, "cycles");
-	for (int i = 0; i < sizeof(items_cache)/sizeof(items_cache[0]); i++) {
-		fprintf(flog, ",%s", items_cache[i]);
+	for (int i = 0; i < sizeof(items_runtime_cache)/sizeof(items_runtime_cache[0]); i++) {
+		fprintf(flog, ",%s", items_runtime_cache[i]);
 	}
 	fprintf(flog, ",");
-	for (int i = 0; i < sizeof(items_mshr)/sizeof(items_mshr[0]); i++) {
-		fprintf(flog, ",%s", items_mshr[i]);
+	for (int i = 0; i < sizeof(items_runtime_mshr)/sizeof(items_runtime_mshr[0]); i++) {
+		fprintf(flog, ",%s", items_runtime_mshr[i]);
 	}
+}
 
-	for (int i = 0; i < fpgamshr_runtime_log_idx; i++) {
-		fprintf(flog, "\n%lu", fpgamshr_runtime_log_misc[i][0]);
-		for (int j = 0; j < sizeof(items_cache)/sizeof(items_cache[0]); j++) {
-			uint64_t sum = 0;
-			for (int k = 0; k < NUM_REQ_HANDLERS; k++) {
-				sum += fpgamshr_runtime_log_cache[i][k][j];
-			}
-			// fprintf(flog, ",%lu", fpgamshr_runtime_log_cache[i][0][j]);
-			fprintf(flog, ",%lu", sum);
+void FPGAMSHR_Write_runtime_row(FILE *flog, const struct fpgamshr_runtime *r) {
+	fprintf(flog, "%lu", r->misc[0]);
+	for (int j = 0; j < sizeof(items_runtime_cache)/sizeof(items_runtime_cache[0]); j++) {
+		uint64_t sum = 0;
+		for (int k = 0; k < NUM_REQ_HANDLERS; k++) {
+			sum += r->cache[k][j];
 		}
-		fprintf(flog, ",");
-		for (int j = 0; j < sizeof(items_mshr)/sizeof(items_mshr[0]); j++) {
-			uint64_t sum = 0;
-			for (int k = 0; k < NUM_REQ_HANDLERS; k++) {
-				sum += fpgamshr_runtime_log_mshr[i][k][j];
-			}
-			// fprintf(flog, ",%lu", fpgamshr_runtime_log_mshr[i][0][j]);
-			fprintf(flog, ",%lu", sum);
+		fprintf(flog, ",%lu", sum);
+	}
+	fprintf(flog, ",");
+	for (int j = 0; j < sizeof(items_runtime_mshr)/sizeof(items_runtime_mshr[0]); j++) {
+		uint64_t sum = 0;
+		for (int k = 0; k < NUM_REQ_HANDLERS; k++) {
+			sum += r->mshr[k][j];
 		}
+		fprintf(flog, ",%lu", sum);
 	}
-	fprintf(flog, "\n");
-	fclose(flog);
-	fpgamshr_runtime_log_idx = 0;
 }
 
 /*
@@ -636,6 +707,7 @@ void print_rob_profiling_reg(uint32_t regOffset) {
 }
 
 void FPGAMSHR_Get_stats_row() {
+	FPGAMSHR_Snapshot_lock();
 	FPGAMSHR_Profiling_snapshot();
 	printf("%lu ", FPGAMSHR_Get_extMemCyclesNotReady());
 	print_profiling_reg(CACHE_RECV_REQS_OFFSET);
@@ -668,6 +740,7 @@ void FPGAMSHR_Get_stats_row() {
 	print_profiling_reg(SE_BUF_ACCUM_USED_ENTRIES_OFFSET);
 	print_profiling_reg(SE_BUF_ACCUM_USED_ROWS_OFFSET);
 #endif // MSHR_PER_HASH_TABLE > 0	
+	FPGAMSHR_Snapshot_unlock();
 	printf("\n");
 	// fflush(stdout);
 }
@@ -0,0 +1,620 @@
+/*
+ * Asynchronous matrix loader.
+ *
+ * A file is split into LOADER_CHUNK_SIZE chunks that go through three stages:
+ * file read, optional preprocessing (e.g. col_preprocess) and device write.
+ * Up to loader_depth chunks are in flight, so that the disk, the CPU and
+ * PCIe are busy at the same time. Reads, and writes to the QDMA device, are
+ * issued through io_uring; writes to the stand-in device are synchronous.
+ * The mmap mode skips the bounce buffer for files that need no preprocessing.
+ * On the way, the content of the file is hashed for the resident cache.
+ *
+ * Independent files are loaded concurrently by up to loader_threads workers,
+ * each on a QDMA queue of its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "def.h"
+#include "uring.c"
+
+#define LOADER_CHUNK_SIZE	MB(8)
+#define LOADER_MAX_DEPTH	32
+
+enum load_mode {
+	LOAD_MODE_SYNC,
+	LOAD_MODE_ASYNC,
+	LOAD_MODE_MMAP,
+};
+
+enum load_mode load_mode = LOAD_MODE_ASYNC;
+int loader_mmap_flags;		// MAP_POPULATE
+int loader_mmap_huge;		// madvise(MADV_HUGEPAGE) on the mapping
+int loader_depth = 4;
+int loader_threads = NUM_SPMV;
+static int loader_no_uring;	// set when io_uring turned out to be unavailable
+
+enum {
+	LOAD_STAGE_READ,
+	LOAD_STAGE_PREPROCESS,
+	LOAD_STAGE_WRITE,
+	LOAD_STAGES
+};
+
+// Time each stage had at least one chunk in flight, accumulated over a load_data call.
+struct load_stage_stats {
+	uint64_t bytes;
+	uint64_t busy_ns;
+	uint64_t since_ns;
+	int inflight;
+};
+
+static struct {
+	struct load_stage_stats stage[LOAD_STAGES];
+	uint64_t start_ns;
+	pthread_mutex_t lock;
+} load_stats = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static const char *load_stage_names[LOAD_STAGES] = { "read", "preprocess", "write" };
+
+static void load_stage_begin(int stage, uint64_t now)
+{
+	struct load_stage_stats *s = &load_stats.stage[stage];
+	pthread_mutex_lock(&load_stats.lock);
+	if (s->inflight++ == 0)
+		s->since_ns = now;
+	pthread_mutex_unlock(&load_stats.lock);
+}
+
+static void load_stage_end(int stage, uint64_t bytes, uint64_t now)
+{
+	struct load_stage_stats *s = &load_stats.stage[stage];
+	pthread_mutex_lock(&load_stats.lock);
+	s->bytes += bytes;
+	if (--s->inflight == 0)
+		s->busy_ns += now - s->since_ns;
+	pthread_mutex_unlock(&load_stats.lock);
+}
+
+void load_stats_reset(void)
+{
+	memset(load_stats.stage, 0, sizeof(load_stats.stage));
+	load_stats.start_ns = timing_now();
+}
+
+void load_stats_report(void)
+{
+	uint64_t bytes = load_stats.stage[LOAD_STAGE_WRITE].bytes;
+	uint64_t wall_ns = timing_now() - load_stats.start_ns;
+	if (bytes == 0)
+		return;
+	printf("Load: %.1f MB in %.3f s (%.2f GB/s)",
+			bytes / 1048576.0, wall_ns / 1e9, (double)bytes / wall_ns);
+	for (int i = 0; i < LOAD_STAGES; i++) {
+		struct load_stage_stats *s = &load_stats.stage[i];
+		if (s->busy_ns > 0)
+			printf(", %s %.2f GB/s", load_stage_names[i], (double)s->bytes / s->busy_ns);
+	}
+	printf("\n");
+}
+
+enum load_chunk_state {
+	CHUNK_FREE,
+	CHUNK_READING,
+	CHUNK_WRITING,
+};
+
+struct load_chunk {
+	enum load_chunk_state state;
+	char *buf;
+	off_t off;
+	size_t len;
+	size_t done;	// bytes of the current stage completed so far
+};
+
+// Queue the rest of the current stage of chunk c. Returns -1 if the ring is full.
+static int load_chunk_queue(struct uring *ring, int fd, uint64_t fpga_addr, struct load_chunk *c, int idx)
+{
+	if (c->state == CHUNK_READING)
+		return uring_queue_rw(ring, 0, fd, c->buf + c->done, c->len - c->done, c->off + c->done, idx);
+	return uring_queue_rw(ring, 1, qdma_fd(), c->buf + c->done, c->len - c->done,
+							fpga_addr + c->off + c->done, idx);
+}
+
+static int load_chunk_write(struct uring *ring, uint64_t fpga_addr, struct load_chunk *c, int idx)
+{
+	uint64_t now = timing_now();
+	c->state = CHUNK_WRITING;
+	c->done = 0;
+	load_stage_begin(LOAD_STAGE_WRITE, now);
+	if (qdma_ops == &qdma_dev_ops)
+		return load_chunk_queue(ring, -1, fpga_addr, c, idx);
+	// The stand-in device has no file descriptor to write through io_uring.
+	if (qdma_write(fpga_addr + c->off, c->buf, c->len) < 0) {
+		perror("write vec to FPGA");
+		fprintf(stderr, "fail to write at addr 0x%lx with %ld bytes\n", fpga_addr + c->off, c->len);
+		return -1;
+	}
+	load_stage_end(LOAD_STAGE_WRITE, c->len, timing_now());
+	c->state = CHUNK_FREE;
+	return 0;
+}
+
+static inline uint64_t load_hash_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdUL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53UL;
+	h ^= h >> 33;
+	return h;
+}
+
+// Hash of the LOADER_CHUNK_SIZE block at offset off of a file. The hash of a
+// file is the XOR over its blocks, so the chunks can be hashed in any order.
+// Not cryptographic, it only tells apart files of the same size.
+static uint64_t load_hash_block(const char *buf, size_t len, uint64_t off)
+{
+	uint64_t const k = 0x9e3779b97f4a7c15UL;
+	uint64_t h[4] = { off, off + k, off + 2 * k, off + 3 * k };
+	uint64_t w;
+	size_t i = 0;
+	// four independent lanes to keep the multipliers busy
+	for (; i + 32 <= len; i += 32) {
+		for (int l = 0; l < 4; l++) {
+			memcpy(&w, buf + i + l * 8, 8);
+			h[l] = (h[l] ^ w) * k;
+			h[l] ^= h[l] >> 29;
+		}
+	}
+	for (int l = 0; i < len; i += 8, l++) {
+		w = 0;
+		memcpy(&w, buf + i, MIN(len - i, 8));
+		h[l] = (h[l] ^ w) * k;
+		h[l] ^= h[l] >> 29;
+	}
+	return load_hash_mix(h[0] ^ load_hash_mix(h[1] ^ load_hash_mix(h[2] ^ load_hash_mix(h[3] ^ len))));
+}
+
+// Gather nstrip cache lines that are stride bytes apart in src into dst.
+typedef void (*stripe_copy_fn)(char *dst, const char *src, size_t nstrip, size_t stride);
+
+static void stripe_copy_scalar(char *dst, const char *src, size_t nstrip, size_t stride)
+{
+	for (size_t j = 0; j < nstrip; j++)
+		memcpy(dst + j * CACHELINE_SIZE, src + j * stride, CACHELINE_SIZE);
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#if defined(__x86_64__) && CACHELINE_SIZE == 64
+
+// The staging buffer is only read back by the DMA engine, so the
+// non-temporal stores keep it from evicting the source out of the caches.
+__attribute__((target("avx2")))
+static void stripe_copy_avx2(char *dst, const char *src, size_t nstrip, size_t stride)
+{
+	for (size_t j = 0; j < nstrip; j++) {
+		__m256i lo = _mm256_loadu_si256((const __m256i *)(src + j * stride));
+		__m256i hi = _mm256_loadu_si256((const __m256i *)(src + j * stride + 32));
+		_mm256_stream_si256((__m256i *)(dst + j * 64), lo);
+		_mm256_stream_si256((__m256i *)(dst + j * 64 + 32), hi);
+	}
+	_mm_sfence();
+}
+
+__attribute__((target("avx512f")))
+static void stripe_copy_avx512(char *dst, const char *src, size_t nstrip, size_t stride)
+{
+	for (size_t j = 0; j < nstrip; j++)
+		_mm512_stream_si512((__m512i *)(dst + j * 64), _mm512_loadu_si512(src + j * stride));
+	_mm_sfence();
+}
+#endif
+
+// dst must be CACHELINE_SIZE aligned.
+static stripe_copy_fn stripe_copy_select(void)
+{
+#if defined(__x86_64__) && CACHELINE_SIZE == 64
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return stripe_copy_avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return stripe_copy_avx2;
+#endif
+	return stripe_copy_scalar;
+}
+
+// Column index remapping into the striped HBM layout for a power-of-two
+// channel count: strip = col >> strip_shift is placed in channel
+// strip & ch_mask at strip offset strip >> ch_shift, and a channel spans
+// 1 << base_shift indices.
+struct col_remap {
+	unsigned strip_shift;
+	unsigned ch_shift;
+	uint32_t ch_mask;
+	unsigned base_shift;
+};
+
+typedef void (*col_remap_fn)(uint32_t *col, size_t n, const struct col_remap *r);
+
+static inline uint32_t col_remap_one(uint32_t c, const struct col_remap *r)
+{
+	uint32_t strip = c >> r->strip_shift;
+	return ((strip & r->ch_mask) << r->base_shift) +
+			((strip >> r->ch_shift) << r->strip_shift) +
+			(c & ((1U << r->strip_shift) - 1));
+}
+
+static void col_remap_scalar(uint32_t *col, size_t n, const struct col_remap *r)
+{
+	for (size_t i = 0; i < n; i++)
+		col[i] = col_remap_one(col[i], r);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void col_remap_avx2(uint32_t *col, size_t n, const struct col_remap *r)
+{
+	__m128i const strip_shift = _mm_cvtsi32_si128(r->strip_shift);
+	__m128i const ch_shift = _mm_cvtsi32_si128(r->ch_shift);
+	__m128i const base_shift = _mm_cvtsi32_si128(r->base_shift);
+	__m256i const ch_mask = _mm256_set1_epi32(r->ch_mask);
+	__m256i const elem_mask = _mm256_set1_epi32((1U << r->strip_shift) - 1);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i c = _mm256_loadu_si256((const __m256i *)(col + i));
+		__m256i strip = _mm256_srl_epi32(c, strip_shift);
+		__m256i ch = _mm256_sll_epi32(_mm256_and_si256(strip, ch_mask), base_shift);
+		__m256i off = _mm256_sll_epi32(_mm256_srl_epi32(strip, ch_shift), strip_shift);
+		c = _mm256_add_epi32(_mm256_add_epi32(ch, off), _mm256_and_si256(c, elem_mask));
+		_mm256_storeu_si256((__m256i *)(col + i), c);
+	}
+	col_remap_scalar(col + i, n - i, r);
+}
+
+__attribute__((target("avx512f")))
+static void col_remap_avx512(uint32_t *col, size_t n, const struct col_remap *r)
+{
+	__m128i const strip_shift = _mm_cvtsi32_si128(r->strip_shift);
+	__m128i const ch_shift = _mm_cvtsi32_si128(r->ch_shift);
+	__m128i const base_shift = _mm_cvtsi32_si128(r->base_shift);
+	__m512i const ch_mask = _mm512_set1_epi32(r->ch_mask);
+	__m512i const elem_mask = _mm512_set1_epi32((1U << r->strip_shift) - 1);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i c = _mm512_loadu_si512(col + i);
+		__m512i strip = _mm512_srl_epi32(c, strip_shift);
+		__m512i ch = _mm512_sll_epi32(_mm512_and_si512(strip, ch_mask), base_shift);
+		__m512i off = _mm512_sll_epi32(_mm512_srl_epi32(strip, ch_shift), strip_shift);
+		c = _mm512_add_epi32(_mm512_add_epi32(ch, off), _mm512_and_si512(c, elem_mask));
+		_mm512_storeu_si512(col + i, c);
+	}
+	col_remap_scalar(col + i, n - i, r);
+}
+#endif
+
+static col_remap_fn col_remap_select(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return col_remap_avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return col_remap_avx2;
+#endif
+	return col_remap_scalar;
+}
+
+static col_remap_fn col_remap_impl;
+static pthread_once_t col_remap_once = PTHREAD_ONCE_INIT;
+
+static void col_remap_init(void)
+{
+	col_remap_impl = col_remap_select();
+}
+
+#define COL_REMAP_BLOCK		(1 << 16)
+
+// Remap a chunk of column indices, split over OpenMP threads when it is
+// large enough. Called on every chunk as it passes through the loader, so
+// the rewrite overlaps with the file reads and device writes of other chunks.
+// Up to loader_threads workers remap at once, each with its share of the
+// OpenMP threads.
+static void col_remap(uint32_t *col, size_t n, const struct col_remap *r)
+{
+	pthread_once(&col_remap_once, col_remap_init);
+	size_t nblock = (n + COL_REMAP_BLOCK - 1) / COL_REMAP_BLOCK;
+	int nthread = MAX(omp_get_max_threads() / MAX(loader_threads, 1), 1);
+	#pragma omp parallel for schedule(static) num_threads(nthread) if (nblock > 1 && nthread > 1)
+	for (size_t b = 0; b < nblock; b++)
+		col_remap_impl(col + b * COL_REMAP_BLOCK, MIN(n - b * COL_REMAP_BLOCK, COL_REMAP_BLOCK), r);
+}
+
+// Zero-copy variant of load_vec() for files that need no preprocessing: the
+// file is mapped and its page-cache pages are handed to qdma_write directly,
+// instead of being copied into a bounce buffer first.
+int load_vec_mmap(uint64_t fpga_addr, const char *vec_file, uint32_t *pvec_sz, size_t elem_sz, uint64_t *phash)
+{
+	int vec_fd = open(vec_file, O_RDONLY);
+	if (vec_fd < 0) {
+		fprintf(stderr, "unable to open %s\n", vec_file);
+		return -1;
+	}
+
+	int res = -1;
+	char *map = MAP_FAILED;
+	struct stat st;
+	if (fstat(vec_fd, &st) < 0) {
+		fprintf(stderr, "fail to stat %s\n", vec_file);
+		goto out;
+	}
+	if (st.st_size % elem_sz) {
+		fprintf(stderr, "funny file size that unaligned to data size: %lu to %lu\n", st.st_size, elem_sz);
+		goto out;
+	}
+	*pvec_sz = st.st_size / elem_sz;
+	if (st.st_size == 0) {
+		res = 0;
+		goto out;
+	}
+
+	// without MAP_POPULATE the file is read by page faults during the writes
+	uint64_t map_start = timing_now();
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | loader_mmap_flags, vec_fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap vec file");
+		goto out;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	if (loader_mmap_huge)
+		madvise(map, st.st_size, MADV_HUGEPAGE);	// best effort, needs THP for page cache
+	if (loader_mmap_flags & MAP_POPULATE) {
+		load_stage_begin(LOAD_STAGE_READ, map_start);
+		load_stage_end(LOAD_STAGE_READ, st.st_size, timing_now());
+	}
+
+	for (off_t off = 0; off < st.st_size; off += LOADER_CHUNK_SIZE) {
+		size_t len = MIN(st.st_size - off, LOADER_CHUNK_SIZE);
+		if (phash)
+			*phash ^= load_hash_block(map + off, len, off);
+		load_stage_begin(LOAD_STAGE_WRITE, timing_now());
+		if (qdma_write(fpga_addr + off, map + off, len) < 0) {
+			perror("write vec to FPGA");
+			fprintf(stderr, "fail to write at addr 0x%lx with %ld bytes\n", fpga_addr + off, len);
+			goto out;
+		}
+		load_stage_end(LOAD_STAGE_WRITE, len, timing_now());
+	}
+
+	res = 0;
+out:
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	close(vec_fd);
+	return res;
+}
+
+// Same contract as load_vec(). Returns 1 when io_uring is not available, so
+// that the caller can fall back to the synchronous path.
+int load_vec_async(uint64_t fpga_addr, const char *vec_file, uint32_t *pvec_sz, size_t elem_sz,
+			int (*preprocess)(char*, uint32_t, void *), void *args, uint64_t *phash)
+{
+	struct load_chunk chunks[LOADER_MAX_DEPTH];
+	int depth = MIN(MAX(loader_depth, 1), LOADER_MAX_DEPTH);
+	struct uring ring;
+	int res = -1;
+
+	if (uring_init(&ring, 2 * depth) < 0)
+		return 1;
+
+	int vec_fd = open(vec_file, O_RDONLY);
+	if (vec_fd < 0) {
+		fprintf(stderr, "unable to open %s\n", vec_file);
+		uring_exit(&ring);
+		return -1;
+	}
+
+	memset(chunks, 0, sizeof(chunks));
+	struct stat st;
+	if (fstat(vec_fd, &st) < 0) {
+		fprintf(stderr, "fail to stat %s\n", vec_file);
+		goto out;
+	}
+	if (st.st_size % elem_sz) {
+		fprintf(stderr, "funny file size that unaligned to data size: %lu to %lu\n", st.st_size, elem_sz);
+		goto out;
+	}
+	*pvec_sz = st.st_size / elem_sz;
+
+	size_t chunk_size = MIN(st.st_size, LOADER_CHUNK_SIZE);
+	depth = MIN(depth, (st.st_size + LOADER_CHUNK_SIZE - 1) / LOADER_CHUNK_SIZE);
+	for (int i = 0; i < depth; i++) {
+		chunks[i].buf = malloc(chunk_size);
+		if (chunks[i].buf == NULL) {
+			perror("load vec mem");
+			goto out;
+		}
+	}
+
+	off_t next_off = 0;
+	int busy = 0;
+	for (;;) {
+		// start reading into every free buffer
+		for (int i = 0; i < depth && next_off < st.st_size; i++) {
+			struct load_chunk *c = &chunks[i];
+			if (c->state != CHUNK_FREE)
+				continue;
+			c->state = CHUNK_READING;
+			c->off = next_off;
+			c->len = MIN(st.st_size - next_off, LOADER_CHUNK_SIZE);
+			c->done = 0;
+			if (load_chunk_queue(&ring, vec_fd, fpga_addr, c, i) < 0) {
+				c->state = CHUNK_FREE;
+				break;
+			}
+			load_stage_begin(LOAD_STAGE_READ, timing_now());
+			next_off += c->len;
+			busy++;
+		}
+		if (busy == 0)
+			break;
+		if (uring_submit(&ring, 1) < 0) {
+			perror("io_uring submit");
+			goto out;
+		}
+
+		int cqe_res;
+		uint64_t idx;
+		while (uring_reap(&ring, &cqe_res, &idx)) {
+			struct load_chunk *c = &chunks[idx];
+			if (cqe_res < 0 && c->state == CHUNK_WRITING) {
+				// e.g. a driver without write_iter support: redo it synchronously
+				if (qdma_write(fpga_addr + c->off + c->done, c->buf + c->done, c->len - c->done) == 0)
+					cqe_res = c->len - c->done;
+			}
+			if (cqe_res < 0 || (cqe_res == 0 && c->done < c->len)) {
+				errno = cqe_res < 0 ? -cqe_res : EIO;
+				perror(c->state == CHUNK_READING ? "read vec file" : "write vec to FPGA");
+				fprintf(stderr, "fail at offset 0x%lx of %s\n", c->off, vec_file);
+				goto out;
+			}
+			c->done += cqe_res;
+			if (c->done < c->len) {
+				// short transfer: queue the remainder
+				if (load_chunk_queue(&ring, vec_fd, fpga_addr, c, idx) < 0)
+					goto out;
+				continue;
+			}
+			uint64_t now = timing_now();
+			if (c->state == CHUNK_READING) {
+				if (phash)
+					*phash ^= load_hash_block(c->buf, c->len, c->off);
+				load_stage_end(LOAD_STAGE_READ, c->len, now);
+				if (preprocess) {
+					load_stage_begin(LOAD_STAGE_PREPROCESS, now);
+					preprocess(c->buf, c->len, args);
+					load_stage_end(LOAD_STAGE_PREPROCESS, c->len, timing_now());
+				}
+				if (load_chunk_write(&ring, fpga_addr, c, idx) < 0)
+					goto out;
+				if (c->state == CHUNK_FREE)
+					busy--;
+			} else {
+				load_stage_end(LOAD_STAGE_WRITE, c->len, now);
+				c->state = CHUNK_FREE;
+				busy--;
+			}
+		}
+	}
+	res = 0;
+out:
+	if (res < 0) {
+		// drain what is still in flight before the buffers go away
+		int cqe_res;
+		uint64_t idx;
+		while (ring.inflight > 0 && uring_submit(&ring, 1) == 0)
+			while (uring_reap(&ring, &cqe_res, &idx))
+				;
+	}
+	for (int i = 0; i < LOADER_MAX_DEPTH; i++)
+		free(chunks[i].buf);
+	uring_exit(&ring);
+	close(vec_fd);
+	return res;
+}
+
+int load_vec(uint64_t fpga_addr, const char *vec_file, uint32_t *pvec_sz, size_t elem_sz,
+			int (*preprocess)(char*, uint32_t, void *), void *args, uint64_t *phash);
+
+// One file for load_jobs_run(), the arguments of load_vec().
+struct load_job {
+	uint64_t fpga_addr;
+	char file[256];
+	uint32_t *pvec_sz;
+	size_t elem_sz;
+	int (*preprocess)(char*, uint32_t, void *);
+	void *args;
+	uint64_t *phash;
+};
+
+struct load_pool {
+	struct load_job *jobs;
+	int njobs;
+	int next;		// next job to hand out
+	int failed;
+};
+
+struct load_worker {
+	struct load_pool *pool;
+	int idx;
+	pthread_t tid;
+};
+
+static void *load_worker_main(void *arg)
+{
+	struct load_worker *w = arg;
+	struct load_pool *pool = w->pool;
+
+	// Worker 0 runs on the main queue, the others try queue idx and share
+	// the main one if it has not been added.
+	if (w->idx > 0 && qdma_ops == &qdma_dev_ops && qdma_queue_open(w->idx) < 0)
+		fprintf(stderr, "no QDMA queue %d, loader %d shares queue 0\n", w->idx, w->idx);
+	for (;;) {
+		int i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+		if (i >= pool->njobs || __atomic_load_n(&pool->failed, __ATOMIC_RELAXED))
+			break;
+		struct load_job *j = &pool->jobs[i];
+		if (load_vec(j->fpga_addr, j->file, j->pvec_sz, j->elem_sz, j->preprocess, j->args, j->phash) < 0)
+			__atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+	}
+	qdma_queue_close();
+	return NULL;
+}
+
+// Load all jobs with up to loader_threads concurrent workers.
+int load_jobs_run(struct load_job *jobs, int njobs)
+{
+	struct load_worker workers[LOADER_MAX_DEPTH];
+	struct load_pool pool = { .jobs = jobs, .njobs = njobs };
+	int nworkers = MIN(MIN(MAX(loader_threads, 1), njobs), LOADER_MAX_DEPTH);
+
+	// an io_uring fallback switches load_mode, settle it before going parallel
+	if (load_mode != LOAD_MODE_SYNC) {
+		struct uring ring;
+		if (uring_init(&ring, 1) < 0) {
+			fprintf(stderr, "io_uring unavailable, loading synchronously\n");
+			if (load_mode == LOAD_MODE_ASYNC)
+				load_mode = LOAD_MODE_SYNC;
+			loader_no_uring = 1;
+		}
+		uring_exit(&ring);
+	}
+
+	for (int i = 1; i < nworkers; i++) {
+		workers[i].pool = &pool;
+		workers[i].idx = i;
+		if (pthread_create(&workers[i].tid, NULL, load_worker_main, &workers[i]) != 0) {
+			perror("loader thread");
+			nworkers = i;
+			break;
+		}
+	}
+	workers[0].pool = &pool;
+	workers[0].idx = 0;
+	load_worker_main(&workers[0]);
+	for (int i = 1; i < nworkers; i++)
+		pthread_join(workers[i].tid, NULL);
+	return pool.failed ? -1 : 0;
+}
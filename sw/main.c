@@ -18,10 +18,10 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <omp.h>
 
 #include "def.h"
 #include "xfully_pipelined_spmv.c"
-// #define GET_RUNTIME_LOG
 // #define MSHR_INCLUSIVE
 #ifdef MSHR_INCLUSIVE
 #include "mshrinclusive.c"
@@ -29,45 +29,83 @@
 #include "fpgamshr.c"
 #endif
 #include "xaxi_dma.c"
-
-uint32_t cols;
-uint32_t nnz[NUM_SPMV];
-uint32_t rows[NUM_SPMV];
-uint32_t nout[NUM_SPMV];
-
-#define KB(x)	((uint64_t)(x) * 1024)
-#define MB(x)	((uint64_t)(x) * 1024 * 1024)
-#define GB(x)	((uint64_t)(x) * 1024 * 1024 * 1024)
-
-uint64_t vect_mem = HBM_BASE_ADDR;
-uint64_t vect_mem_host = HBM_BASE_ADDR;
-uint64_t rowptr_mem[NUM_SPMV] = {
-	DDR_BASE_ADDR,
-	DDR_BASE_ADDR + MB(512),
-	DDR_BASE_ADDR + GB(1),
-	DDR_BASE_ADDR + GB(1) + MB(512)
-};
-uint64_t col_mem[NUM_SPMV] = {
-	DDR_BASE_ADDR + GB(2),
-	DDR_BASE_ADDR + GB(2) + MB(512),
-	DDR_BASE_ADDR + GB(2) + GB(1),
-	DDR_BASE_ADDR + GB(2) + GB(1) + MB(512)
+#include "qdma_emu.c"
+#include "loader.c"
+#include "resident.c"
+#include "verify.c"
+#include "refspmv.c"
+#include "snapshot.c"
+#include "sampler.c"
+#include "profiling.c"
+#include "timing.c"
+#include "sweep.c"
+#include "wait.c"
+
+// Second vector of batch mode, in the upper half of the same HBM channels.
+#define HBM_VECT_SLOT_OFFSET	(HBM_CHANNEL_SIZE / 2)
+
+// Rows [r0, r1) of a partition, handed to an accelerator by the dynamic
+// scheduler, see sched_plan().
+struct sched_chunk {
+	int part;
+	uint32_t r0, r1;
+	uint32_t k0;			// first non-zero, counted from the start of the partition
+	uint32_t nnz;
 };
-uint64_t val_mem[NUM_SPMV] = {
-	DDR_BASE_ADDR + GB(4),
-	DDR_BASE_ADDR + GB(4) + MB(512),
-	DDR_BASE_ADDR + GB(4) + GB(1),
-	DDR_BASE_ADDR + GB(4) + GB(1) + MB(512)
+
+// Column tile of a matrix converted with mm2csr -T: the partitions of the
+// accelerators restricted to columns [c0, c1), numbered from c0.
+struct spmv_tile {
+	uint32_t c0, c1;
+	uint64_t vect_off;		// of column c0 from vect_mem, in bytes
+	uint32_t nnz[NUM_SPMV];
+	uint32_t rows[NUM_SPMV];
+	uint64_t rowptr_mem[NUM_SPMV];
+	uint64_t col_mem[NUM_SPMV];
+	uint64_t val_mem[NUM_SPMV];
 };
-uint64_t output_mem[NUM_SPMV] = {
-	DDR_BASE_ADDR + GB(6),
-	DDR_BASE_ADDR + GB(6) + MB(512),
-	DDR_BASE_ADDR + GB(6) + GB(1),
-	DDR_BASE_ADDR + GB(6) + GB(1) + MB(512)
+
+// A matrix loaded by load_data(): the partitions of the accelerators, the
+// vector and the outputs. Batch mode keeps two, see run_batch().
+struct spmv_data {
+	char folder[256];
+	const char *bench_name;		// in folder
+	uint32_t cols;
+	uint32_t nnz[NUM_SPMV];
+	uint32_t rows[NUM_SPMV];
+	uint32_t nout[NUM_SPMV];
+
+	uint64_t vect_mem;
+	// Placed in DDR by load_data(), see resident.c.
+	uint64_t rowptr_mem[NUM_SPMV];
+	uint64_t col_mem[NUM_SPMV];
+	uint64_t val_mem[NUM_SPMV];
+	uint64_t output_mem[NUM_SPMV];
+
+	float* host_output_mem[NUM_SPMV];
+	float* ref_output_mem[NUM_SPMV];
+
+	// -k: the partitions in chunks, largest first
+	struct sched_chunk *chunks;
+	int nchunks;
+
+	// -T: the column tiles, see tile_run(); the partial outputs alternate
+	// between output_mem and tile_output_mem
+	struct spmv_tile *tiles;
+	int ntiles;
+	uint64_t tile_output_mem[NUM_SPMV];
 };
 
-float* host_output_mem[NUM_SPMV] = { NULL };
-float* ref_output_mem[NUM_SPMV] = { NULL };
+int batch_mode;
+int iterations;		// -i: iterative mode, see run_iterations()
+int sched_chunks;	// -k: chunks per accelerator of the dynamic scheduler, 0: static partitions
+int tiled;			// -T: run the column tiles of the matrices, see tile_run()
+
+struct spmv_data spmv_slots[2] = {
+	{ .vect_mem = HBM_BASE_ADDR },
+	{ .vect_mem = HBM_BASE_ADDR + HBM_VECT_SLOT_OFFSET },
+};
+uint64_t spmv_cost_us;		// of the last test_spmv_mult_axis(), per iteration of run_iterations()
 
 uint64_t spmv_bases[NUM_SPMV] = {
 	0x100010000,
@@ -111,15 +149,8 @@ uint64_t fpgamshr_base = 0x100160000;
 // #define NUM_REQ_HANDLERS 4
 // #endif
 
-static void measure(struct timeval *start, struct timeval *end, uint64_t *sec, int *msec)
-{
-	*sec = end->tv_sec - start->tv_sec;
-	*msec = (end->tv_usec - start->tv_usec) / 1000;
-	if (*msec < 0) {
-		*msec += 1000;
-		*sec -= 1;
-	}
-}
+int dma_sg;		// engines are built with scatter-gather, see init_dma()
+int ref_from_exp;	// expected output from the .exp files instead of refspmv.c
 
 void init_dma(int nspmv)
 {
@@ -136,209 +167,552 @@ void init_dma(int nspmv)
 		XAXI_DMA_Enable(val_dma_bases[i], XAXIDMA_DMA_TO_DEVICE);
 		XAXI_DMA_Enable(out_dma_bases[i], XAXIDMA_DEVICE_TO_DMA);
 	}
+	dma_sg = XAXI_DMA_HasSG(row_dma_bases[0], XAXIDMA_DMA_TO_DEVICE) != 0;
+	printf("DMA mode: %s\n", dma_sg ? "scatter-gather" : "direct");
 }
 
 #define DMA_TRANSFER_BITWIDTH	26
 #define MAX_TRANSFER_SIZE_BYTES ((1 << DMA_TRANSFER_BITWIDTH) - 64)
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-int test_spmv_mult_axis(int num_spmv, const char *logname)
+#define DMA_STREAMS_PER_SPMV	4
+
+// Descriptor rings of the scatter-gather mode, at the end of the block of
+// DDR that the allocator keeps for itself.
+#define SG_RING_DESCS	64
+#define SG_DESC_MEM_SIZE	(NUM_SPMV * DMA_STREAMS_PER_SPMV * SG_RING_DESCS * sizeof(struct XAXI_DMA_desc))
+uint64_t sg_desc_mem = DEVMEM_SYS_BASE + DEVMEM_SYS_SIZE - SG_DESC_MEM_SIZE;
+
+typedef struct {
+	uint64_t next_start_addr;
+	uint64_t bytes_left;
+} dma_state_t;
+
+// One DMA engine feeding (or draining) an SpMV accelerator.
+typedef struct {
+	const char *name;
+	int spmv;
+	uint64_t base;
+	int direction;
+	dma_state_t state;
+} dma_stream_t;
+
+// Program the next chunk of a stream. Returns -1 on failure.
+static int dma_stream_send(dma_stream_t *s)
 {
-	typedef struct {
-		uint64_t next_start_addr;
-		uint64_t bytes_left;
-	} dma_state_t;
+	uint32_t bytes_to_send = MIN(s->state.bytes_left, MAX_TRANSFER_SIZE_BYTES);
+	debug_dma_printf("Sending %d bytes %s addr 0x%lX on %s[%d]\n", bytes_to_send,
+					s->direction == XAXIDMA_DMA_TO_DEVICE ? "from" : "to",
+					s->state.next_start_addr, s->name, s->spmv);
+	if (XAXI_DMA_SetAddrLength(s->base, s->state.next_start_addr, bytes_to_send, s->direction) < 0) {
+		return -1;
+	}
+	s->state.next_start_addr += bytes_to_send;
+	s->state.bytes_left -= bytes_to_send;
+	return 0;
+}
 
-	typedef struct {
-		dma_state_t rowptr;
-		dma_state_t col;
-		dma_state_t val;
-		dma_state_t output;
-	} spmv_dma_state_t;
+// Queue all chunks of a stream as one descriptor chain, so the engine
+// streams through them without the host re-arming it. Returns -1 on failure.
+static int dma_stream_send_sg(dma_stream_t *s, int idx)
+{
+	struct XAXI_DMA_desc desc[SG_RING_DESCS];
+	uint64_t desc_addr = sg_desc_mem + idx * SG_RING_DESCS * sizeof(desc[0]);
+	int ndesc = XAXI_DMA_SgBuild(desc, SG_RING_DESCS, desc_addr, s->state.next_start_addr,
+								s->state.bytes_left, MAX_TRANSFER_SIZE_BYTES, s->direction);
+	if (ndesc < 0) {
+		fprintf(stderr, "%s[%d]: %lu bytes need more than %d descriptors\n",
+				s->name, s->spmv, s->state.bytes_left, SG_RING_DESCS);
+		return -1;
+	}
+	debug_dma_printf("Queueing %lu bytes in %d descriptors %s addr 0x%lX on %s[%d]\n", s->state.bytes_left, ndesc,
+					s->direction == XAXIDMA_DMA_TO_DEVICE ? "from" : "to",
+					s->state.next_start_addr, s->name, s->spmv);
+	if (qdma_write(desc_addr, desc, ndesc * sizeof(desc[0])) < 0) {
+		perror("write DMA descriptors");
+		return -1;
+	}
+	if (XAXI_DMA_SgStart(s->base, desc_addr, ndesc, s->direction) < 0)
+		return -1;
+	s->state.next_start_addr += s->state.bytes_left;
+	s->state.bytes_left = 0;
+	return 0;
+}
 
-	spmv_dma_state_t dma_state[num_spmv];
+// State shared by the wait_until() checks of test_spmv_mult_axis().
+struct spmv_run {
+	int num_spmv;
+	const char *logname;
+	dma_stream_t *streams;
+	int nstream;
+	// Status registers gathered with one batched read per check.
+	struct qdma_iov *status_iov;
+	uint32_t *status_regs;
+	int *status_stream;
+	int all_stat;
+	int out_idle;
+	// dynamic scheduler, see sched_check()
+	const struct spmv_data *d;
+	int next;						// chunk to hand out next
+	int chunk_of[NUM_SPMV];			// chunk an accelerator works on, -1 if none
+	int nchunks_of[NUM_SPMV];
+	uint64_t nnz_of[NUM_SPMV];
+};
 
-	struct timeval t1, t2;
-	uint64_t sec;
-	int msec;
+// Re-arm every DMA engine that finished its chunk; done when all chunks are sent.
+static int dma_check(void *arg, uint64_t count, int *done)
+{
+	struct spmv_run *run = arg;
+	int i, nstatus = 0, events = 0;
+	#if DEBUG_DMA == 1
+	uint32_t status, ctrl;
+	if ((count & 0x3fff) == 0) {
+		FPGAMSHR_Get_stats_log(run->logname);
+		status = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMASR);
+		ctrl = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMACR);
+		printf("count %lu:\nrow_dma: status 0x%x, ctrl 0x%x\n", count, status, ctrl);
+		status = XAXI_DMA_ReadReg(col_dma_bases[0], MM2S_DMASR);
+		ctrl = XAXI_DMA_ReadReg(col_dma_bases[0], MM2S_DMACR);
+		printf("col_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+		status = XAXI_DMA_ReadReg(val_dma_bases[0], MM2S_DMASR);
+		ctrl = XAXI_DMA_ReadReg(val_dma_bases[0], MM2S_DMACR);
+		printf("val_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+		status = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMASR);
+		ctrl = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMACR);
+		printf("out_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+	}
+	#endif
+	#ifdef MSHR_INCLUSIVE
+	if ((count & 0x2fff) == 0) {
+		printf("%lu: SpMV not done\n", count);
+		// FPGAMSHR_Get_stats_log(run->logname);
+	}
+	#endif
+	// gather the status of every engine that still has chunks to send
+	for (i = 0; i < run->nstream; i++) {
+		if (run->streams[i].state.bytes_left > 0) {
+			run->status_iov[nstatus].addr = run->streams[i].base + XAXI_DMA_StatusReg(run->streams[i].direction);
+			run->status_iov[nstatus].data = &run->status_regs[nstatus];
+			run->status_iov[nstatus].size = sizeof(run->status_regs[nstatus]);
+			run->status_stream[nstatus] = i;
+			nstatus++;
+		}
+	}
+	*done = nstatus == 0;
+	if (nstatus > 0 && qdma_readv(run->status_iov, nstatus) < 0) {
+		perror("read DMA status");
+		return -1;
+	}
+	for (i = 0; i < nstatus; i++) {
+		if (!XAXI_DMA_StatusBusy(run->status_regs[i])) {
+			if (dma_stream_send(&run->streams[run->status_stream[i]]) < 0) {
+				return -1;
+			}
+			events++;
+		}
+	}
+	return events;
+}
 
-	int i;
+// Done when every accelerator reports ap_idle.
+static int spmv_check(void *arg, uint64_t count, int *done)
+{
+	struct spmv_run *run = arg;
+	int i, all_idle, events = 0;
+	#if DEBUG_DMA == 1
+	uint32_t status, ctrl;
+	if ((count & 0x3fff) == 0) {
+		FPGAMSHR_Get_stats_log(run->logname);
+		printf("spmv stat: 0x%04x\n", run->all_stat);
+		for (int j = 0; j < run->num_spmv; j++) {
+			status = XAXI_DMA_ReadReg(row_dma_bases[j], MM2S_DMASR);
+			ctrl = XAXI_DMA_ReadReg(row_dma_bases[j], MM2S_DMACR);
+			printf("row_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+			status = XAXI_DMA_ReadReg(col_dma_bases[j], MM2S_DMASR);
+			ctrl = XAXI_DMA_ReadReg(col_dma_bases[j], MM2S_DMACR);
+			printf("col_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+			status = XAXI_DMA_ReadReg(val_dma_bases[j], MM2S_DMASR);
+			ctrl = XAXI_DMA_ReadReg(val_dma_bases[j], MM2S_DMACR);
+			printf("val_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+			status = XAXI_DMA_ReadReg(out_dma_bases[j], S2MM_DMASR);
+			ctrl = XAXI_DMA_ReadReg(out_dma_bases[j], S2MM_DMACR);
+			printf("out_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+		}
+	}
+	#endif
+	#ifdef MSHR_INCLUSIVE
+	if ((count & 0x2fff) == 0) {
+		// printf("%lu: SpMV not done\n", count);
+		snap_stats(SNAP_PERIODIC, NULL);
+	}
+	#endif
+	if (qdma_readv(run->status_iov, run->num_spmv) < 0) {
+		perror("read SpMV status");
+		return -1;
+	}
+	all_idle = 1;
+	for (i = 0; i < run->num_spmv; i++) {
+		int res = XSpmv_mult_axis_CtrlIdle(run->status_regs[i]);
+		all_idle &= res;
+		events += res && !(run->all_stat & (1 << i));
+		run->all_stat |= res << i;
+	}
+	*done = all_idle;
+	return events;
+}
 
-	for (i = 0; i < num_spmv; i++) {
-		dma_state[i].col.next_start_addr = col_mem[i];
-		dma_state[i].col.bytes_left = nnz[i] * sizeof(unsigned);
-		dma_state[i].val.next_start_addr = val_mem[i];
-		dma_state[i].val.bytes_left = nnz[i] * sizeof(float);
+// Done when the output DMA engines have written back all results.
+static int out_check(void *arg, uint64_t count, int *done)
+{
+	struct spmv_run *run = arg;
+	int i, all_idle, events = 0;
 
-		dma_state[i].rowptr.next_start_addr = rowptr_mem[i];
-		dma_state[i].rowptr.bytes_left = (rows[i] + 1) * sizeof(unsigned);
+	if (qdma_readv(run->status_iov, run->num_spmv) < 0) {
+		perror("read DMA status");
+		return -1;
+	}
+	all_idle = 1;
+	for (i = 0; i < run->num_spmv; i++) {
+		int idle = !XAXI_DMA_StatusBusy(run->status_regs[i]);
+		all_idle &= idle;
+		events += idle && !(run->out_idle & (1 << i));
+		run->out_idle |= idle << i;
+	}
+	*done = all_idle;
+	return events;
+}
 
-		dma_state[i].output.next_start_addr = output_mem[i];
-		dma_state[i].output.bytes_left = nout[i] * sizeof(float);
+static int sched_cmp_chunk(const void *a, const void *b)
+{
+	const struct sched_chunk *x = a, *y = b;
+	return x->nnz > y->nnz ? -1 : x->nnz < y->nnz;
+}
 
-		XSpmv_mult_axis_Set_val_size(spmv_bases[i], nnz[i]);
-		XSpmv_mult_axis_Set_output_size(spmv_bases[i], nout[i]);
-		XSpmv_mult_axis_Set_vect_mem(spmv_bases[i], vect_mem);
-		// if (XSpmv_mult_axis_Set_args(spmv_bases[i], nnz[i], nout[i], vect_mem) < 0) {
-		// 	return -1;
-		// }
-		// XSpmv_mult_axis_Get_args(spmv_bases[i]);
+// Split the partitions of d into chunks of about 1/sched_chunks of the
+// non-zeros of an accelerator, largest first. The DMA engines are built
+// without the realignment engine, so a chunk starts at a row and a non-zero
+// that are both cache line aligned; when no such row follows, the chunk takes
+// the rest of the partition.
+static int sched_plan(struct spmv_data *d, int nspmv)
+{
+	uint32_t const align = CACHELINE_SIZE / sizeof(uint32_t);
+	uint64_t total = 0;
+	char path[256];
+	int cap = 0;
 
-		debug_dma_printf("\ni=%d, curr_nnz=%u, curr_row_num=%u, curr_nout_num=%u\n", i, nnz[i], rows[i], nout[i]);
-		debug_dma_printf("col bytes %lu, val bytes %lu, row bytes %lu, out bytes %lu\n",
-						dma_state[i].col.bytes_left,
-						dma_state[i].val.bytes_left,
-						dma_state[i].rowptr.bytes_left,
-						dma_state[i].output.bytes_left);
+	for (int i = 0; i < nspmv; i++) {
+		if (d->nout[i] != d->rows[i]) {
+			fprintf(stderr, "spmv %d: %u outputs for %u rows, cannot be split\n", i, d->nout[i], d->rows[i]);
+			return -1;
+		}
+		total += d->nnz[i];
 	}
-
-	uint32_t status, ctrl;
-	// status = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMASR);
-	// ctrl = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMACR);
-	// printf("row_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-	// status = XAXI_DMA_ReadReg(col_dma_bases[0], MM2S_DMASR);
-	// ctrl = XAXI_DMA_ReadReg(col_dma_bases[0], MM2S_DMACR);
-	// printf("col_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-	// status = XAXI_DMA_ReadReg(val_dma_bases[0], MM2S_DMASR);
-	// ctrl = XAXI_DMA_ReadReg(val_dma_bases[0], MM2S_DMACR);
-	// printf("val_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-	// status = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMASR);
-	// ctrl = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMACR);
-	// printf("out_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-
-	for (i = 0; i < num_spmv; i++)
-	{
-		uint32_t bytes_to_send;
-		bytes_to_send = MIN(dma_state[i].rowptr.bytes_left, MAX_TRANSFER_SIZE_BYTES);
-		debug_dma_printf("Sending %d bytes from addr 0x%lX on rowptr[%d]\n", bytes_to_send, dma_state[i].rowptr.next_start_addr, i);
-		if (XAXI_DMA_SetAddrLength(row_dma_bases[i], dma_state[i].rowptr.next_start_addr, bytes_to_send, XAXIDMA_DMA_TO_DEVICE) < 0) {
+	uint64_t const target = MAX(total / ((uint64_t)nspmv * sched_chunks), 1);
+	for (int i = 0; i < nspmv; i++) {
+		struct ref_map m;
+		if (snprintf(path, sizeof(path), "%s/%d/%d.row", d->folder, nspmv, i) >= sizeof(path)) {
+			fprintf(stderr, "path of %d.row too long\n", i);
 			return -1;
 		}
-		dma_state[i].rowptr.next_start_addr += bytes_to_send;
-		dma_state[i].rowptr.bytes_left -= bytes_to_send;
-		
-		bytes_to_send = MIN(dma_state[i].col.bytes_left, MAX_TRANSFER_SIZE_BYTES);
-		debug_dma_printf("Sending %d bytes from addr 0x%lX on col[%d]\n", bytes_to_send, dma_state[i].col.next_start_addr, i);
-		if (XAXI_DMA_SetAddrLength(col_dma_bases[i], dma_state[i].col.next_start_addr, bytes_to_send, XAXIDMA_DMA_TO_DEVICE) < 0) {
+		if (ref_map_file(path, sizeof(uint32_t), &m) < 0)
 			return -1;
+		const uint32_t *rowptr = m.addr;
+		for (uint32_t r0 = 0, r1; r0 < d->rows[i]; r0 = r1) {
+			for (r1 = r0 + 1; r1 < d->rows[i]; r1++) {
+				if (rowptr[r1] - rowptr[r0] >= target && r1 % align == 0 && (rowptr[r1] - rowptr[0]) % align == 0)
+					break;
+			}
+			if (d->nchunks == cap) {
+				cap = cap ? cap * 2 : 64;
+				struct sched_chunk *c = realloc(d->chunks, cap * sizeof(*c));
+				if (c == NULL) {
+					perror("schedule");
+					ref_unmap_file(&m);
+					return -1;
+				}
+				d->chunks = c;
+			}
+			d->chunks[d->nchunks++] = (struct sched_chunk){ i, r0, r1, rowptr[r0] - rowptr[0], rowptr[r1] - rowptr[r0] };
 		}
-		dma_state[i].col.next_start_addr += bytes_to_send;
-		dma_state[i].col.bytes_left -= bytes_to_send;
+		ref_unmap_file(&m);
+	}
+	qsort(d->chunks, d->nchunks, sizeof(*d->chunks), sched_cmp_chunk);
+	return 0;
+}
 
-		bytes_to_send = MIN(dma_state[i].val.bytes_left, MAX_TRANSFER_SIZE_BYTES);
-		debug_dma_printf("Sending %d bytes from addr 0x%lX on val[%d]\n", bytes_to_send, dma_state[i].val.next_start_addr, i);
-		if (XAXI_DMA_SetAddrLength(val_dma_bases[i], dma_state[i].val.next_start_addr, bytes_to_send, XAXIDMA_DMA_TO_DEVICE) < 0) {
+// Hand the next chunk to accelerator p: point its DMA engines at the rows,
+// non-zeros and outputs of the chunk and start it.
+static int sched_arm(struct spmv_run *run, int p)
+{
+	const struct spmv_data *d = run->d;
+	const struct sched_chunk *c = &d->chunks[run->next++];
+	dma_stream_t *s = &run->streams[p * DMA_STREAMS_PER_SPMV];
+	uint32_t const rows = c->r1 - c->r0;
+
+	s[0] = (dma_stream_t){ "rowptr", p, row_dma_bases[p], XAXIDMA_DMA_TO_DEVICE,
+							{ d->rowptr_mem[c->part] + c->r0 * sizeof(unsigned), (rows + 1) * sizeof(unsigned) } };
+	s[1] = (dma_stream_t){ "col", p, col_dma_bases[p], XAXIDMA_DMA_TO_DEVICE,
+							{ d->col_mem[c->part] + c->k0 * sizeof(unsigned), c->nnz * sizeof(unsigned) } };
+	s[2] = (dma_stream_t){ "val", p, val_dma_bases[p], XAXIDMA_DMA_TO_DEVICE,
+							{ d->val_mem[c->part] + c->k0 * sizeof(float), c->nnz * sizeof(float) } };
+	s[3] = (dma_stream_t){ "output", p, out_dma_bases[p], XAXIDMA_DEVICE_TO_DMA,
+							{ d->output_mem[c->part] + c->r0 * sizeof(float), rows * sizeof(float) } };
+	XSpmv_mult_axis_Set_val_size(spmv_bases[p], c->nnz);
+	XSpmv_mult_axis_Set_output_size(spmv_bases[p], rows);
+	XSpmv_mult_axis_Set_vect_mem(spmv_bases[p], d->vect_mem);
+	for (int j = 0; j < DMA_STREAMS_PER_SPMV; j++) {
+		if ((dma_sg ? dma_stream_send_sg(&s[j], p * DMA_STREAMS_PER_SPMV + j) : dma_stream_send(&s[j])) < 0)
 			return -1;
+	}
+	debug_dma_printf("chunk %d (spmv %d rows %u-%u, %u nnz) on spmv %d\n", run->next - 1, c->part, c->r0, c->r1, c->nnz, p);
+	XSpmv_mult_axis_Start(spmv_bases[p]);
+	run->chunk_of[p] = run->next - 1;
+	run->nchunks_of[p]++;
+	run->nnz_of[p] += c->nnz;
+	return 0;
+}
+
+// Re-arm every DMA engine that finished a transfer, and hand the next chunk
+// to every accelerator that is idle with its output written back. Done when
+// all chunks are.
+static int sched_check(void *arg, uint64_t count, int *done)
+{
+	struct spmv_run *run = arg;
+	int p, j, i, nstatus = 0, events = 0;
+	int idle[NUM_SPMV] = { 0 }, out_idle[NUM_SPMV] = { 0 };
+
+	// status of the engines with transfers left, or of the accelerator and
+	// its output engine once its inputs are all queued
+	for (p = 0; p < run->num_spmv; p++) {
+		int queued = 1;
+		if (run->chunk_of[p] < 0)
+			continue;
+		for (j = p * DMA_STREAMS_PER_SPMV; j < (p + 1) * DMA_STREAMS_PER_SPMV; j++) {
+			if (run->streams[j].state.bytes_left == 0)
+				continue;
+			run->status_iov[nstatus].addr = run->streams[j].base + XAXI_DMA_StatusReg(run->streams[j].direction);
+			run->status_stream[nstatus++] = j;
+			queued = 0;
+		}
+		if (queued) {
+			run->status_iov[nstatus].addr = spmv_bases[p] + XSPMV_MULT_AXIS_AXILITES_ADDR_AP_CTRL;
+			run->status_stream[nstatus++] = run->nstream + p;
+			run->status_iov[nstatus].addr = out_dma_bases[p] + XAXI_DMA_StatusReg(XAXIDMA_DEVICE_TO_DMA);
+			run->status_stream[nstatus++] = run->nstream + run->num_spmv + p;
+		}
+	}
+	for (i = 0; i < nstatus; i++) {
+		run->status_iov[i].data = &run->status_regs[i];
+		run->status_iov[i].size = sizeof(run->status_regs[i]);
+	}
+	if (nstatus > 0 && qdma_readv(run->status_iov, nstatus) < 0) {
+		perror("read scheduler status");
+		return -1;
+	}
+	for (i = 0; i < nstatus; i++) {
+		int t = run->status_stream[i];
+		if (t < run->nstream) {
+			if (!XAXI_DMA_StatusBusy(run->status_regs[i])) {
+				if (dma_stream_send(&run->streams[t]) < 0)
+					return -1;
+				events++;
+			}
+		} else if (t < run->nstream + run->num_spmv) {
+			idle[t - run->nstream] = XSpmv_mult_axis_CtrlIdle(run->status_regs[i]);
+		} else {
+			out_idle[t - run->nstream - run->num_spmv] = !XAXI_DMA_StatusBusy(run->status_regs[i]);
+		}
+	}
+	*done = 1;
+	for (p = 0; p < run->num_spmv; p++) {
+		if (run->chunk_of[p] >= 0 && idle[p] && out_idle[p]) {
+			run->chunk_of[p] = -1;
+			events++;
+			if (run->next < run->d->nchunks && sched_arm(run, p) < 0)
+				return -1;
 		}
-		dma_state[i].val.next_start_addr += bytes_to_send;
-		dma_state[i].val.bytes_left -= bytes_to_send;
+		*done &= run->chunk_of[p] < 0;
+	}
+	return events;
+}
+
+// Run the chunks of d on the accelerators as they become free.
+static int sched_run(const struct spmv_data *d, struct spmv_run *run)
+{
+	run->d = d;
+	run->next = 0;
+	for (int p = 0; p < run->num_spmv; p++) {
+		run->chunk_of[p] = -1;
+		run->nchunks_of[p] = 0;
+		run->nnz_of[p] = 0;
+	}
+	for (int p = 0; p < run->num_spmv && run->next < d->nchunks; p++) {
+		if (sched_arm(run, p) < 0)
+			return -1;
+	}
+	if (wait_until("chunks", sched_check, run) < 0)
+		return -1;
+	printf("Schedule: %d chunks, chunks/non-zeros per accelerator:", d->nchunks);
+	for (int p = 0; p < run->num_spmv; p++)
+		printf(" %d/%lu", run->nchunks_of[p], run->nnz_of[p]);
+	printf("\n");
+	return 0;
+}
+
+// Point the DMA engines of the accelerators at the partitions and outputs of
+// d and start them, streams receives their state.
+static int spmv_arm(const struct spmv_data *d, int num_spmv, dma_stream_t *streams)
+{
+	int i;
 
-		bytes_to_send = MIN(dma_state[i].output.bytes_left, MAX_TRANSFER_SIZE_BYTES);
-		debug_dma_printf("Sending %d bytes to addr 0x%lX from output[%d]\n", bytes_to_send, dma_state[i].output.next_start_addr, i);
-		if (XAXI_DMA_SetAddrLength(out_dma_bases[i], dma_state[i].output.next_start_addr, bytes_to_send, XAXIDMA_DEVICE_TO_DMA) < 0) {
+	for (i = 0; i < num_spmv; i++) {
+		dma_stream_t *s = &streams[i * DMA_STREAMS_PER_SPMV];
+
+		s[0] = (dma_stream_t){ "rowptr", i, row_dma_bases[i], XAXIDMA_DMA_TO_DEVICE,
+								{ d->rowptr_mem[i], (d->rows[i] + 1) * sizeof(unsigned) } };
+		s[1] = (dma_stream_t){ "col", i, col_dma_bases[i], XAXIDMA_DMA_TO_DEVICE,
+								{ d->col_mem[i], d->nnz[i] * sizeof(unsigned) } };
+		s[2] = (dma_stream_t){ "val", i, val_dma_bases[i], XAXIDMA_DMA_TO_DEVICE,
+								{ d->val_mem[i], d->nnz[i] * sizeof(float) } };
+		s[3] = (dma_stream_t){ "output", i, out_dma_bases[i], XAXIDMA_DEVICE_TO_DMA,
+								{ d->output_mem[i], d->nout[i] * sizeof(float) } };
+
+		debug_dma_printf("\ni=%d, curr_nnz=%u, curr_row_num=%u, curr_nout_num=%u\n", i, d->nnz[i], d->rows[i], d->nout[i]);
+		debug_dma_printf("col bytes %lu, val bytes %lu, row bytes %lu, out bytes %lu\n",
+						s[1].state.bytes_left,
+						s[2].state.bytes_left,
+						s[0].state.bytes_left,
+						s[3].state.bytes_left);
+	}
+	for (i = 0; i < num_spmv * DMA_STREAMS_PER_SPMV; i++) {
+		// the engines take no empty transfers, a tile may have no non-zeros
+		if (streams[i].state.bytes_left == 0)
+			continue;
+		if ((dma_sg ? dma_stream_send_sg(&streams[i], i) : dma_stream_send(&streams[i])) < 0) {
 			return -1;
 		}
-		dma_state[i].output.next_start_addr += bytes_to_send;
-		dma_state[i].output.bytes_left -= bytes_to_send;
 	}
+	return 0;
+}
 
-	gettimeofday(&t1, NULL);
-	// FPGAMSHR_Clear_stats();
-    for (i = 0; i < num_spmv; i++) {
-		XSpmv_mult_axis_Start(spmv_bases[i]);
-		// XSpmv_mult_axis_Start(spmv_bases[i], nnz[i], nout[i], vect_mem);
+// Point the status reads of run at register reg of every accelerator's block in bases.
+static void spmv_status_iov(struct spmv_run *run, const uint64_t *bases, uint64_t reg)
+{
+	for (int i = 0; i < run->num_spmv; i++) {
+		run->status_iov[i].addr = bases[i] + reg;
+		run->status_iov[i].data = &run->status_regs[i];
+		run->status_iov[i].size = sizeof(run->status_regs[i]);
 	}
+}
 
-	int count = 0;
-    int any_transfers_pending = 1;
-    while (any_transfers_pending)
-	{
-    	any_transfers_pending = 0;
-		count++;
-		#if DEBUG_DMA == 1
-		if ((count & 0x3fff) == 0) {
-			FPGAMSHR_Get_stats_log(logname);
-			status = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMASR);
-			ctrl = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMACR);
-			printf("count %d:\nrow_dma: status 0x%x, ctrl 0x%x\n", count, status, ctrl);
-			status = XAXI_DMA_ReadReg(col_dma_bases[0], MM2S_DMASR);
-			ctrl = XAXI_DMA_ReadReg(col_dma_bases[0], MM2S_DMACR);
-			printf("col_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-			status = XAXI_DMA_ReadReg(val_dma_bases[0], MM2S_DMASR);
-			ctrl = XAXI_DMA_ReadReg(val_dma_bases[0], MM2S_DMACR);
-			printf("val_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-			status = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMASR);
-			ctrl = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMACR);
-			printf("out_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-		}
-		#endif
-		#ifdef MSHR_INCLUSIVE
-		if ((count & 0x2fff) == 0) {
-			printf("%d: SpMV not done\n", count);
-			// FPGAMSHR_Get_stats_log(logname);
-		}
-		if (count > 0x7fff) {
-			return -1;
+// Run the column tiles of d one after the other, each as a matrix of its own
+// with vect_mem moved to its slice of the vector. While a tile runs, the
+// partial outputs of the one before are read back and added up on the host;
+// the sums go to host_output_mem.
+static int tile_run(const struct spmv_data *d, struct spmv_run *run)
+{
+	int const num_spmv = run->num_spmv;
+	double *sum[NUM_SPMV] = { NULL };
+	float *part = NULL;
+	uint32_t maxrows = 0;
+	int res = -1;
+
+	for (int i = 0; i < num_spmv; i++) {
+		maxrows = MAX(maxrows, d->rows[i]);
+		sum[i] = calloc(MAX(d->rows[i], 1), sizeof(double));
+		if (sum[i] == NULL) {
+			perror("tile sums");
+			goto out;
 		}
-		#endif
-		#ifdef GET_RUNTIME_LOG
-		FPGAMSHR_Get_runtime_log();
-		#endif
-		for (i = 0; i < num_spmv; i++)
-		{
-			if (dma_state[i].rowptr.bytes_left > 0) {
-				any_transfers_pending = 1;
-				if (!XAXI_DMA_Busy(row_dma_bases[i], XAXIDMA_DMA_TO_DEVICE)) {
-					uint32_t bytes_to_send = MIN(dma_state[i].rowptr.bytes_left, MAX_TRANSFER_SIZE_BYTES);
-					// debug_dma_printf("Sending %d bytes from addr 0x%lX on rowptr[%d]\n", bytes_to_send, dma_state[i].rowptr.next_start_addr, i);
-					if (XAXI_DMA_SetAddrLength(row_dma_bases[i], dma_state[i].rowptr.next_start_addr, bytes_to_send, XAXIDMA_DMA_TO_DEVICE) < 0) {
-						return -1;
-					}
-					dma_state[i].rowptr.next_start_addr += bytes_to_send;
-					dma_state[i].rowptr.bytes_left -= bytes_to_send;
-				}
-			}
-			if (dma_state[i].col.bytes_left > 0) {
-				any_transfers_pending = 1;
-				if (!XAXI_DMA_Busy(col_dma_bases[i], XAXIDMA_DMA_TO_DEVICE)) {
-					uint32_t bytes_to_send = MIN(dma_state[i].col.bytes_left, MAX_TRANSFER_SIZE_BYTES);
-					// debug_dma_printf("Sending %d bytes from addr 0x%lX on col[%d]\n", bytes_to_send, dma_state[i].col.next_start_addr, i);
-					if (XAXI_DMA_SetAddrLength(col_dma_bases[i], dma_state[i].col.next_start_addr, bytes_to_send, XAXIDMA_DMA_TO_DEVICE) < 0) {
-						return -1;
-					}
-					dma_state[i].col.next_start_addr += bytes_to_send;
-					dma_state[i].col.bytes_left -= bytes_to_send;
-				}
-			}
-			if (dma_state[i].val.bytes_left > 0) {
-				any_transfers_pending = 1;
-				if (!XAXI_DMA_Busy(val_dma_bases[i], XAXIDMA_DMA_TO_DEVICE)) {
-					uint32_t bytes_to_send = MIN(dma_state[i].val.bytes_left, MAX_TRANSFER_SIZE_BYTES);
-					// debug_dma_printf("Sending %d bytes from addr 0x%lX on val[%d]\n", bytes_to_send, dma_state[i].val.next_start_addr, i);
-					if (XAXI_DMA_SetAddrLength(val_dma_bases[i], dma_state[i].val.next_start_addr, bytes_to_send, XAXIDMA_DMA_TO_DEVICE) < 0) {
-						return -1;
-					}
-					dma_state[i].val.next_start_addr += bytes_to_send;
-					dma_state[i].val.bytes_left -= bytes_to_send;
-				}
+	}
+	part = malloc(MAX(maxrows, 1) * sizeof(float));
+	if (part == NULL) {
+		perror("tile outputs");
+		goto out;
+	}
+	for (int t = 0; t <= d->ntiles; t++) {
+		if (t < d->ntiles) {
+			const struct spmv_tile *tile = &d->tiles[t];
+			struct spmv_data td = *d;
+			for (int i = 0; i < num_spmv; i++) {
+				td.nnz[i] = tile->nnz[i];
+				td.nout[i] = tile->rows[i];
+				td.rowptr_mem[i] = tile->rowptr_mem[i];
+				td.col_mem[i] = tile->col_mem[i];
+				td.val_mem[i] = tile->val_mem[i];
+				td.output_mem[i] = t % 2 ? d->tile_output_mem[i] : d->output_mem[i];
+				XSpmv_mult_axis_Set_val_size(spmv_bases[i], td.nnz[i]);
+				XSpmv_mult_axis_Set_output_size(spmv_bases[i], td.nout[i]);
+				XSpmv_mult_axis_Set_vect_mem(spmv_bases[i], d->vect_mem + tile->vect_off);
 			}
-			if (dma_state[i].output.bytes_left > 0) {
-				any_transfers_pending = 1;
-				if (!XAXI_DMA_Busy(out_dma_bases[i], XAXIDMA_DEVICE_TO_DMA)) {
-					uint32_t bytes_to_send = MIN(dma_state[i].output.bytes_left, MAX_TRANSFER_SIZE_BYTES);
-					// debug_dma_printf("Sending %d bytes to addr 0x%lX from output[%d]\n", bytes_to_send, dma_state[i].output.next_start_addr, i);
-					if (XAXI_DMA_SetAddrLength(out_dma_bases[i], dma_state[i].output.next_start_addr, bytes_to_send, XAXIDMA_DEVICE_TO_DMA) < 0) {
-						return -1;
-					}
-					dma_state[i].output.next_start_addr += bytes_to_send;
-					dma_state[i].output.bytes_left -= bytes_to_send;
-				}
+			if (spmv_arm(&td, num_spmv, run->streams) < 0)
+				goto out;
+			debug_dma_printf("tile %d: columns %u-%u\n", t, tile->c0, tile->c1);
+			for (int i = 0; i < num_spmv; i++)
+				XSpmv_mult_axis_Start(spmv_bases[i]);
+		}
+		// add up the tile before while this one runs
+		for (int i = 0; i < num_spmv && t > 0; i++) {
+			if (qdma_read((t - 1) % 2 ? d->tile_output_mem[i] : d->output_mem[i], part, d->rows[i] * sizeof(float)) < 0) {
+				fprintf(stderr, "fail to fetch output of %d spmv, tile %d\n", i, t - 1);
+				goto out;
 			}
+			for (uint32_t r = 0; r < d->rows[i]; r++)
+				sum[i][r] += part[r];
 		}
-    }
+		if (t == d->ntiles)
+			break;
+		run->all_stat = 0;
+		run->out_idle = 0;
+		if (wait_until("DMA transfers", dma_check, run) < 0)
+			goto out;
+		spmv_status_iov(run, spmv_bases, XSPMV_MULT_AXIS_AXILITES_ADDR_AP_CTRL);
+		if (wait_until("SpMV", spmv_check, run) < 0)
+			goto out;
+		// the next tile writes where the one before this did
+		spmv_status_iov(run, out_dma_bases, XAXI_DMA_StatusReg(XAXIDMA_DEVICE_TO_DMA));
+		if (wait_until("output DMA", out_check, run) < 0)
+			goto out;
+	}
+	for (int i = 0; i < num_spmv; i++) {
+		for (uint32_t r = 0; r < d->rows[i]; r++)
+			d->host_output_mem[i][r] = sum[i][r];
+	}
+	printf("Tiles: %d of up to %u columns\n", d->ntiles, d->tiles[0].c1 - d->tiles[0].c0);
+	res = 0;
+out:
+	for (int i = 0; i < num_spmv; i++)
+		free(sum[i]);
+	free(part);
+	return res;
+}
+
+int test_spmv_mult_axis(const struct spmv_data *d, int num_spmv, const char *logname)
+{
+	dma_stream_t streams[num_spmv * DMA_STREAMS_PER_SPMV];
+	int nstream = num_spmv * DMA_STREAMS_PER_SPMV;
+
+	struct qdma_iov status_iov[num_spmv * DMA_STREAMS_PER_SPMV];
+	uint32_t status_regs[num_spmv * DMA_STREAMS_PER_SPMV];
+	int status_stream[num_spmv * DMA_STREAMS_PER_SPMV];
+
+	struct timing_sync sync[2];
+	uint64_t t1, t2, t;
+
+	int i;
+
+	timing_run_begin();
+	t = timing_now();
+	for (i = 0; i < num_spmv && !sched_chunks && !d->ntiles; i++) {
+		XSpmv_mult_axis_Set_val_size(spmv_bases[i], d->nnz[i]);
+		XSpmv_mult_axis_Set_output_size(spmv_bases[i], d->nout[i]);
+		XSpmv_mult_axis_Set_vect_mem(spmv_bases[i], d->vect_mem);
+		// if (XSpmv_mult_axis_Set_args(spmv_bases[i], nnz[i], nout[i], vect_mem) < 0) {
+		// 	return -1;
+		// }
+		// XSpmv_mult_axis_Get_args(spmv_bases[i]);
+	}
 
-	// #if DEBUG_DMA == 1
-	// printf("REACH HERE 1, count=%d\n", count);
+	uint32_t status, ctrl;
 	// status = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMASR);
 	// ctrl = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMACR);
 	// printf("row_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
@@ -351,121 +725,139 @@ int test_spmv_mult_axis(int num_spmv, const char *logname)
 	// status = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMASR);
 	// ctrl = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMACR);
 	// printf("out_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-	// #endif
-
-	count = 0;
-	int all_idle = 0;
-	int all_stat = 0;
-	while (!all_idle) {
-		count++;
-		#if DEBUG_DMA == 1
-		if ((count & 0x3fff) == 0) {
-			FPGAMSHR_Get_stats_log(logname);
-			printf("spmv stat: 0x%04x\n", all_stat);
-			for (int j = 0; j < num_spmv; j++) {
-				status = XAXI_DMA_ReadReg(row_dma_bases[j], MM2S_DMASR);
-				ctrl = XAXI_DMA_ReadReg(row_dma_bases[j], MM2S_DMACR);
-				printf("row_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-				status = XAXI_DMA_ReadReg(col_dma_bases[j], MM2S_DMASR);
-				ctrl = XAXI_DMA_ReadReg(col_dma_bases[j], MM2S_DMACR);
-				printf("col_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-				status = XAXI_DMA_ReadReg(val_dma_bases[j], MM2S_DMASR);
-				ctrl = XAXI_DMA_ReadReg(val_dma_bases[j], MM2S_DMACR);
-				printf("val_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-				status = XAXI_DMA_ReadReg(out_dma_bases[j], S2MM_DMASR);
-				ctrl = XAXI_DMA_ReadReg(out_dma_bases[j], S2MM_DMACR);
-				printf("out_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
-			}
-		}
-		#endif
-		#ifdef MSHR_INCLUSIVE
-		if ((count & 0x2fff) == 0) {
-			// printf("%d: SpMV not done\n", count);
-			FPGAMSHR_Get_stats_log(logname);
-		}
-		if (count > 0x7fff) {
+
+	if (!sched_chunks && !d->ntiles && spmv_arm(d, num_spmv, streams) < 0)
+		return -1;
+	timing_add(TIMING_PROGRAM, timing_now() - t);
+
+	if (!ref_from_exp && ref_start() < 0)
+		return -1;
+	snap_run(logname);
+	if (sampler_start() < 0)
+		return -1;
+
+	struct spmv_run run = {
+		.num_spmv = num_spmv,
+		.logname = logname,
+		.streams = streams,
+		.nstream = nstream,
+		.status_iov = status_iov,
+		.status_regs = status_regs,
+		.status_stream = status_stream,
+	};
+	timing_sync(&sync[0]);
+	t1 = timing_now();
+	wait_stats_reset();
+	if (sched_chunks) {
+		// outputs included
+		if (sched_run(d, &run) < 0)
 			return -1;
-		}
-		#endif
-		#ifdef GET_RUNTIME_LOG
-		FPGAMSHR_Get_runtime_log();
-		#endif
-		all_idle = 1;
+	} else if (d->ntiles) {
+		// outputs included
+		if (tile_run(d, &run) < 0)
+			return -1;
+	} else {
 		for (i = 0; i < num_spmv; i++) {
-			// all_idle &= XSpmv_mult_axis_IsIdle(spmv_bases[i]);
-			int res = XSpmv_mult_axis_IsIdle(spmv_bases[i]);
-			all_idle &= res;
-			all_stat |= res << i;
+			XSpmv_mult_axis_Start(spmv_bases[i]);
+			// XSpmv_mult_axis_Start(spmv_bases[i], nnz[i], nout[i], vect_mem);
 		}
-	}
+		if (wait_until("DMA transfers", dma_check, &run) < 0)
+			return -1;
 
-	FPGAMSHR_Get_stats_log(logname);
-	#ifdef GET_RUNTIME_LOG
-	FPGAMSHR_Get_runtime_log();
-	FPGAMSHR_Output_runtime_log(logname);
-	#endif
+		// #if DEBUG_DMA == 1
+		// printf("REACH HERE 1, count=%d\n", count);
+		// status = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMASR);
+		// ctrl = XAXI_DMA_ReadReg(row_dma_bases[0], MM2S_DMACR);
+		// printf("row_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+		// status = XAXI_DMA_ReadReg(col_dma_bases[0], MM2S_DMASR);
+		// ctrl = XAXI_DMA_ReadReg(col_dma_bases[0], MM2S_DMACR);
+		// printf("col_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+		// status = XAXI_DMA_ReadReg(val_dma_bases[0], MM2S_DMASR);
+		// ctrl = XAXI_DMA_ReadReg(val_dma_bases[0], MM2S_DMACR);
+		// printf("val_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+		// status = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMASR);
+		// ctrl = XAXI_DMA_ReadReg(out_dma_bases[0], S2MM_DMACR);
+		// printf("out_dma: status 0x%x, ctrl 0x%x\n", status, ctrl);
+		// #endif
+
+		spmv_status_iov(&run, spmv_bases, XSPMV_MULT_AXIS_AXILITES_ADDR_AP_CTRL);
+		if (wait_until("SpMV", spmv_check, &run) < 0)
+			return -1;
+	}
 
-	gettimeofday(&t2, NULL);
-	measure(&t1, &t2, &sec, &msec);
-	printf("  cost %lu s %d ms\n", sec, msec);
-
-	count = 0;
-    all_idle = 0;
-    while (!all_idle) {
-		count++;
-		// if (count > 10000)
-		// 	break;
-    	all_idle = 1;
-		for (i = 0; i < num_spmv; i++) {
-			all_idle &= !XAXI_DMA_Busy(out_dma_bases[i], XAXIDMA_DEVICE_TO_DMA);
-		}
-    }
+	t2 = timing_now();
+	timing_sync(&sync[1]);
+	timing_add(TIMING_COMPUTE, t2 - t1);
+	struct fpgamshr_stats stats;
+	snap_stats(SNAP_FINAL, &stats);
+
+	sampler_stop();
+	printf("  cost %lu s %lu ms\n", (t2 - t1) / 1000000000, (t2 - t1) / 1000000 % 1000);
+	spmv_cost_us = (t2 - t1) / 1000;
+	FPGAMSHR_Write_stats_log(logname, &stats);
+	sampler_write(logname);
+	if (prof_read(prof_sample) == 0)
+		prof_report(prof_sample);
+
+	if (!sched_chunks && !d->ntiles) {
+		t = timing_now();
+		spmv_status_iov(&run, out_dma_bases, XAXI_DMA_StatusReg(XAXIDMA_DEVICE_TO_DMA));
+		if (wait_until("output DMA", out_check, &run) < 0)
+			return -1;
+		timing_add(TIMING_DRAIN, timing_now() - t);
+	}
+	wait_stats_report();
+	timing_run_report(&sync[0], &sync[1]);
 	printf("DONE\n");
     return 0;
 }
 
-int fetch_result(int nspmv)
+int fetch_result(struct spmv_data *d, int nspmv)
 {
+	// added up by tile_run() already
+	if (d->ntiles)
+		return 0;
+	uint64_t start = timing_now();
 	for (int i = 0; i < nspmv; i++) {
-		if (qdma_read(output_mem[i], host_output_mem[i], nout[i] * sizeof(float)) < 0) {
+		if (qdma_read(d->output_mem[i], d->host_output_mem[i], d->nout[i] * sizeof(float)) < 0) {
 			fprintf(stderr, "fail to fetch output of %d spmv\n", i);
 			return -1;
 		}
 	}
+	timing_add(TIMING_FETCH, timing_now() - start);
 	return 0;
 }
 
-void compare_result(int nspmv)
+// Verify the outputs against the reference, which must be complete (see
+// ref_wait()), sum receives the totals.
+void compare_result(const struct spmv_data *d, int nspmv, struct verify_result *sum)
 {
+	struct verify_result res[NUM_SPMV];
+	memset(sum, 0, sizeof(*sum));
+	uint64_t start = timing_now();
+	for (int acc = 0; acc < nspmv; acc++)
+		verify(d->host_output_mem[acc], d->ref_output_mem[acc], d->rows[acc], &res[acc]);
+	uint64_t elapsed = timing_now() - start;
+
 	printf("Result verification: \n");
-	int i, acc;
-	for (acc = 0; acc < nspmv; acc++)
-	{
-		for (i = 0; i < rows[acc]; i++) {
-			//printf("%d: %lf %lf\n", i, output_mem[i], ref_output_mem[i]);
-			if ((ref_output_mem[acc][i] > 1e-5) &&
-				(((((int32_t*)ref_output_mem[acc])[i] - ((int32_t*)host_output_mem[acc])[i]) > 167772) ||
-				(((int32_t*)host_output_mem[acc])[i] - ((int32_t*)ref_output_mem[acc])[i]) > 167772)) {
-			// float diff = ref_output_mem[acc][i] - host_output_mem[acc][i];
-			// if (diff > 1e-3 || diff < -1e-3) {
-				printf("%d %d: %f %f\n", acc, i, host_output_mem[acc][i], ref_output_mem[acc][i]);
-				break;
-			}
-		}
-		if (i == rows[acc]) {
-			printf("spmv %d pass\n", acc);
-		} else {
-			printf("spmv %d fail\n", acc);
+	for (int acc = 0; acc < nspmv; acc++) {
+		struct verify_result *r = &res[acc];
+		if (r->mismatches) {
+			printf("%d %lu: %f %f\n", acc, r->first, d->host_output_mem[acc][r->first], d->ref_output_mem[acc][r->first]);
 		}
+		printf("spmv %d %s: %lu mismatches, max %u ulp, max rel err %.3g\n", acc, r->mismatches ? "fail" : "pass",
+				r->mismatches, r->max_ulp, r->max_rel);
+		sum->mismatches += r->mismatches;
+		sum->max_ulp = MAX(sum->max_ulp, r->max_ulp);
+		sum->max_rel = MAX(sum->max_rel, r->max_rel);
 	}
+	debug_check_results_printf("verified in %lu us\n", elapsed / 1000);
 }
 
-#define HBM_CHANNEL_SIZE  MB(256)
-#define HBM_CHANNEL_NUM   16
-
 struct hbm_data_config {
 	// input
 	uint32_t channel_num;
+	int prestriped;		// the files are in the layout already, see load_hbm_layout()
 	// output
 	uint32_t elem_num;
 	uint32_t elem_num_per_pc[HBM_CHANNEL_NUM];
@@ -473,7 +865,94 @@ struct hbm_data_config {
 };
 
 
-int load_vec_hbm(uint64_t hbm_addr, const char *vec_file, struct hbm_data_config *config)
+// Stripe size bytes of vec over the channels of config from hbm_addr on.
+// vec is read in whole cache lines.
+static int write_vec_hbm(uint64_t hbm_addr, const char *vec, uint64_t size, struct hbm_data_config *config)
+{
+	uint32_t const nchannel = config->channel_num;
+	uint32_t nstrip = size / CACHELINE_SIZE;
+	if (size % CACHELINE_SIZE)
+		nstrip += 1;
+	// division
+	uint32_t nstrip_per_pc = nstrip / nchannel;
+	uint32_t nleft = nstrip - nstrip_per_pc * nchannel;
+	for (int i = 0; i < nchannel; i++) {
+		config->elem_num_per_pc[i] = nstrip_per_pc;		// treat "elem" as "strip"
+		if (nleft > 0) {
+			nleft--;
+			config->elem_num_per_pc[i]++;
+		}
+	}
+	// for (int i = 0; i < nchannel; i++)
+	// 	config->elem_num_prefix_sum[i] = 0;				// treat "elem" as "strip of this kind"
+	// for (int i = NUM_REQ_HANDLERS; i < nchannel + NUM_REQ_HANDLERS; i++)
+	// 	config->elem_num_prefix_sum[i] = config->elem_num_prefix_sum[i - NUM_REQ_HANDLERS] + config->elem_num_per_pc[i - NUM_REQ_HANDLERS];
+
+	// Channels are built and written in parallel, each thread on its own QDMA
+	// queue and with a LOADER_CHUNK_SIZE staging buffer.
+	stripe_copy_fn stripe_copy = stripe_copy_select();
+	int nthreads = MIN(nchannel, MAX(loader_threads, 1));
+	int failed = 0;
+	#pragma omp parallel num_threads(nthreads)
+	{
+		char *buf = aligned_alloc(CACHELINE_SIZE, LOADER_CHUNK_SIZE);
+		if (buf == NULL) {
+			perror("load vec mem");
+			failed = 1;
+		}
+		qdma_queue_open(omp_get_thread_num());
+		#pragma omp for schedule(dynamic, 1)
+		for (int i = 0; i < nchannel; i++) {
+			uint32_t const chunk_strips = LOADER_CHUNK_SIZE / CACHELINE_SIZE;
+			for (uint32_t j = 0; j < config->elem_num_per_pc[i] && !failed; j += chunk_strips) {
+				uint32_t n = MIN(config->elem_num_per_pc[i] - j, chunk_strips);
+				load_stage_begin(LOAD_STAGE_PREPROCESS, timing_now());
+				stripe_copy(buf, vec + ((uint64_t)i + (uint64_t)j * nchannel) * CACHELINE_SIZE,
+							n, nchannel * CACHELINE_SIZE);
+				load_stage_end(LOAD_STAGE_PREPROCESS, n * CACHELINE_SIZE, timing_now());
+				load_stage_begin(LOAD_STAGE_WRITE, timing_now());
+				if (qdma_write(hbm_addr + i * HBM_CHANNEL_SIZE + (uint64_t)j * CACHELINE_SIZE, buf, n * CACHELINE_SIZE) < 0) {
+					perror("write vec to HBM");
+					failed = 1;
+				}
+				load_stage_end(LOAD_STAGE_WRITE, n * CACHELINE_SIZE, timing_now());
+			}
+		}
+		qdma_queue_close();
+		free(buf);
+	}
+	return failed ? -1 : 0;
+}
+
+// Copy vec, striped over the channels of config by mm2csr -H, to hbm_addr
+// as it is: each channel takes its run of size / channels bytes.
+static int write_vec_hbm_striped(uint64_t hbm_addr, const char *vec, uint64_t size, struct hbm_data_config *config)
+{
+	uint32_t const nchannel = config->channel_num;
+	uint64_t const per_pc = size / nchannel;
+	int nthreads = MIN(nchannel, MAX(loader_threads, 1));
+	int failed = 0;
+	#pragma omp parallel num_threads(nthreads)
+	{
+		qdma_queue_open(omp_get_thread_num());
+		#pragma omp for schedule(dynamic, 1)
+		for (int i = 0; i < nchannel; i++) {
+			for (uint64_t off = 0; off < per_pc && !failed; off += LOADER_CHUNK_SIZE) {
+				uint64_t n = MIN(per_pc - off, LOADER_CHUNK_SIZE);
+				load_stage_begin(LOAD_STAGE_WRITE, timing_now());
+				if (qdma_write(hbm_addr + i * HBM_CHANNEL_SIZE + off, (char *)vec + i * per_pc + off, n) < 0) {
+					perror("write vec to HBM");
+					failed = 1;
+				}
+				load_stage_end(LOAD_STAGE_WRITE, n, timing_now());
+			}
+		}
+		qdma_queue_close();
+	}
+	return failed ? -1 : 0;
+}
+
+int load_vec_hbm(uint64_t hbm_addr, const char *vec_file, struct hbm_data_config *config, uint64_t *phash)
 {
 	uint32_t const nchannel = config->channel_num;
 	if (nchannel > 16 || /*nchannel < NUM_REQ_HANDLERS ||*/ (nchannel & (nchannel - 1)) != 0) {
@@ -488,7 +967,6 @@ int load_vec_hbm(uint64_t hbm_addr, const char *vec_file, struct hbm_data_config
 	}
 
 	int res = -1;
-	char *buf = NULL;
 	char *vec_mem = MAP_FAILED;
 	uint32_t nelem;
 	struct stat st;
@@ -500,59 +978,44 @@ int load_vec_hbm(uint64_t hbm_addr, const char *vec_file, struct hbm_data_config
 		fprintf(stderr, "funny file size that unaligned to data size: %lu to %lu\n", st.st_size, sizeof(float));
 		goto out;
 	}
-	if (st.st_size > nchannel * HBM_CHANNEL_SIZE) {
+	// in batch mode, each of the two vectors gets half of every channel
+	if (st.st_size > nchannel * (batch_mode ? HBM_VECT_SLOT_OFFSET : HBM_CHANNEL_SIZE)) {
 		fprintf(stderr, "file size exceed capacity of %d channel(s): %lu \n", nchannel, st.st_size);
 		goto out;
 	}
-	nelem = st.st_size / sizeof(float);
-	config->elem_num = nelem;
+	// the striped image has a run of whole lines per channel, see mm2csr -H
+	if (config->prestriped) {
+		uint64_t lines = ((uint64_t)config->elem_num * sizeof(float) + CACHELINE_SIZE - 1) / CACHELINE_SIZE;
+		if (st.st_size != (lines + nchannel - 1) / nchannel * nchannel * CACHELINE_SIZE) {
+			fprintf(stderr, "%s: %lu bytes is not %u elements striped over %d channel(s)\n", vec_file, st.st_size,
+					config->elem_num, nchannel);
+			goto out;
+		}
+	} else {
+		nelem = st.st_size / sizeof(float);
+		config->elem_num = nelem;
+	}
 	
 	vec_mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, vec_fd, 0);
 	if (vec_mem == MAP_FAILED) {
 		fprintf(stderr, "fail to mmap %s\n", vec_file);
 		goto out;
 	}
+	if (phash) {
+		uint64_t hash = 0;
+		#pragma omp parallel for reduction(^:hash) schedule(static)
+		for (off_t off = 0; off < st.st_size; off += LOADER_CHUNK_SIZE)
+			hash ^= load_hash_block(vec_mem + off, MIN(st.st_size - off, LOADER_CHUNK_SIZE), off);
+		*phash = hash;
+	}
 
-	uint32_t nstrip = st.st_size / CACHELINE_SIZE;
-	if (st.st_size % CACHELINE_SIZE)
-		nstrip += 1;
-	// division
-	uint32_t nstrip_per_pc = nstrip / nchannel;
-	uint32_t nleft = nstrip - nstrip_per_pc * nchannel;
-	for (int i = 0; i < nchannel; i++) {
-		config->elem_num_per_pc[i] = nstrip_per_pc;		// treat "elem" as "strip"
-		if (nleft > 0) {
-			nleft--;
-			config->elem_num_per_pc[i]++;
-		}
-	}
-	// for (int i = 0; i < nchannel; i++)
-	// 	config->elem_num_prefix_sum[i] = 0;				// treat "elem" as "strip of this kind"
-	// for (int i = NUM_REQ_HANDLERS; i < nchannel + NUM_REQ_HANDLERS; i++)
-	// 	config->elem_num_prefix_sum[i] = config->elem_num_prefix_sum[i - NUM_REQ_HANDLERS] + config->elem_num_per_pc[i - NUM_REQ_HANDLERS];
-
-	buf = (char *)malloc((nstrip_per_pc + 1) * CACHELINE_SIZE);
-	if (buf == NULL) {
-		perror("load vec mem");
+	if ((config->prestriped ? write_vec_hbm_striped : write_vec_hbm)(hbm_addr, vec_mem, st.st_size, config) < 0)
 		goto out;
-	}
-
-	for (int i = 0; i < nchannel; i++) {
-		for (int j = 0; j < config->elem_num_per_pc[i]; j++) {
-			memcpy(buf + j * CACHELINE_SIZE, vec_mem + (i + j * nchannel) * CACHELINE_SIZE, CACHELINE_SIZE);
-		}
-		if (qdma_write(hbm_addr + i * HBM_CHANNEL_SIZE, buf, config->elem_num_per_pc[i] * CACHELINE_SIZE) < 0) {
-			perror("write vec to HBM");
-			goto out;
-		}
-	}
 
 	res = 0;
 out:
 	if (vec_mem != MAP_FAILED)
 		munmap(vec_mem, st.st_size);
-	if (buf != NULL)
-		free(buf);
 	close(vec_fd);
 	return res;
 }
@@ -569,6 +1032,19 @@ int col_preprocess(char *buf, uint32_t buf_sz, void *args)
 	// uint32_t const max_per_channel = HBM_CHANNEL_SIZE / sizeof(uint32_t);
 	uint32_t const nelem_per_strip = CACHELINE_SIZE / sizeof(uint32_t);
 
+	// load_vec_hbm only accepts power-of-two channel counts, for which the
+	// division and modulo below are shifts and masks
+	if ((nchannel & (nchannel - 1)) == 0) {
+		struct col_remap r = {
+			.strip_shift = __builtin_ctz(nelem_per_strip),
+			.ch_shift = __builtin_ctz(nchannel),
+			.ch_mask = nchannel - 1,
+			.base_shift = __builtin_ctzl(HBM_CHANNEL_SIZE / sizeof(uint32_t)),
+		};
+		col_remap(col_data, col_num, &r);
+		return 0;
+	}
+
 	for (int i = 0; i < col_num; i++) {
 		int strip_no = col_data[i] / nelem_per_strip;
 		int strip_ch_no = strip_no % nchannel;
@@ -581,8 +1057,18 @@ int col_preprocess(char *buf, uint32_t buf_sz, void *args)
 }
 
 int load_vec(uint64_t fpga_addr, const char *vec_file, uint32_t *pvec_sz, size_t elem_sz,
-			int (*preprocess)(char*, uint32_t, void *), void *args)
+			int (*preprocess)(char*, uint32_t, void *), void *args, uint64_t *phash)
 {
+	if (load_mode == LOAD_MODE_MMAP && preprocess == NULL)
+		return load_vec_mmap(fpga_addr, vec_file, pvec_sz, elem_sz, phash);
+	if (load_mode != LOAD_MODE_SYNC && !loader_no_uring) {
+		int res = load_vec_async(fpga_addr, vec_file, pvec_sz, elem_sz, preprocess, args, phash);
+		if (res <= 0)
+			return res;
+		fprintf(stderr, "io_uring unavailable, loading synchronously\n");
+		loader_no_uring = 1;
+	}
+
 	int vec_fd = open(vec_file, O_RDONLY);
 	if (vec_fd < 0) {
 		fprintf(stderr, "unable to open %s\n", vec_file);
@@ -604,7 +1090,7 @@ int load_vec(uint64_t fpga_addr, const char *vec_file, uint32_t *pvec_sz, size_t
 	vec_sz = st.st_size / elem_sz;
 	*pvec_sz = vec_sz;
 	
-	off_t chunk_size = MIN(st.st_size, MB(8));
+	off_t chunk_size = MIN(st.st_size, LOADER_CHUNK_SIZE);
 
 	buf = (char *)malloc(chunk_size);
 	if (buf == NULL) {
@@ -612,20 +1098,28 @@ int load_vec(uint64_t fpga_addr, const char *vec_file, uint32_t *pvec_sz, size_t
 		goto out;
 	}
 	for (off_t off = 0; off < st.st_size; off += chunk_size) {
-		chunk_size = MIN(st.st_size - off, MB(8));
+		chunk_size = MIN(st.st_size - off, LOADER_CHUNK_SIZE);
 		// printf("addr=0x%lx, chunk_size=0x%lx\n", fpga_addr + off, chunk_size);
+		load_stage_begin(LOAD_STAGE_READ, timing_now());
 		if (read(vec_fd, buf, chunk_size) < 0) {
 			perror("read vec file");
 			goto out;
 		}
+		if (phash)
+			*phash ^= load_hash_block(buf, chunk_size, off);
+		load_stage_end(LOAD_STAGE_READ, chunk_size, timing_now());
 		if (preprocess) {
+			load_stage_begin(LOAD_STAGE_PREPROCESS, timing_now());
 			preprocess(buf, chunk_size, args);
+			load_stage_end(LOAD_STAGE_PREPROCESS, chunk_size, timing_now());
 		}
+		load_stage_begin(LOAD_STAGE_WRITE, timing_now());
 		if (qdma_write(fpga_addr + off, buf, chunk_size) < 0) {
 			perror("write vec to FPGA");
 			fprintf(stderr, "fail to write at addr 0x%lx with %ld bytes\n", fpga_addr + off, chunk_size);
 			goto out;
 		}
+		load_stage_end(LOAD_STAGE_WRITE, chunk_size, timing_now());
 	}
 
 	res = 0;
@@ -636,7 +1130,125 @@ out:
 	return res;
 }
 
-int load_data(const char* folder_name, int nspmv, uint32_t nchannel)
+// Read the expected output precomputed by util/mm_matrix_to_csr.py.
+static int load_exp(const char *file, uint32_t *pnout, float **pbuf)
+{
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "unable to open [%s]\n", file);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "fail to stat %s\n", file);
+		close(fd);
+		return -1;
+	}
+	if (st.st_size % sizeof(float)) {
+		fprintf(stderr, "funny file size that unaligned to data size: %lu to %lu\n", st.st_size, sizeof(float));
+		close(fd);
+		return -1;
+	}
+	*pnout = st.st_size / sizeof(float);
+	*pbuf = (float *)malloc(MAX(st.st_size, 1));
+	if (*pbuf == NULL) {
+		fprintf(stderr, "fail to malloc output memory\n");
+		close(fd);
+		return -1;
+	}
+	int res = read(fd, *pbuf, st.st_size);
+	close(fd);
+	return res < 0 ? -1 : 0;
+}
+
+// Whether folder_name for nspmv accelerators has the vector and the column
+// indices striped over nchannel channels already (mm2csr -H), in the layout
+// of this build; config receives the length of the vector then. Returns -1
+// on error.
+static int load_hbm_layout(const char *folder_name, int nspmv, uint32_t nchannel, struct hbm_data_config *config)
+{
+	uint64_t channels, line, channel_size, elems;
+	char path[256];
+
+	if (snprintf(path, sizeof(path), "%s/%d/hbm%u", folder_name, nspmv, nchannel) >= sizeof(path)) {
+		fprintf(stderr, "path of the HBM layout of %s too long\n", folder_name);
+		return -1;
+	}
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	int n = fscanf(f, "%lu %lu %lu %lu", &channels, &line, &channel_size, &elems);
+	fclose(f);
+	if (n != 4 || channels != nchannel || line != CACHELINE_SIZE || channel_size != HBM_CHANNEL_SIZE ||
+		elems > UINT32_MAX) {
+		printf("%s: not the layout of this build, striping while loading\n", path);
+		return 0;
+	}
+	config->elem_num = elems;
+	return 1;
+}
+
+// Read the list of column tiles of folder_name for nspmv accelerators, see
+// mm2csr -T. A tile starts on a cache line of every channel of the vector,
+// where the slice of x of the tile starts.
+static int load_tiles(const char *folder_name, int nspmv, uint32_t nchannel, struct spmv_data *d)
+{
+	uint64_t const align = CACHELINE_SIZE / sizeof(float) * MAX(nchannel, 1);
+	uint64_t c0, c1, off;
+	char path[256];
+	int cap = 0;
+
+	if (snprintf(path, sizeof(path), "%s/%d/tiles", folder_name, nspmv) >= sizeof(path)) {
+		fprintf(stderr, "path of the tiles of %s too long\n", folder_name);
+		return -1;
+	}
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "%s: no column tiles, convert with mm2csr -T\n", path);
+		return -1;
+	}
+	while (fscanf(f, "%lu %lu %lu", &c0, &c1, &off) == 3) {
+		if (c0 % align || c1 <= c0 || c1 > UINT32_MAX || off != c0 * sizeof(float)) {
+			fprintf(stderr, "%s: tile %d at column %lu is not aligned to %lu columns\n", path, d->ntiles, c0, align);
+			goto fail;
+		}
+		if (d->ntiles == cap) {
+			cap = cap ? cap * 2 : 64;
+			struct spmv_tile *t = realloc(d->tiles, cap * sizeof(*t));
+			if (t == NULL) {
+				perror("tiles");
+				goto fail;
+			}
+			d->tiles = t;
+		}
+		// striped over the channels, the columns before c0 fill c0 / nchannel of each
+		d->tiles[d->ntiles++] = (struct spmv_tile){ .c0 = c0, .c1 = c1, .vect_off = nchannel ? off / nchannel : off };
+	}
+	if (!feof(f) || d->ntiles == 0) {
+		fprintf(stderr, "%s: bad tile list\n", path);
+		goto fail;
+	}
+	fclose(f);
+	return 0;
+
+fail:
+	fclose(f);
+	return -1;
+}
+
+// Point job at file part of folder_name for nspmv accelerators, -1 if the
+// path does not fit.
+static int load_job_file(struct load_job *job, const char *folder_name, int nspmv,
+						const char *part, const char *suffix, const char *ext)
+{
+	if (snprintf(job->file, sizeof(job->file), "%s/%d/%s%s%s", folder_name, nspmv, part, suffix, ext) >= sizeof(job->file)) {
+		fprintf(stderr, "path of %s%s%s in %s too long\n", part, suffix, ext, folder_name);
+		return -1;
+	}
+	return 0;
+}
+
+int load_data(const char* folder_name, int nspmv, uint32_t nchannel, struct spmv_data *d)
 {
 	char full_file_name[256];
 	if (strlen(folder_name) > 64) {
@@ -653,100 +1265,795 @@ int load_data(const char* folder_name, int nspmv, uint32_t nchannel)
 		return -1;
 	}
 
+	snprintf(d->folder, sizeof(d->folder), "%s", folder_name);
+	d->bench_name = d->folder + (bench_name - folder_name);
+	uint64_t start = timing_now();
+
+	load_stats_reset();
+	resident_begin(d - spmv_slots);
+	for (int i = 0; i < NUM_SPMV; i++) {
+		devmem_free(d->output_mem[i]);
+		d->output_mem[i] = 0;
+		devmem_free(d->tile_output_mem[i]);
+		d->tile_output_mem[i] = 0;
+		free(d->host_output_mem[i]);
+		d->host_output_mem[i] = NULL;
+		free(d->ref_output_mem[i]);
+		d->ref_output_mem[i] = NULL;
+	}
+	free(d->chunks);
+	d->chunks = NULL;
+	d->nchunks = 0;
+	free(d->tiles);
+	d->tiles = NULL;
+	d->ntiles = 0;
+
 	struct hbm_data_config hdc;
+	struct resident_key vec_key;
+	uint64_t vec_addr;
 	hdc.channel_num = nchannel;
-	sprintf(full_file_name, "%s/%d/%s.vec", folder_name, nspmv, bench_name);
-	if (nchannel == 0) {
-		if (load_vec(vect_mem_host, full_file_name, &cols, sizeof(float), NULL, NULL) < 0)
-			return -1;
-	} else {
-		if (load_vec_hbm(vect_mem, full_file_name, &hdc) < 0)
+	hdc.prestriped = nchannel != 0 ? load_hbm_layout(folder_name, nspmv, nchannel, &hdc) : 0;
+	if (hdc.prestriped < 0)
+		return -1;
+	// the striped files of mm2csr -H go up as they are
+	char hbm_suffix[16] = "";
+	if (hdc.prestriped)
+		snprintf(hbm_suffix, sizeof(hbm_suffix), ".hbm%u", nchannel);
+	if (snprintf(full_file_name, sizeof(full_file_name), "%s/%d/%s%s.vec",
+				folder_name, nspmv, bench_name, hbm_suffix) >= sizeof(full_file_name)) {
+		fprintf(stderr, "path of %s.vec too long\n", bench_name);
+		return -1;
+	}
+	if (nchannel != 0) {
+		int res = resident_find(full_file_name, nchannel, d->vect_mem, &vec_key, &vec_addr);
+		if (res < 0)
 			return -1;
-		cols = hdc.elem_num;
+		if (res == 0) {
+			resident_drop_range(d->vect_mem, nchannel * HBM_CHANNEL_SIZE);
+			if (load_vec_hbm(d->vect_mem, full_file_name, &hdc, &vec_key.hash) < 0)
+				return -1;
+			resident_add(&vec_key, d->vect_mem, nchannel * HBM_CHANNEL_SIZE);
+		}
+		if (!hdc.prestriped)
+			hdc.elem_num = vec_key.size / sizeof(float);
+		d->cols = hdc.elem_num;
 	}
 
+	if (tiled && load_tiles(folder_name, nspmv, nchannel, d) < 0)
+		return -1;
+
+	// all other files are independent, load them concurrently; a tiled
+	// matrix has the files of every tile instead of those of the partitions
+	int const nsets = MAX(d->ntiles, 1), maxjobs = 3 * nspmv * nsets + 1;
+	struct load_job *jobs = malloc(maxjobs * sizeof(*jobs));
+	uint64_t **job_addr = malloc(maxjobs * sizeof(*job_addr));	// where the device address of the job goes
+	struct load_job *todo = malloc(maxjobs * sizeof(*todo));
+	struct resident_key *keys = malloc(maxjobs * sizeof(*keys));
+	uint64_t *allocated = calloc(maxjobs, sizeof(*allocated));
+	uint32_t ncol[nspmv * nsets];
+	int njobs = 0;
+	if (jobs == NULL || job_addr == NULL || todo == NULL || keys == NULL || allocated == NULL) {
+		perror("load jobs");
+		goto fail;
+	}
+	if (nchannel == 0) {
+		jobs[njobs] = (struct load_job){ d->vect_mem, "", &d->cols, sizeof(float), NULL, NULL };
+		job_addr[njobs] = &d->vect_mem;
+		strcpy(jobs[njobs++].file, full_file_name);
+	}
+	for (int t = 0; t < nsets; t++)
 	for (int i = 0; i < nspmv; i++) {
-		sprintf(full_file_name, "%s/%d/%d.val", folder_name, nspmv, i);
-		if (load_vec(val_mem[i], full_file_name, &nnz[i], sizeof(float), NULL, NULL) < 0)
-			return -1;
-		sprintf(full_file_name, "%s/%d/%d.col", folder_name, nspmv, i);
-		if (load_vec(col_mem[i], full_file_name, &nnz[i], sizeof(float), col_preprocess, &hdc) < 0)
-			return -1;
+		struct spmv_tile *tile = d->ntiles ? &d->tiles[t] : NULL;
+		char part[32];
+		if (tile)
+			sprintf(part, "%d.%d", i, t);
+		else
+			sprintf(part, "%d", i);
+		jobs[njobs] = (struct load_job){ RESIDENT_ANY, "", tile ? &tile->nnz[i] : &d->nnz[i], sizeof(float), NULL, NULL };
+		job_addr[njobs] = tile ? &tile->val_mem[i] : &d->val_mem[i];
+		if (load_job_file(&jobs[njobs++], folder_name, nspmv, part, "", ".val") < 0)
+			goto fail;
+		jobs[njobs] = (struct load_job){ RESIDENT_ANY, "", &ncol[t * nspmv + i], sizeof(float),
+											nchannel && !hdc.prestriped ? col_preprocess : NULL, &hdc };
+		job_addr[njobs] = tile ? &tile->col_mem[i] : &d->col_mem[i];
+		if (load_job_file(&jobs[njobs++], folder_name, nspmv, part, hbm_suffix, ".col") < 0)
+			goto fail;
+		jobs[njobs] = (struct load_job){ RESIDENT_ANY, "", tile ? &tile->rows[i] : &d->rows[i], sizeof(float), NULL, NULL };
+		job_addr[njobs] = tile ? &tile->rowptr_mem[i] : &d->rowptr_mem[i];
+		if (load_job_file(&jobs[njobs++], folder_name, nspmv, part, "", ".row") < 0)
+			goto fail;
+	}
 
-		sprintf(full_file_name, "%s/%d/%d.row", folder_name, nspmv, i);
-		if (load_vec(rowptr_mem[i], full_file_name, &rows[i], sizeof(float), NULL, NULL) < 0)
+	// skip what is still on the device and place the rest
+	int ntodo = 0;
+	for (int j = 0; j < njobs; j++) {
+		struct load_job *job = &jobs[j];
+		int res = resident_find(job->file, job->preprocess ? nchannel : 0, job->fpga_addr, &keys[j], job_addr[j]);
+		if (res < 0)
+			goto fail;
+		if (res > 0) {
+			*job->pvec_sz = keys[j].size / job->elem_sz;
+			continue;
+		}
+		if (batch_mode && job->fpga_addr != RESIDENT_ANY && keys[j].size > HBM_VECT_SLOT_OFFSET) {
+			fprintf(stderr, "%s: vector too large for batch mode\n", job->file);
+			goto fail;
+		}
+		if (job->fpga_addr == RESIDENT_ANY) {
+			job->fpga_addr = allocated[j] = devmem_alloc(keys[j].size);
+			if (job->fpga_addr == 0)
+				goto fail;
+		} else {
+			resident_drop_range(job->fpga_addr, keys[j].size);
+		}
+		*job_addr[j] = job->fpga_addr;
+		job->phash = &keys[j].hash;
+		todo[ntodo++] = *job;
+	}
+	if (load_jobs_run(todo, ntodo) < 0)
+		goto fail;
+	for (int j = 0; j < njobs; j++) {
+		if (jobs[j].phash != NULL)
+			resident_add(&keys[j], jobs[j].fpga_addr, allocated[j] ? 0 : MAX(keys[j].size, 1));
+	}
+	free(jobs);
+	free(job_addr);
+	free(todo);
+	free(keys);
+	free(allocated);
+
+	for (int t = 0; t < d->ntiles; t++) {
+		struct spmv_tile *tile = &d->tiles[t];
+		for (int i = 0; i < nspmv; i++) {
+			if (ncol[t * nspmv + i] != tile->nnz[i]) {
+				fprintf(stderr, "spmv %d, tile %d: %u values but %u column indices\n", i, t, tile->nnz[i], ncol[t * nspmv + i]);
+				return -1;
+			}
+			tile->rows[i]--; // rowptr size is rows + 1
+			// the partition is the sum of its tiles
+			uint64_t nnz = (t > 0 ? d->nnz[i] : 0) + (uint64_t)tile->nnz[i];
+			if (tile->rows[i] != d->tiles[0].rows[i] || nnz > UINT32_MAX) {
+				fprintf(stderr, "spmv %d, tile %d: %u rows, %u non-zeros do not add up\n", i, t, tile->rows[i], tile->nnz[i]);
+				return -1;
+			}
+			d->nnz[i] = nnz;
+			d->rows[i] = tile->rows[i] + 1;
+			ncol[i] = nnz;
+		}
+	}
+	for (int i = 0; i < nspmv; i++) {
+		if (ncol[i] != d->nnz[i]) {
+			fprintf(stderr, "spmv %d: %u values but %u column indices\n", i, d->nnz[i], ncol[i]);
 			return -1;
-		rows[i]--; // rowptr size is rows + 1
+		}
+		d->rows[i]--; // rowptr size is rows + 1
 
-		sprintf(full_file_name, "%s/%d/%d.exp", folder_name, nspmv, i);
-		int fd = open(full_file_name, O_RDONLY);
-		if (fd < 0) {
-			fprintf(stderr, "unable to open [%s]\n", full_file_name);
-			return -1;
+		if (ref_from_exp) {
+			sprintf(full_file_name, "%s/%d/%d.exp", folder_name, nspmv, i);
+			if (load_exp(full_file_name, &d->nout[i], &d->ref_output_mem[i]) < 0)
+				return -1;
+		} else {
+			d->nout[i] = d->rows[i];
+			d->ref_output_mem[i] = (float *)malloc(MAX(d->nout[i], 1) * sizeof(float));
 		}
-		struct stat st;
-		if (fstat(fd, &st) < 0) {
-			fprintf(stderr, "fail to stat %s\n", full_file_name);
-			close(fd);
+		if (d->ntiles && d->nout[i] != d->rows[i]) {
+			fprintf(stderr, "spmv %d: %u outputs for %u rows, cannot be tiled\n", i, d->nout[i], d->rows[i]);
 			return -1;
 		}
-		if (st.st_size % sizeof(float)) {
-			fprintf(stderr, "funny file size that unaligned to data size: %lu to %lu\n", st.st_size, sizeof(float));
+		d->output_mem[i] = devmem_alloc(d->nout[i] * sizeof(float));
+		if (d->output_mem[i] == 0)
 			return -1;
+		if (d->ntiles) {
+			d->tile_output_mem[i] = devmem_alloc(d->nout[i] * sizeof(float));
+			if (d->tile_output_mem[i] == 0)
+				return -1;
 		}
-		nout[i] = st.st_size / sizeof(float);
-		host_output_mem[i] = (float *)malloc(st.st_size);
-		ref_output_mem[i] = (float *)malloc(st.st_size);
-		if (host_output_mem[i] == NULL || ref_output_mem[i] == NULL) {
+		d->host_output_mem[i] = (float *)malloc(MAX(d->nout[i], 1) * sizeof(float));
+		if (d->host_output_mem[i] == NULL || d->ref_output_mem[i] == NULL) {
 			fprintf(stderr, "fail to malloc output memory\n");
-			close(fd);
 			return -1;
 		}
-		int res = read(fd, ref_output_mem[i], st.st_size);
-		close(fd);
-		if (res < 0)
-			return -1;
 	}
+	if (sched_chunks && sched_plan(d, nspmv) < 0)
+		return -1;
+	timing_add(TIMING_LOAD, timing_now() - start);
+	load_stats_report();
+	resident_report();
+	resident_save();
+	return 0;
+
+fail:
+	for (int j = 0; j < njobs; j++)
+		devmem_free(allocated[j]);
+	free(jobs);
+	free(job_addr);
+	free(todo);
+	free(keys);
+	free(allocated);
+	return -1;
+}
+
+// Set up the reference of d, computed while the accelerators run.
+int ref_open_data(struct spmv_data *d, int nspmv)
+{
+	return ref_from_exp ? 0 : ref_open(d->folder, d->bench_name, nspmv, d->ref_output_mem);
+}
+
+
+// Print the test info of p, name its logs and configure MiCache for it.
+static void setup_point(const struct sweep_point *p, int num_spmv, char *logname, size_t size)
+{
+	uint32_t num_pc = MAX(p->v[SWEEP_HBM], 1);
+#if FPGAMSHR_EXISTS
+	int MSHR_divider = 0;
+	int subRow_divider = 0;
+	uint32_t total_cache_size = (CACHE_SIZE / 1024) * NUM_REQ_HANDLERS; // KB
+	uint32_t total_MSHR_number = MSHR_PER_HASH_TABLE * MSHR_HASH_TABLES * NUM_REQ_HANDLERS;
+	uint32_t cache_divider = p->v[SWEEP_CACHE];
+	uint32_t max_mshr = p->v[SWEEP_MSHR];
+
+	// for (MSHR_divider = 2; MSHR_divider < 3; MSHR_divider++) { // for mshr-rich test
+	#ifndef MSHR_INCLUSIVE
+	// MSHR_divider = cache_divider;
+	subRow_divider = MSHR_divider;
+	#else
+	MSHR_divider = cache_divider;
+	#endif
+	// effective_cache_size = total_cache_size / (2 ^ cache_divider)
+	uint32_t cache_size = cache_divider == CACHE_SIZE_REDUCTION_VALUES ? 0 : total_cache_size / (1 << cache_divider);
+	uint32_t MSHR_num = max_mshr ? max_mshr : total_MSHR_number / (1 << MSHR_divider);
+	uint32_t subRow_num = (total_MSHR_number / NUM_REQ_HANDLERS) / (1 << (subRow_divider));
+	printf("------------ Test Info ------------\n%s\nSpMV: %d\nHBM channels: %d\nCache size: %uKB\nMSHR number: %u\nSubentry row number: %u\n-----------------------------------\n",
+			p->bench, num_spmv, num_pc, cache_size, MSHR_num, subRow_num);
+	snprintf(logname, size, "%s_%dpe_%upc_%uKB_%uMSHR",
+				p->bench, num_spmv, num_pc, cache_size, MSHR_num);
+
+	FPGAMSHR_Clear_stats();
+	FPGAMSHR_Invalidate_cache();
+	if (cache_divider == CACHE_SIZE_REDUCTION_VALUES) {
+		FPGAMSHR_Disable_cache();
+	} else {
+		FPGAMSHR_Enable_cache();
+		FPGAMSHR_SetCacheDivider(cache_divider);
+		#ifndef MSHR_INCLUSIVE
+		FPGAMSHR_SetMshrDivider(MSHR_divider);
+		FPGAMSHR_SetMaxSubentryRow(subRow_num);
+		#endif
+	}
+	if (max_mshr)
+		FPGAMSHR_SetMaxMSHR(max_mshr);
+#else
+	printf("------------ Test Info ------------\n%s\nSpMV: %d\nHBM channels: %d\nNo MSHR\n-----------------------------------\n",
+				p->bench, num_spmv, num_pc);
+	snprintf(logname, size, "%s_%dpe_%upc_none", p->bench, num_spmv, num_pc);
+	FPGAMSHR_Clear_stats();
+#endif
+}
+
+// Fetch and verify the results of a run of p and record it. Returns -1 if
+// the results could not be fetched.
+static int finish_point(struct spmv_data *d, int num_spmv, int ref_ok, const struct sweep_point *p,
+						struct sweep_result *r)
+{
+	int res = fetch_result(d, num_spmv);
+	if (res < 0) {
+		r->status = "fail";
+	} else if (!ref_ok) {
+		printf("Result verification: no reference\n");
+		r->status = "noref";
+	} else {
+		compare_result(d, num_spmv, &r->verify);
+		r->status = r->verify.mismatches ? "mismatch" : "ok";
+	}
+	sweep_record(p, num_spmv, r);
+	return res;
+}
+
+// After a failed run: without a results database the program ends (-1),
+// with one the board is reset and the sweep goes on with the next point.
+static int recover_point(int num_spmv, const char *logname)
+{
+	if (sweep_db_path[0] == '\0')
+		return -1;
+	fprintf(stderr, "%s failed, resetting the board\n", logname);
+	#ifdef MSHR_INCLUSIVE
+	FPGAMSHR_Reset();
+	#endif
+	init_dma(num_spmv);
 	return 0;
 }
 
+// Iterative mode: x_{k+1} = A x_k for the given number of iterations, with the
+// partitions staying where load_data() put them. The vector ping-pongs between
+// d->vect_mem and the buffer HBM_VECT_SLOT_OFFSET above it, so an iteration
+// only re-points vect_mem and re-arms the DMA engines. The output DMA engines
+// only reach DDR, so the outputs are copied into the next vector through the
+// host, and MiCache is invalidated before the next iteration reads it. last
+// receives where the outputs of the last iteration are, the reference is
+// started on its input.
+static int run_iterations(const struct spmv_data *d, uint32_t nchannel, int num_spmv, const char *logname,
+						struct spmv_data *last)
+{
+	dma_stream_t streams[num_spmv * DMA_STREAMS_PER_SPMV];
+	struct qdma_iov status_iov[num_spmv * DMA_STREAMS_PER_SPMV];
+	uint32_t status_regs[num_spmv * DMA_STREAMS_PER_SPMV];
+	int status_stream[num_spmv * DMA_STREAMS_PER_SPMV];
+	uint64_t const vect[2] = { d->vect_mem, d->vect_mem + HBM_VECT_SLOT_OFFSET };
+	uint64_t const vec_bytes = (uint64_t)d->cols * sizeof(float);
+	uint64_t const vec_size = (vec_bytes + CACHELINE_SIZE - 1) / CACHELINE_SIZE * CACHELINE_SIZE;
+	uint32_t const nslice = MAX(nchannel, 1);
+	struct hbm_data_config hdc = { .channel_num = nchannel };
+	struct timing_sync sync[2];
+	uint32_t row_off[NUM_SPMV], rows = 0;
+	uint64_t *lat = NULL;
+	float *x = NULL, *y = NULL, *x0 = NULL;
+	char path[256];
+	int res = -1;
+
+	for (int i = 0; i < num_spmv; i++) {
+		row_off[i] = rows;
+		rows += d->rows[i];
+	}
+	if (rows != d->cols) {
+		fprintf(stderr, "iterative mode needs a square matrix, %s has %u rows and %u columns\n",
+				d->bench_name, rows, d->cols);
+		return -1;
+	}
+	if ((vec_size / CACHELINE_SIZE + nslice - 1) / nslice * CACHELINE_SIZE > HBM_VECT_SLOT_OFFSET) {
+		fprintf(stderr, "%s: vector too large for iterative mode\n", d->bench_name);
+		return -1;
+	}
+
+	// x0 from the file, the vector on the device is overwritten by the iterates
+	uint32_t n;
+	if (snprintf(path, sizeof(path), "%s/%d/%s.vec", d->folder, num_spmv, d->bench_name) >= sizeof(path)) {
+		fprintf(stderr, "path of %s.vec too long\n", d->bench_name);
+		return -1;
+	}
+	if (load_exp(path, &n, &x0) < 0)
+		return -1;
+	lat = malloc(iterations * sizeof(*lat));
+	x = aligned_alloc(CACHELINE_SIZE, vec_size);
+	y = aligned_alloc(CACHELINE_SIZE, vec_size);
+	if (lat == NULL || x == NULL || y == NULL) {
+		fprintf(stderr, "fail to malloc iteration buffers\n");
+		goto out;
+	}
+	memset(x, 0, vec_size);
+	memset(y, 0, vec_size);
+	memcpy(x, x0, MIN(n, d->cols) * sizeof(float));
+	resident_drop_range(d->vect_mem, nslice * HBM_CHANNEL_SIZE);
+	resident_save();
+	if ((nchannel ? write_vec_hbm(vect[0], (char *)x, vec_bytes, &hdc) : qdma_write(vect[0], x, vec_bytes)) < 0) {
+		perror("write x0");
+		goto out;
+	}
+
+	*last = *d;
+	for (int i = 0; i < num_spmv; i++) {
+		XSpmv_mult_axis_Set_val_size(spmv_bases[i], d->nnz[i]);
+		XSpmv_mult_axis_Set_output_size(spmv_bases[i], d->nout[i]);
+	}
+	snap_run(logname);
+	if (sampler_start() < 0)
+		goto out;
+	wait_stats_reset();
+	timing_run_begin();
+	timing_sync(&sync[0]);
+	for (int k = 0; k < iterations; k++) {
+		uint64_t start = timing_now(), t = start;
+		int in = k % 2;
+		last->vect_mem = vect[in];
+		for (int i = 0; i < num_spmv; i++)
+			XSpmv_mult_axis_Set_vect_mem(spmv_bases[i], last->vect_mem);
+		// the vector was rewritten behind the cache
+		FPGAMSHR_Invalidate_cache();
+		struct spmv_run run = {
+			.num_spmv = num_spmv,
+			.logname = logname,
+			.streams = streams,
+			.nstream = num_spmv * DMA_STREAMS_PER_SPMV,
+			.status_iov = status_iov,
+			.status_regs = status_regs,
+			.status_stream = status_stream,
+		};
+		if (sched_chunks) {
+			if (sched_run(last, &run) < 0)
+				goto out;
+			timing_add(TIMING_COMPUTE, timing_now() - t);
+		} else {
+			if (spmv_arm(last, num_spmv, streams) < 0)
+				goto out;
+			timing_add(TIMING_PROGRAM, timing_now() - t);
+			t = timing_now();
+			for (int i = 0; i < num_spmv; i++)
+				XSpmv_mult_axis_Start(spmv_bases[i]);
+			if (wait_until("DMA transfers", dma_check, &run) < 0)
+				goto out;
+			spmv_status_iov(&run, spmv_bases, XSPMV_MULT_AXIS_AXILITES_ADDR_AP_CTRL);
+			if (wait_until("SpMV", spmv_check, &run) < 0)
+				goto out;
+			timing_add(TIMING_COMPUTE, timing_now() - t);
+			t = timing_now();
+			spmv_status_iov(&run, out_dma_bases, XAXI_DMA_StatusReg(XAXIDMA_DEVICE_TO_DMA));
+			if (wait_until("output DMA", out_check, &run) < 0)
+				goto out;
+			timing_add(TIMING_DRAIN, timing_now() - t);
+		}
+
+		// the outputs become the next vector, x always holds the current one
+		if (k + 1 < iterations) {
+			for (int i = 0; i < num_spmv; i++) {
+				if (qdma_read(d->output_mem[i], y + row_off[i], d->rows[i] * sizeof(float)) < 0) {
+					fprintf(stderr, "fail to fetch output of %d spmv\n", i);
+					goto out;
+				}
+			}
+			if ((nchannel ? write_vec_hbm(vect[!in], (char *)y, vec_bytes, &hdc) : qdma_write(vect[!in], y, vec_bytes)) < 0) {
+				perror("write next vector");
+				goto out;
+			}
+			float *t = x;
+			x = y;
+			y = t;
+		}
+		lat[k] = timing_now() - start;
+	}
+	timing_sync(&sync[1]);
+	struct fpgamshr_stats stats;
+	snap_stats(SNAP_FINAL, &stats);
+	sampler_stop();
+
+	uint64_t total = 0, min = UINT64_MAX, max = 0;
+	for (int k = 1; k < iterations; k++) {
+		total += lat[k];
+		min = MIN(min, lat[k]);
+		max = MAX(max, lat[k]);
+	}
+	printf("Iterations: %d, first %lu us", iterations, lat[0] / 1000);
+	if (iterations > 1)
+		printf(", then min %lu us, avg %lu us, max %lu us", min / 1000, total / (iterations - 1) / 1000, max / 1000);
+	printf("\n");
+	spmv_cost_us = (total + lat[0]) / iterations / 1000;
+	FPGAMSHR_Write_stats_log(logname, &stats);
+	sampler_write(logname);
+	if (prof_read(prof_sample) == 0)
+		prof_report(prof_sample);
+	wait_stats_report();
+	timing_run_report(&sync[0], &sync[1]);
+
+	// x is the input of the last iteration
+	if (!ref_from_exp && (ref_set_vector(x) < 0 || ref_start() < 0))
+		goto out;
+	res = 0;
+out:
+	sampler_stop();
+	free(x0);
+	free(x);
+	free(y);
+	free(lat);
+	return res;
+}
+
+// Run one point of a sweep on d and record it.
+static int run_point(struct spmv_data *d, const struct sweep_point *p, int num_spmv, const char *logname)
+{
+	struct sweep_result r = { .status = "fail", .logname = logname };
+	struct spmv_data last;
+	sweep_begin(p, num_spmv);
+	int res = iterations > 0 ? run_iterations(d, p->v[SWEEP_HBM], num_spmv, logname, &last) :
+								test_spmv_mult_axis(d, num_spmv, logname);
+	if (res == 0) {
+		r.cost_us = spmv_cost_us;
+		prof_metrics(prof_sample, &r.prof);
+		res = finish_point(iterations > 0 ? &last : d, num_spmv, ref_from_exp || ref_wait() == 0, p, &r);
+	} else {
+		sweep_record(p, num_spmv, &r);
+	}
+	return res == 0 ? 0 : recover_point(num_spmv, logname);
+}
+
+// A matrix of batch mode, in the spmv_slots entry of the same index.
+struct batch_slot {
+	struct sweep_point point;
+	struct sweep_result result;
+	char logname[256];
+	int loaded;
+	int ran;				// results to fetch
+	int ref_ok;
+};
+
+// What the worker does while the accelerators run: finish the previous
+// matrix, then load the next one into the slot it leaves.
+struct batch_work {
+	struct batch_slot *slots;
+	int done;				// slot to finish, -1 if none
+	int next;				// slot to load, -1 if none
+	const char *next_folder;
+	int num_spmv;
+	uint32_t nchannel;
+	uint64_t load_ns;
+};
+
+static void *batch_worker(void *arg)
+{
+	struct batch_work *w = arg;
+	if (w->done >= 0) {
+		struct batch_slot *s = &w->slots[w->done];
+		s->ran = 0;
+		finish_point(&spmv_slots[w->done], w->num_spmv, s->ref_ok, &s->point, &s->result);
+	}
+	if (w->next >= 0) {
+		uint64_t start = timing_now();
+		w->slots[w->next].loaded = load_data(w->next_folder, w->num_spmv, w->nchannel, &spmv_slots[w->next]) == 0;
+		if (!w->slots[w->next].loaded)
+			fprintf(stderr, "fail to load data %s into FPGA\n", w->next_folder);
+		w->load_ns += timing_now() - start;
+	}
+	return NULL;
+}
+
+// Batch mode: the benchmarks run back to back at one point of the sweep axes,
+// double buffered in spmv_slots. While the accelerators work on a matrix, a
+// worker thread fetches and verifies the results of the previous one and
+// uploads the next one, so the upload and the result transfers overlap
+// with the computation instead of leaving the FPGA idle.
+static int run_batch(char **benchmarks, int nbench, int num_spmv)
+{
+	struct batch_slot slots[2] = { { .loaded = 0 } };
+	struct batch_work w = { slots, -1, -1, NULL, num_spmv, sweep_values[SWEEP_HBM][0], 0 };
+	uint64_t t1, t2, compute_us = 0;
+	int ntodo = 0, nrun = 0;
+	pthread_t tid;
+
+	// the benchmarks without results, see sweep.c
+	char *todo[nbench];
+	for (int b = 0; b < nbench; b++) {
+		struct sweep_point p = { basename(benchmarks[b]), { 0 } };
+		for (int a = 0; a < SWEEP_AXES; a++)
+			p.v[a] = sweep_nvalues[a] ? sweep_values[a][0] : 0;
+		if (sweep_pending(&p, num_spmv))
+			todo[ntodo++] = benchmarks[b];
+	}
+	if (ntodo == 0)
+		return 0;
+
+	t1 = timing_now();
+	w.next = 0;
+	w.next_folder = todo[0];
+	batch_worker(&w);
+	for (int i = 0; i < ntodo; i++) {
+		int cur = i % 2;
+		struct batch_slot *s = &slots[cur];
+		struct spmv_data *d = &spmv_slots[cur];
+		s->point.bench = basename(todo[i]);
+		for (int a = 0; a < SWEEP_AXES; a++)
+			s->point.v[a] = sweep_nvalues[a] ? sweep_values[a][0] : 0;
+		s->result = (struct sweep_result){ .status = "fail", .logname = s->logname };
+		w.done = i > 0 && slots[!cur].ran ? !cur : -1;
+		w.next = i + 1 < ntodo ? !cur : -1;
+		w.next_folder = i + 1 < ntodo ? todo[i + 1] : NULL;
+
+		setup_point(&s->point, num_spmv, s->logname, sizeof(s->logname));
+		sweep_begin(&s->point, num_spmv);
+		if (!s->loaded || ref_open_data(d, num_spmv) < 0) {
+			sweep_record(&s->point, num_spmv, &s->result);
+			batch_worker(&w);
+			continue;
+		}
+		if (pthread_create(&tid, NULL, batch_worker, &w) != 0) {
+			perror("batch worker");
+			return -1;
+		}
+		int res = test_spmv_mult_axis(d, num_spmv, s->logname);
+		if (res == 0) {
+			s->result.cost_us = spmv_cost_us;
+			prof_metrics(prof_sample, &s->result.prof);
+			s->ref_ok = ref_from_exp || ref_wait() == 0;
+			s->ran = 1;
+			compute_us += spmv_cost_us;
+			nrun++;
+		}
+		pthread_join(tid, NULL);
+		if (res != 0) {
+			sweep_record(&s->point, num_spmv, &s->result);
+			if (recover_point(num_spmv, s->logname) < 0)
+				return -1;
+		}
+	}
+	int last = (ntodo - 1) % 2;
+	if (slots[last].ran)
+		finish_point(&spmv_slots[last], num_spmv, slots[last].ref_ok, &slots[last].point, &slots[last].result);
+	t2 = timing_now();
+	printf("Batch: %d of %d matrices in %lu s %lu ms, %lu ms computing, %lu ms loading behind it\n",
+			nrun, ntodo, (t2 - t1) / 1000000000, (t2 - t1) / 1000000 % 1000, compute_us / 1000, w.load_ns / 1000000);
+	return 0;
+}
 
 /**
  * USAGE:
- * $ ./spmvtest QDMA_DEV_PATH BENCH_MATRIX_PATH
+ * $ ./spmvtest [-l sync|async|mmap[:populate,huge]] [-d DEPTH] [-j THREADS] [-w poll|backoff[:MAX_US]|event[:PATH]] [-t TIMEOUT_MS] [-c off|MANIFEST] [-e ULP[:ABS]] [-r host|exp] [-s off|PATH] [-p US[:MB]] [-x AXIS=V,...] [-o RESULTS] [-b] [-i ITERS] [-k CHUNKS] [-T] QDMA_DEV_PATH BENCH_MATRIX_PATH...
+ * QDMA_DEV_PATH may be "emu[:options]" to run on the stand-in device of qdma_emu.c.
+ * -l selects the matrix loader (default async), -d the number of chunks the async loader keeps in flight
+ * and -j the number of files loaded concurrently, each on its own QDMA queue.
+ * -w selects how completions are waited for (see wait.c), -t the timeout of each wait.
+ * -c sets where the resident-matrix cache is persisted (see resident.c), by default
+ * /var/tmp/spmvtest-DEV.resident for a QDMA device and nowhere for the stand-in; "off" disables it.
+ * -e sets the error an output may have, in ULP and absolute (see verify.c), -r where the expected
+ * output comes from: computed on the host during the run (default, see refspmv.c) or the .exp files.
+ * -s sets the file of the binary profiling snapshot stream (see snapshot.c), by default
+ * BENCH_MMDDhhmmss.snap; "off" disables it.
+ * -p samples the runtime counters every US microseconds into a buffer of MB megabytes (default 64)
+ * and writes them to runtime_LOGNAME_MMDDhhmmss.csv after each run (see sampler.c); off by default.
+ * -x sweeps an axis over the values given, one -x per axis: cache (dividers, default all),
+ * mshr (maxAllowedMSHRs, default as reset) or hbm (channels the vector is striped over, default 0:
+ * host layout); every benchmark runs at every point (see sweep.c). -o appends the results to the
+ * CSV database RESULTS and resumes the sweep from it, skipping the points it already has.
+ * -b runs the benchmarks back to back at one point, each uploaded while the previous one computes.
+ * -i runs ITERS iterations of x = A x at every point, the matrix staying on the device and the vector
+ * alternating between two HBM buffers; the last iteration is verified.
+ * -k splits the partitions into about CHUNKS chunks of equal non-zeros per accelerator, handed to
+ * whichever accelerator is idle (0: every accelerator runs its own partition, the default).
+ * -T runs the column tiles of the matrices (converted with mm2csr -T) one after the other, adding up
+ * their partial outputs on the host.
  */
 int main(int argc, char *argv[])
 {
-	if (argc < 3) {
-		fprintf(stderr, "args too less!\nbin QDMA_DEV_PATH BENCH_NAME\n");
+	int opt;
+	while ((opt = getopt(argc, argv, "l:d:j:w:t:c:e:r:s:p:x:o:bi:k:T")) != -1) {
+		switch (opt) {
+		case 'l':
+			if (strcmp(optarg, "sync") == 0)
+				load_mode = LOAD_MODE_SYNC;
+			else if (strcmp(optarg, "async") == 0)
+				load_mode = LOAD_MODE_ASYNC;
+			else if (strncmp(optarg, "mmap", 4) == 0 && (optarg[4] == '\0' || optarg[4] == ':')) {
+				load_mode = LOAD_MODE_MMAP;
+				if (strstr(optarg, "populate"))
+					loader_mmap_flags |= MAP_POPULATE;
+				if (strstr(optarg, "huge"))
+					loader_mmap_huge = 1;
+			} else {
+				fprintf(stderr, "unknown loader %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'd':
+			loader_depth = atoi(optarg);
+			break;
+		case 'j':
+			loader_threads = atoi(optarg);
+			break;
+		case 'w':
+			if (wait_parse_mode(optarg) < 0) {
+				fprintf(stderr, "unknown wait mode %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 't':
+			wait_timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			if (strcmp(optarg, "off") == 0)
+				resident_enabled = 0;
+			else
+				snprintf(resident_manifest, sizeof(resident_manifest), "%s", optarg);
+			break;
+		case 'e':
+			if (verify_parse_tolerance(optarg) < 0) {
+				fprintf(stderr, "bad tolerance %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'r':
+			if (strcmp(optarg, "host") == 0)
+				ref_from_exp = 0;
+			else if (strcmp(optarg, "exp") == 0)
+				ref_from_exp = 1;
+			else {
+				fprintf(stderr, "unknown reference %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 's':
+			if (strcmp(optarg, "off") == 0)
+				snap_enabled = 0;
+			else
+				snprintf(snap_path, sizeof(snap_path), "%s", optarg);
+			break;
+		case 'p':
+			if (sampler_parse(optarg) < 0) {
+				fprintf(stderr, "bad sampling period %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'x':
+			if (sweep_parse(optarg) < 0) {
+				fprintf(stderr, "bad sweep axis %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'o':
+			snprintf(sweep_db_path, sizeof(sweep_db_path), "%s", optarg);
+			break;
+		case 'b':
+			batch_mode = 1;
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			if (iterations <= 0) {
+				fprintf(stderr, "bad iteration count %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'k':
+			sched_chunks = atoi(optarg);
+			if (sched_chunks < 0) {
+				fprintf(stderr, "bad chunk count %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'T':
+			tiled = 1;
+			break;
+		default:
+			return -1;
+		}
+	}
+	for (int a = 0; a < SWEEP_AXES; a++) {
+		if (batch_mode && sweep_nvalues[a] > 1) {
+			fprintf(stderr, "batch mode runs at one point, give one value per axis\n");
+			return -1;
+		}
+	}
+	if (iterations > 0 && (batch_mode || ref_from_exp)) {
+		fprintf(stderr, "iterative mode uses the second vector of batch mode and verifies against the host reference\n");
+		return -1;
+	}
+	if (tiled && (iterations > 0 || sched_chunks)) {
+		fprintf(stderr, "column tiles run neither in iterative mode nor with the dynamic scheduler\n");
+		return -1;
+	}
+	if (argc - optind < 2) {
+		fprintf(stderr, "args too less!\nbin [-l sync|async|mmap[:populate,huge]] [-d DEPTH] [-j THREADS] [-w poll|backoff[:MAX_US]|event[:PATH]] [-t TIMEOUT_MS] [-c off|MANIFEST] [-e ULP[:ABS]] [-r host|exp] [-s off|PATH] [-p US[:MB]] [-x AXIS=V,...] [-o RESULTS] [-b] [-i ITERS] [-k CHUNKS] [-T] QDMA_DEV_PATH BENCH_NAME...\n");
 		return -1;
 	}
 
-	extern int qdmafd;
-	qdmafd = open(argv[1], O_RDWR);
-	if (qdmafd < 0) {
-		fprintf(stderr, "unable to open device %s\n", argv[1]);
+	if (qdma_open(argv[optind]) < 0) {
+		fprintf(stderr, "unable to open device %s\n", argv[optind]);
 		perror("qdma open");
 		return -1;
 	}
+	if (resident_enabled && resident_manifest[0] == '\0' && qdma_ops == &qdma_dev_ops) {
+		char dev[256];
+		snprintf(dev, sizeof(dev), "%s", argv[optind]);
+		snprintf(resident_manifest, sizeof(resident_manifest), "/var/tmp/spmvtest-%s.resident", basename(dev));
+	}
+	if (resident_init() < 0)
+		return -1;
 
-	char *benchmark = argv[2];
-	char *benchname = basename(benchmark);
-	if (benchname == NULL)
-		benchname = benchmark;
+	char *benchname = basename(argv[optind + 1]);
 	char logname[256];
-	
+
 	int num_spmv;
-	int cache_divider = 0;
-	int MSHR_divider = 0;
-	int subRow_divider = 0;
-	int mshr_count_idx;
-	uint32_t num_hbm_channel = 1;
-	uint32_t total_cache_size = (CACHE_SIZE / 1024) * NUM_REQ_HANDLERS; // KB
-	uint32_t total_MSHR_number = MSHR_PER_HASH_TABLE * MSHR_HASH_TABLES * NUM_REQ_HANDLERS;
 	num_spmv = NUM_SPMV;
 
 	FPGAMSHR_Set_base(fpgamshr_base);
+	if (prof_init() < 0)
+		return -1;
+	sweep_defaults();
+	if (sweep_open() < 0)
+		return -1;
+	if (snap_enabled) {
+		if (snap_path[0] == '\0') {
+			time_t now = time(NULL);
+			struct tm *t = localtime(&now);
+			snprintf(snap_path, sizeof(snap_path), "%s_%02d%02d%02d%02d%02d.snap", benchname,
+						t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+		}
+		if (snap_open() < 0)
+			return -1;
+	}
 
 	printf("init DMA\n");
 	#ifdef MSHR_INCLUSIVE
@@ -755,79 +2062,53 @@ int main(int argc, char *argv[])
 	init_dma(num_spmv);
 	printf("DMA init done\n");
 
-	// for (num_hbm_channel = 1; num_hbm_channel <= 16; num_hbm_channel <<= 1)
-	{	
+	if (batch_mode) {
+		if (run_batch(&argv[optind + 1], argc - optind - 1, num_spmv) < 0)
+			return -1;
+	} else
+	// the data of a benchmark is loaded once per HBM channel count and stays
+	// on the device for all cache and MSHR settings, see sweep.c
+	for (int bench = optind + 1; bench < argc; bench++)
+	for (int h = 0; h < sweep_nvalues[SWEEP_HBM]; h++) {
+		struct spmv_data *d = &spmv_slots[0];
+		char *benchmark = argv[bench];
+		benchname = basename(benchmark);
+		uint32_t num_hbm_channel = sweep_values[SWEEP_HBM][h];
+		if (!sweep_pending_load(benchname, num_hbm_channel, num_spmv))
+			continue;
+
 		debug_data_read_printf("Reading data...\n");
-		// if (load_data(benchmark, num_spmv, num_hbm_channel) < 0) {
-		if (load_data(benchmark, num_spmv, 0) < 0) {
+		if (load_data(benchmark, num_spmv, num_hbm_channel, d) < 0 || ref_open_data(d, num_spmv) < 0) {
 			fprintf(stderr, "fail to load data %s into FPGA\n", benchmark);
-			// continue;
+			continue;
 		}
 		debug_data_read_printf("...done\n");
-		printf("Data stat:\ncols: %u\n", cols);
+		printf("Data stat:\ncols: %u\n", d->cols);
 		for (int i = 0; i < num_spmv; i++) {
-			printf("spmv %d: nnz=%u, rows=%u, nout=%u\n", i, nnz[i], rows[i], nout[i]);
-		}
-
-	#if FPGAMSHR_EXISTS
-		// we iterate over all possible cache size values
-		// effective_cache_size = total_cache_size / (2 ^ cache_divider)
-		for (cache_divider = 0; cache_divider < CACHE_SIZE_REDUCTION_VALUES; cache_divider++) {
-		// for (MSHR_divider = 2; MSHR_divider < 3; MSHR_divider++) { // for mshr-rich test
-			#ifndef MSHR_INCLUSIVE
-			// MSHR_divider = cache_divider;
-			subRow_divider = MSHR_divider;
-			#else
-			MSHR_divider = cache_divider;
-			#endif
-			uint32_t cache_size = cache_divider == CACHE_SIZE_REDUCTION_VALUES ? 0 : total_cache_size / (1 << cache_divider);
-			uint32_t MSHR_num = total_MSHR_number / (1 << MSHR_divider);
-			uint32_t subRow_num = (total_MSHR_number / NUM_REQ_HANDLERS) / (1 << (subRow_divider));
-			printf("------------ Test Info ------------\n%s\nSpMV: %d\nHBM channels: %d\nCache size: %uKB\nMSHR number: %u\nSubentry row number: %u\n-----------------------------------\n",
-					benchname, num_spmv, num_hbm_channel, cache_size, MSHR_num, subRow_num);
-			snprintf(logname, sizeof(logname), "%s_%dpe_%upc_%uKB_%uMSHR",
-						benchname, num_spmv, num_hbm_channel, cache_size, MSHR_num);
-
-			FPGAMSHR_Clear_stats();
-			FPGAMSHR_Invalidate_cache();
-			if (cache_divider == CACHE_SIZE_REDUCTION_VALUES) {
-				FPGAMSHR_Disable_cache();
-			} else {
-				FPGAMSHR_Enable_cache();
-				FPGAMSHR_SetCacheDivider(cache_divider);
-				#ifndef MSHR_INCLUSIVE
-				FPGAMSHR_SetMshrDivider(MSHR_divider);
-				FPGAMSHR_SetMaxSubentryRow(subRow_num);
-				#endif
-			}
+			printf("spmv %d: nnz=%u, rows=%u, nout=%u\n", i, d->nnz[i], d->rows[i], d->nout[i]);
+		}
 
-			if (test_spmv_mult_axis(num_spmv, logname) != 0) {
+		for (int c = 0; c < (FPGAMSHR_EXISTS ? sweep_nvalues[SWEEP_CACHE] : 1); c++)
+		for (int m = 0; m < (FPGAMSHR_EXISTS ? MAX(sweep_nvalues[SWEEP_MSHR], 1) : 1); m++) {
+			struct sweep_point point = { benchname, { 0 } };
+			point.v[SWEEP_CACHE] = FPGAMSHR_EXISTS ? sweep_values[SWEEP_CACHE][c] : 0;
+			point.v[SWEEP_MSHR] = sweep_nvalues[SWEEP_MSHR] ? sweep_values[SWEEP_MSHR][m] : 0;
+			point.v[SWEEP_HBM] = num_hbm_channel;
+			if (!sweep_pending(&point, num_spmv))
+				continue;
+			setup_point(&point, num_spmv, logname, sizeof(logname));
+			if (run_point(d, &point, num_spmv, logname) < 0)
 				return -1;
-			}
-			fetch_result(num_spmv);
-			compare_result(num_spmv);
-		// }
 		}
-	#else
-		printf("------------ Test Info ------------\n%s\nSpMV: %d\nHBM channels: %d\nNo MSHR\n-----------------------------------\n",
-					benchname, num_spmv, num_hbm_channel);
-		snprintf(logname, sizeof(logname), "%s_%dpe_%upc_none", benchname, num_spmv, num_hbm_channel);
-		FPGAMSHR_Clear_stats();
-		if (test_spmv_mult_axis(num_spmv, logname) != 0)
-			return -1;
-		fetch_result(num_spmv);
-		compare_result(num_spmv);
-	#endif
 
 		// Uncomment to get a full dump of the internal performance registers
 		// FPGAMSHR_Get_stats_pretty();
-		for (int i = 0; i < num_spmv; i++) {
-			free(ref_output_mem[i]);
-			ref_output_mem[i] = NULL;
-			free(host_output_mem[i]);
-			host_output_mem[i] = NULL;
-		}
 	}
-	close(qdmafd);
+	timing_report();
+	sweep_close();
+	ref_close();
+	sampler_stop();
+	snap_close();
+	qdma_close();
     return 0;
 }
@@ -0,0 +1,268 @@
+/*
+ * Bulk reader of the MiCache profiling counters.
+ *
+ * The register map is the hand-written one of the driver
+ * (fpgamshr_stats_blocks). Built with USE_PROFILING_MAP (make
+ * GENERATED_MAP=1), it is taken from profiling_map.h instead, which the
+ * Vivado builder generates next to params.h from the ProfilingSelector
+ * hierarchy of the design (see ProfilingMap in Profiling.scala). The
+ * generated map has not been checked against a build yet, hence opt-in.
+ *
+ * prof_init() turns the map into a read plan: register ranges less than
+ * PROF_MERGE_GAP registers apart are merged, since reading a few unused
+ * registers costs less than another transfer, so prof_read() takes a
+ * snapshot and reads every counter with one qdma_readv() of few transfers.
+ * A sample is a flat array of all counters, block by block and instance by
+ * instance; prof_metrics() derives hit rate, MSHR occupancy and stall
+ * fractions from it. Only one thread may read at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "def.h"
+
+// One block of the register map: the same counters in every instance,
+// instance i starting at register reg + i * stride.
+struct prof_block {
+	const char *name;
+	const char **items;
+	uint32_t words;
+	uint64_t reg;
+	uint64_t stride;
+	uint32_t instances;
+};
+
+#ifdef USE_PROFILING_MAP
+#include "profiling_map.h"
+#endif
+
+#define PROF_MERGE_GAP		16		// registers
+
+struct prof_metrics {
+	uint64_t cycles;
+	double hit_rate;			// of the requests to the banks, < 0 if unknown
+	double mshr_occupancy;		// MSHRs in use per bank, on average
+	double alloc_stall;			// fraction of cycles the banks stalled allocations
+	double mem_not_ready;		// fraction of cycles memory did not accept requests
+};
+
+static struct {
+	const struct prof_block *map;
+	int nblocks;
+	uint32_t *first;			// per block: index of its first counter in a sample
+	uint32_t ncounters;
+	struct qdma_iov *iov;
+	int niov;
+	uint64_t *raw;				// registers as read, gaps included
+	uint32_t *pos;				// per counter: index in raw
+} prof;
+
+uint64_t *prof_sample;			// for the caller, prof_counters() long
+
+#ifndef PROFILING_MAP_H
+static struct prof_block prof_driver_map[FPGAMSHR_STATS_BLOCKS];
+#endif
+
+static int prof_cmp_range(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+	return x[0] < y[0] ? -1 : x[0] > y[0];
+}
+
+int prof_init(void)
+{
+#ifdef PROFILING_MAP_H
+	prof.map = profiling_map;
+	prof.nblocks = sizeof(profiling_map) / sizeof(profiling_map[0]);
+#else
+	for (int b = 0; b < FPGAMSHR_STATS_BLOCKS; b++) {
+		const struct fpgamshr_stats_block *s = &fpgamshr_stats_blocks[b];
+		prof_driver_map[b] = (struct prof_block){ s->name, s->items, s->words, s->reg, s->stride, s->instances };
+	}
+	prof.map = prof_driver_map;
+	prof.nblocks = FPGAMSHR_STATS_BLOCKS;
+#endif
+
+	int nranges = 0;
+	prof.ncounters = 0;
+	prof.first = malloc(prof.nblocks * sizeof(*prof.first));
+	for (int b = 0; b < prof.nblocks; b++) {
+		prof.first[b] = prof.ncounters;
+		prof.ncounters += prof.map[b].instances * prof.map[b].words;
+		nranges += prof.map[b].instances;
+	}
+	// ranges as { first register, words, first counter }, sorted by register
+	uint64_t (*range)[3] = malloc(nranges * sizeof(*range));
+	prof.pos = malloc(prof.ncounters * sizeof(*prof.pos));
+	prof.iov = malloc(nranges * sizeof(*prof.iov));
+	if (prof.first == NULL || range == NULL || prof.pos == NULL || prof.iov == NULL) {
+		free(range);
+		fprintf(stderr, "fail to set up the profiling reader\n");
+		return -1;
+	}
+	int n = 0;
+	for (int b = 0; b < prof.nblocks; b++) {
+		for (int i = 0; i < prof.map[b].instances; i++, n++) {
+			range[n][0] = prof.map[b].reg + i * prof.map[b].stride;
+			range[n][1] = prof.map[b].words;
+			range[n][2] = prof.first[b] + i * prof.map[b].words;
+		}
+	}
+	qsort(range, nranges, sizeof(*range), prof_cmp_range);
+
+	// merge close ranges into transfers, then place them in raw
+	uint64_t nraw = 0;
+	prof.niov = 0;
+	for (int r = 0; r < nranges; r++) {
+		struct qdma_iov *t = prof.niov ? &prof.iov[prof.niov - 1] : NULL;
+		uint64_t end = t ? (t->addr + t->size) / sizeof(uint64_t) : 0;
+		if (t && range[r][0] <= end + PROF_MERGE_GAP) {
+			uint64_t new_end = MAX(end, range[r][0] + range[r][1]);
+			nraw += new_end - end;
+			t->size = (new_end - t->addr / sizeof(uint64_t)) * sizeof(uint64_t);
+		} else {
+			t = &prof.iov[prof.niov++];
+			t->addr = range[r][0] * sizeof(uint64_t);
+			t->size = range[r][1] * sizeof(uint64_t);
+			t->data = (void *)(uintptr_t)nraw;		// offset for now
+			nraw += range[r][1];
+		}
+		uint64_t base = (uintptr_t)t->data + range[r][0] - t->addr / sizeof(uint64_t);
+		for (uint64_t w = 0; w < range[r][1]; w++)
+			prof.pos[range[r][2] + w] = base + w;
+	}
+	free(range);
+	prof.raw = malloc(nraw * sizeof(uint64_t));
+	prof_sample = calloc(prof.ncounters, sizeof(uint64_t));
+	if (prof.raw == NULL || prof_sample == NULL) {
+		fprintf(stderr, "fail to set up the profiling reader\n");
+		return -1;
+	}
+	for (int t = 0; t < prof.niov; t++) {
+		prof.iov[t].data = prof.raw + (uintptr_t)prof.iov[t].data;
+		prof.iov[t].addr += FPGAMSHR_Get_base();
+	}
+	return 0;
+}
+
+// Counters in a sample.
+uint32_t prof_counters(void)
+{
+	return prof.ncounters;
+}
+
+// Take a profiling snapshot and read all counters into s.
+int prof_read(uint64_t *s)
+{
+	FPGAMSHR_Snapshot_lock();
+	FPGAMSHR_Profiling_snapshot();
+	if (qdma_readv(prof.iov, prof.niov) < 0) {
+		perror("read profiling counters");
+		FPGAMSHR_Snapshot_unlock();
+		return -1;
+	}
+	for (uint32_t c = 0; c < prof.ncounters; c++)
+		s[c] = prof.raw[prof.pos[c]];
+	FPGAMSHR_Snapshot_unlock();
+	return 0;
+}
+
+// Block and counter index of item in block name, -1 if the design has none.
+static int prof_find(const char *name, const char *item, int *block)
+{
+	for (int b = 0; b < prof.nblocks; b++) {
+		if (strcmp(prof.map[b].name, name) != 0)
+			continue;
+		for (int i = 0; i < prof.map[b].words; i++) {
+			if (strcmp(prof.map[b].items[i], item) == 0) {
+				*block = b;
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+// Take a profiling snapshot and read only the total cycles counter, a
+// single register read. Returns -1 if the design has none.
+int prof_cycles(uint64_t *cycles)
+{
+	int b, i = prof_find("misc", "total cycles", &b);
+	if (i < 0)
+		return -1;
+	FPGAMSHR_Snapshot_lock();
+	FPGAMSHR_Profiling_snapshot();
+	if (qdma_read(FPGAMSHR_Get_base() + (prof.map[b].reg + i) * sizeof(uint64_t), cycles, sizeof(*cycles)) < 0) {
+		perror("read total cycles");
+		FPGAMSHR_Snapshot_unlock();
+		return -1;
+	}
+	FPGAMSHR_Snapshot_unlock();
+	return 0;
+}
+
+// Sum of a counter over all instances, -1 if the design has none.
+static double prof_sum(const uint64_t *s, const char *name, const char *item, uint32_t *instances)
+{
+	int b, i = prof_find(name, item, &b);
+	if (i < 0)
+		return -1;
+	double sum = 0;
+	for (int k = 0; k < prof.map[b].instances; k++)
+		sum += s[prof.first[b] + k * prof.map[b].words + i];
+	if (instances)
+		*instances = prof.map[b].instances;
+	return sum;
+}
+
+static double prof_ratio(double a, double b)
+{
+	return a >= 0 && b > 0 ? a / b : -1;
+}
+
+void prof_metrics(const uint64_t *s, struct prof_metrics *m)
+{
+	uint32_t banks = 0, ports = 0;
+	double cycles = prof_sum(s, "misc", "total cycles", NULL);
+	m->cycles = MAX(cycles, 0);
+
+	// the in-cache MSHR answers hits itself, the traditional design has a cache in front
+	double hits = prof_sum(s, "mshr", "cache hit count", NULL);
+	double reqs = prof_sum(s, "mshr", "accepted allocs count", NULL);
+	if (hits < 0) {
+		hits = prof_sum(s, "cache", "hits", NULL);
+		reqs = prof_sum(s, "cache", "received requests", NULL);
+	}
+	m->hit_rate = prof_ratio(hits, reqs);
+	double accum = prof_sum(s, "mshr", "accum used MSHR", &banks);
+	m->mshr_occupancy = prof_ratio(accum, cycles * banks);
+	m->alloc_stall = prof_ratio(prof_sum(s, "mshr", "cycles allocs stall", &banks), cycles * banks);
+	double not_ready = prof_sum(s, "misc", "mem cycles not ready", &ports);
+	if (not_ready < 0) {
+		// one counter per port in the generated map
+		char item[64];
+		not_ready = 0;
+		for (ports = 0; snprintf(item, sizeof(item), "mem cycles not ready %u", ports),
+				prof_sum(s, "misc", item, NULL) >= 0; ports++)
+			not_ready += prof_sum(s, "misc", item, NULL);
+	}
+	m->mem_not_ready = prof_ratio(not_ready, cycles * ports);
+}
+
+void prof_report(const uint64_t *s)
+{
+	struct prof_metrics m;
+	prof_metrics(s, &m);
+	printf("MiCache: %lu cycles", m.cycles);
+	if (m.hit_rate >= 0)
+		printf(", hit rate %.1f%%", m.hit_rate * 100);
+	if (m.mshr_occupancy >= 0)
+		printf(", %.1f MSHRs in use per bank", m.mshr_occupancy);
+	if (m.alloc_stall >= 0)
+		printf(", allocations stalled %.1f%%", m.alloc_stall * 100);
+	if (m.mem_not_ready >= 0)
+		printf(", memory not ready %.1f%%", m.mem_not_ready * 100);
+	printf(" (%u counters in %d transfers)\n", prof.ncounters, prof.niov);
+}
@@ -0,0 +1,700 @@
+/*
+ * Userspace stand-in for the QDMA device of the U280 design.
+ *
+ * It models the AXI-lite register maps of the AXI DMA engines (XAXI_DMA_*),
+ * the SpMV accelerators (XSpmv_mult_axis_*) and the FPGAMSHR profiling
+ * block, and backs DDR/HBM with lazily allocated host memory, so the host
+ * program can be run and timed without a board. Select it by passing
+ * "emu[:options]" instead of the QDMA device path. Options are separated by
+ * commas:
+ *   func       run a functional SpMV, so that results can be verified
+ *   sg         DMA engines in scatter-gather mode (c_include_sg)
+ *   bw=N       per-engine DMA stream bandwidth in MB/s (default 1000)
+ *   clk=N      accelerator clock in MHz (default 250)
+ *
+ * Transfers and SpMV runs complete after the time the bandwidth and clock
+ * model predicts, so the host polling loops behave as on hardware. A timerfd
+ * armed for the next completion serves as completion fd for "-w event".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include "def.h"
+
+// Address map of the block design (see util/genprj.tcl)
+#define EMU_REG_BASE			0x100000000UL
+#define EMU_REG_END				0x200000000UL
+#define EMU_WINDOW_SIZE			0x10000
+#define EMU_SPMV_BASE			0x100010000UL
+#define EMU_DMA_BASE			0x100050000UL
+#define EMU_DMA_STRIDE			0x40000
+#if NUM_REQ_HANDLERS <= 4
+#define EMU_FPGAMSHR_BASE		0x100000000UL
+#else
+#define EMU_FPGAMSHR_BASE		0x100160000UL
+#endif
+#define EMU_FPGAMSHR_REGS		((NUM_INPUTS + NUM_REQ_HANDLERS + 1) * REGS_PER_REQ_HANDLER)
+
+#define EMU_MEM_SPAN			(1UL << 34)		// HBM at 0, DDR at DDR_BASE_ADDR
+#define EMU_PAGE_SHIFT			21
+#define EMU_PAGE_SIZE			(1UL << EMU_PAGE_SHIFT)
+#define EMU_NUM_PAGES			(EMU_MEM_SPAN >> EMU_PAGE_SHIFT)
+
+#define EMU_DMA_REGS			(0x60 / sizeof(uint32_t))
+#define EMU_DMA_ROW				0
+#define EMU_DMA_COL				1
+#define EMU_DMA_VAL				2
+#define EMU_DMA_OUT				3
+
+struct emu_seg {
+	uint64_t addr;
+	uint32_t len;
+};
+
+struct emu_dma_chan {
+	int halted;
+	int busy;
+	uint64_t done_ns;		// completion time of the current transfer
+	uint64_t arm_ns;
+	uint32_t len;
+	struct emu_seg *segs;	// transfers since the engine was last started
+	int nseg, capseg;
+	uint64_t bytes;
+	uint64_t last_ns;		// completion time of the latest transfer
+};
+
+struct emu_dma {
+	uint32_t regs[EMU_DMA_REGS];
+	struct emu_dma_chan chan[2];	// MM2S, S2MM
+};
+
+struct emu_spmv {
+	uint32_t regs[4];		// ap_ctrl, val_size, output_size, vect_mem
+	int running;
+	int computed;
+	uint64_t start_ns;
+	uint64_t compute_done_ns;
+	float *out;
+	uint64_t drained;
+	int drained_seg;		// output segments written back so far
+	struct emu_dma *dma[4];
+};
+
+static struct {
+	int functional;
+	int sg;					// DMA engines built with scatter-gather
+	uint64_t bw;			// MB/s, i.e. bytes per us
+	uint64_t clk;			// MHz
+	pthread_mutex_t lock;
+	pthread_mutex_t page_lock;
+	char *pages[EMU_NUM_PAGES];
+	struct emu_dma dma[NUM_SPMV][4];
+	struct emu_spmv spmv[NUM_SPMV];
+	uint64_t fpgamshr[EMU_FPGAMSHR_REGS];
+	uint64_t cycles_origin_ns;
+	int timerfd;			// completion fd, see emu_event_fd()
+	uint64_t event_armed_ns;
+	// transport accounting
+	uint64_t submissions;
+	uint64_t reg_reads, reg_writes;
+	uint64_t mem_reads, mem_writes;
+	uint64_t mem_read_bytes, mem_write_bytes;
+} emu = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.page_lock = PTHREAD_MUTEX_INITIALIZER,
+	.timerfd = -1,
+};
+
+static uint64_t emu_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static char *emu_page(uint64_t addr, int create)
+{
+	uint64_t idx = addr >> EMU_PAGE_SHIFT;
+	char *p = __atomic_load_n(&emu.pages[idx], __ATOMIC_ACQUIRE);
+	if (p != NULL || !create)
+		return p;
+	pthread_mutex_lock(&emu.page_lock);
+	p = emu.pages[idx];
+	if (p == NULL) {
+		p = calloc(1, EMU_PAGE_SIZE);
+		__atomic_store_n(&emu.pages[idx], p, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&emu.page_lock);
+	return p;
+}
+
+static int emu_mem_read(uint64_t addr, void *data, size_t size)
+{
+	if (addr + size > EMU_MEM_SPAN) {
+		errno = EFAULT;
+		return -1;
+	}
+	while (size > 0) {
+		uint64_t off = addr & (EMU_PAGE_SIZE - 1);
+		size_t n = MIN(size, EMU_PAGE_SIZE - off);
+		char *p = emu_page(addr, 0);
+		if (p != NULL)
+			memcpy(data, p + off, n);
+		else
+			memset(data, 0, n);
+		addr += n;
+		data = (char *)data + n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int emu_mem_write(uint64_t addr, const void *data, size_t size)
+{
+	if (addr + size > EMU_MEM_SPAN) {
+		errno = EFAULT;
+		return -1;
+	}
+	while (size > 0) {
+		uint64_t off = addr & (EMU_PAGE_SIZE - 1);
+		size_t n = MIN(size, EMU_PAGE_SIZE - off);
+		char *p = emu_page(addr, 1);
+		if (p == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(p + off, data, n);
+		addr += n;
+		data = (const char *)data + n;
+		size -= n;
+	}
+	return 0;
+}
+
+static inline float emu_mem_float(uint64_t addr)
+{
+	char *p = emu_page(addr, 0);
+	return p == NULL ? 0.0f : *(float *)(p + (addr & (EMU_PAGE_SIZE - 1)));
+}
+
+static uint64_t emu_transfer_ns(uint64_t bytes)
+{
+	return bytes * 1000 / emu.bw;
+}
+
+// Gather the stream a DMA channel has delivered since the engine started.
+static void *emu_gather(struct emu_dma_chan *ch, uint64_t bytes)
+{
+	char *buf = malloc(bytes ? bytes : 1);
+	uint64_t off = 0;
+	if (buf == NULL)
+		return NULL;
+	for (int i = 0; i < ch->nseg && off < bytes; i++) {
+		uint64_t n = MIN(ch->segs[i].len, bytes - off);
+		emu_mem_read(ch->segs[i].addr, buf + off, n);
+		off += n;
+	}
+	return buf;
+}
+
+static void emu_spmv_compute(struct emu_spmv *e)
+{
+	uint32_t nnz = e->regs[1];
+	uint32_t nout = e->regs[2];
+	uint64_t vect = e->regs[3];
+
+	e->out = calloc(nout ? nout : 1, sizeof(float));
+	if (!emu.functional || e->out == NULL)
+		return;
+	uint32_t *rowptr = emu_gather(&e->dma[EMU_DMA_ROW]->chan[0], (nout + 1) * sizeof(uint32_t));
+	uint32_t *col = emu_gather(&e->dma[EMU_DMA_COL]->chan[0], nnz * sizeof(uint32_t));
+	float *val = emu_gather(&e->dma[EMU_DMA_VAL]->chan[0], nnz * sizeof(float));
+	if (rowptr != NULL && col != NULL && val != NULL) {
+		uint32_t k = 0;
+		for (uint32_t r = 0; r < nout; r++) {
+			uint32_t len = rowptr[r + 1] - rowptr[r];
+			float sum = 0;
+			for (uint32_t j = 0; j < len && k < nnz; j++, k++)
+				sum += val[k] * emu_mem_float(HBM_BASE_ADDR + vect + ((uint64_t)(col[k] & 0x7fffffff) << 2));
+			e->out[r] = sum;
+		}
+	}
+	free(rowptr);
+	free(col);
+	free(val);
+}
+
+static void emu_chan_reset_segs(struct emu_dma_chan *ch)
+{
+	ch->nseg = 0;
+	ch->bytes = 0;
+	ch->last_ns = 0;
+}
+
+// Bring the state of an accelerator and its DMA engines up to time now.
+static void emu_spmv_advance(struct emu_spmv *e, uint64_t now)
+{
+	struct emu_dma_chan *out = &e->dma[EMU_DMA_OUT]->chan[1];
+	uint32_t nnz = e->regs[1];
+	uint32_t nout = e->regs[2];
+
+	if (!e->running)
+		return;
+	if (!e->computed) {
+		struct emu_dma_chan *row = &e->dma[EMU_DMA_ROW]->chan[0];
+		struct emu_dma_chan *col = &e->dma[EMU_DMA_COL]->chan[0];
+		struct emu_dma_chan *val = &e->dma[EMU_DMA_VAL]->chan[0];
+		if (row->bytes < (nout + 1) * sizeof(uint32_t) ||
+			col->bytes < nnz * sizeof(uint32_t) ||
+			val->bytes < nnz * sizeof(float))
+			return;
+		uint64_t ready = MAX(MAX(row->last_ns, col->last_ns), val->last_ns);
+		uint64_t done = MAX(ready, e->start_ns + nnz * 1000UL / emu.clk);
+		if (now < done)
+			return;
+		emu_spmv_compute(e);
+		e->computed = 1;
+		e->compute_done_ns = done;
+	}
+	if (out->busy && now >= MAX(out->done_ns, e->compute_done_ns)) {
+		uint64_t total = (uint64_t)nout * sizeof(float);
+		for (; e->drained_seg < out->nseg; e->drained_seg++) {
+			struct emu_seg *seg = &out->segs[e->drained_seg];
+			uint64_t n = MIN((uint64_t)seg->len, total - MIN(e->drained, total));
+			if (emu.functional && e->out != NULL && n > 0)
+				emu_mem_write(seg->addr, (char *)e->out + e->drained, n);
+			e->drained += seg->len;
+		}
+		out->busy = 0;
+	}
+	if (e->drained >= (uint64_t)nout * sizeof(float)) {
+		e->running = 0;
+		free(e->out);
+		e->out = NULL;
+		for (int i = 0; i < 4; i++) {
+			emu_chan_reset_segs(&e->dma[i]->chan[0]);
+			emu_chan_reset_segs(&e->dma[i]->chan[1]);
+		}
+	}
+}
+
+static void emu_advance(uint64_t now)
+{
+	for (int i = 0; i < NUM_SPMV; i++)
+		emu_spmv_advance(&emu.spmv[i], now);
+}
+
+// Queue one transfer behind the ones the channel is still busy with.
+static void emu_dma_queue(struct emu_dma_chan *ch, uint64_t addr, uint32_t len, uint64_t now)
+{
+	if (ch->nseg == ch->capseg) {
+		int cap = ch->capseg ? ch->capseg * 2 : 16;
+		struct emu_seg *segs = realloc(ch->segs, cap * sizeof(*segs));
+		if (segs == NULL)
+			return;
+		ch->segs = segs;
+		ch->capseg = cap;
+	}
+	ch->segs[ch->nseg].addr = addr;
+	ch->segs[ch->nseg].len = len;
+	ch->nseg++;
+	ch->bytes += len;
+	if (!ch->busy) {
+		ch->busy = 1;
+		ch->arm_ns = now;
+		ch->len = 0;
+		ch->done_ns = now;
+	}
+	ch->len += len;
+	ch->done_ns += emu_transfer_ns(len);
+	ch->last_ns = ch->done_ns;
+}
+
+static void emu_dma_start(struct emu_dma *d, int dir, uint64_t now)
+{
+	struct emu_dma_chan *ch = &d->chan[dir];
+	uint32_t base = dir ? S2MM_DMACR : MM2S_DMACR;
+	uint64_t addr = d->regs[(base + 0x18) / 4] | ((uint64_t)d->regs[(base + 0x1c) / 4] << 32);
+	uint32_t len = d->regs[(base + 0x28) / 4];
+
+	if (ch->halted)
+		return;
+	emu_dma_queue(ch, addr, len, now);
+}
+
+// Scatter-gather mode: fetch the descriptors from CURDESC to TAILDESC and
+// queue their buffers back to back.
+static void emu_dma_start_sg(struct emu_dma *d, int dir, uint64_t now)
+{
+	struct emu_dma_chan *ch = &d->chan[dir];
+	uint32_t base = dir ? S2MM_DMACR : MM2S_DMACR;
+	uint64_t cur = d->regs[(base + 0x08) / 4] | ((uint64_t)d->regs[(base + 0x0c) / 4] << 32);
+	uint64_t tail = d->regs[(base + 0x10) / 4] | ((uint64_t)d->regs[(base + 0x14) / 4] << 32);
+	uint32_t desc[8];
+
+	if (ch->halted)
+		return;
+	for (int n = 0; n < 1 << 16; n++) {
+		emu_mem_read(cur, desc, sizeof(desc));
+		emu_dma_queue(ch, desc[2] | ((uint64_t)desc[3] << 32), desc[6] & ((1U << 26) - 1), now);
+		if (cur == tail)
+			break;
+		cur = desc[0] | ((uint64_t)desc[1] << 32);
+	}
+	// the next run starts from the descriptor after the tail
+	d->regs[(base + 0x08) / 4] = desc[0];
+	d->regs[(base + 0x0c) / 4] = desc[1];
+}
+
+static uint32_t emu_dma_status(struct emu_dma *d, int dir, uint64_t now)
+{
+	struct emu_dma_chan *ch = &d->chan[dir];
+	int idle;
+	if (dir == 0) {
+		if (ch->busy && now >= ch->done_ns)
+			ch->busy = 0;
+	}
+	idle = !ch->busy;
+	return (ch->halted ? 0x1 : 0) | (idle ? 0x2 : 0) | (emu.sg ? 0x8 : 0);
+}
+
+static void emu_dma_write(struct emu_dma *d, uint32_t offset, uint32_t data, uint64_t now)
+{
+	int dir = offset >= S2MM_DMACR;
+	uint32_t base = dir ? S2MM_DMACR : MM2S_DMACR;
+	struct emu_dma_chan *ch = &d->chan[dir];
+
+	if (offset / 4 >= EMU_DMA_REGS)
+		return;
+	d->regs[offset / 4] = data;
+	if (offset == base) {
+		if (data & 0x4) {			// soft reset
+			ch->halted = 1;
+			ch->busy = 0;
+			emu_chan_reset_segs(ch);
+			d->regs[offset / 4] &= ~0x4;
+		} else if (data & 0x1) {	// run/stop
+			ch->halted = 0;
+		}
+	} else if (offset == base + 0x28 && !emu.sg) {
+		emu_dma_start(d, dir, now);
+	} else if (offset == base + 0x10 && emu.sg) {
+		emu_dma_start_sg(d, dir, now);
+	}
+}
+
+static uint32_t emu_dma_read(struct emu_dma *d, uint32_t offset, uint64_t now)
+{
+	if (offset / 4 >= EMU_DMA_REGS)
+		return 0;
+	if (offset == MM2S_DMASR)
+		return emu_dma_status(d, 0, now);
+	if (offset == S2MM_DMASR)
+		return emu_dma_status(d, 1, now);
+	return d->regs[offset / 4];
+}
+
+static void emu_spmv_write(struct emu_spmv *e, uint32_t offset, uint32_t data, uint64_t now)
+{
+	if (offset / 4 >= 4)
+		return;
+	if (offset == XSPMV_MULT_AXIS_AXILITES_ADDR_AP_CTRL) {
+		if ((data & 0x1) && !e->running) {
+			e->running = 1;
+			e->computed = 0;
+			e->drained = 0;
+			e->drained_seg = 0;
+			e->start_ns = now;
+		}
+		return;
+	}
+	e->regs[offset / 4] = data;
+}
+
+static uint32_t emu_spmv_read(struct emu_spmv *e, uint32_t offset, uint64_t now)
+{
+	if (offset / 4 >= 4)
+		return 0;
+	if (offset == XSPMV_MULT_AXIS_AXILITES_ADDR_AP_CTRL)
+		return !e->running;
+	return e->regs[offset / 4];
+}
+
+static void emu_fpgamshr_write(uint32_t offset, uint64_t data, uint64_t now)
+{
+	if (offset / 8 >= EMU_FPGAMSHR_REGS)
+		return;
+	if (offset == 0) {
+		if (data & 0x1) {			// clear statistics
+			memset(emu.fpgamshr, 0, sizeof(emu.fpgamshr));
+			emu.cycles_origin_ns = now;
+		}
+		if (data & 0x2)				// snapshot
+			emu.fpgamshr[(NUM_INPUTS + NUM_REQ_HANDLERS) * REGS_PER_REQ_HANDLER] =
+				(now - emu.cycles_origin_ns) * emu.clk / 1000;
+		return;
+	}
+	emu.fpgamshr[offset / 8] = data;
+}
+
+// Find the register window addr falls into. Returns the offset in the window.
+static uint32_t emu_decode(uint64_t addr, struct emu_dma **dma, struct emu_spmv **spmv, int *fpgamshr)
+{
+	*dma = NULL;
+	*spmv = NULL;
+	*fpgamshr = 0;
+	if (addr >= EMU_FPGAMSHR_BASE && addr < EMU_FPGAMSHR_BASE + EMU_FPGAMSHR_REGS * sizeof(uint64_t)) {
+		*fpgamshr = 1;
+		return addr - EMU_FPGAMSHR_BASE;
+	}
+	if (addr >= EMU_SPMV_BASE && addr < EMU_SPMV_BASE + NUM_SPMV * EMU_WINDOW_SIZE) {
+		*spmv = &emu.spmv[(addr - EMU_SPMV_BASE) / EMU_WINDOW_SIZE];
+		return (addr - EMU_SPMV_BASE) % EMU_WINDOW_SIZE;
+	}
+	if (addr >= EMU_DMA_BASE && addr < EMU_DMA_BASE + NUM_SPMV * EMU_DMA_STRIDE) {
+		uint64_t off = addr - EMU_DMA_BASE;
+		*dma = &emu.dma[off / EMU_DMA_STRIDE][(off % EMU_DMA_STRIDE) / EMU_WINDOW_SIZE];
+		return off % EMU_WINDOW_SIZE;
+	}
+	return 0;
+}
+
+static int emu_reg_read(uint64_t addr, void *data, size_t size)
+{
+	struct emu_dma *dma;
+	struct emu_spmv *spmv;
+	int fpgamshr;
+	uint32_t offset = emu_decode(addr, &dma, &spmv, &fpgamshr);
+	uint64_t now = emu_now_ns();
+
+	pthread_mutex_lock(&emu.lock);
+	emu.reg_reads++;
+	emu_advance(now);
+	if (fpgamshr) {
+		size_t n = MIN(size, sizeof(emu.fpgamshr) - offset);
+		memcpy(data, (char *)emu.fpgamshr + offset, n);
+		memset((char *)data + n, 0, size - n);
+	} else {
+		for (size_t i = 0; i < size; i += sizeof(uint32_t)) {
+			uint32_t v = 0;
+			if (dma != NULL)
+				v = emu_dma_read(dma, offset + i, now);
+			else if (spmv != NULL)
+				v = emu_spmv_read(spmv, offset + i, now);
+			memcpy((char *)data + i, &v, MIN(sizeof(v), size - i));
+		}
+	}
+	pthread_mutex_unlock(&emu.lock);
+	return 0;
+}
+
+static int emu_reg_write(uint64_t addr, void *data, size_t size)
+{
+	struct emu_dma *dma;
+	struct emu_spmv *spmv;
+	int fpgamshr;
+	uint32_t offset = emu_decode(addr, &dma, &spmv, &fpgamshr);
+	uint64_t now = emu_now_ns();
+
+	pthread_mutex_lock(&emu.lock);
+	emu.reg_writes++;
+	emu_advance(now);
+	if (fpgamshr) {
+		for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+			emu_fpgamshr_write(offset + i, *(uint64_t *)((char *)data + i), now);
+	} else {
+		for (size_t i = 0; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+			uint32_t v = *(uint32_t *)((char *)data + i);
+			if (dma != NULL)
+				emu_dma_write(dma, offset + i, v, now);
+			else if (spmv != NULL)
+				emu_spmv_write(spmv, offset + i, v, now);
+		}
+	}
+	emu_advance(now);
+	pthread_mutex_unlock(&emu.lock);
+	return 0;
+}
+
+static int emu_read(uint64_t addr, void *data, size_t size)
+{
+	__atomic_add_fetch(&emu.submissions, 1, __ATOMIC_RELAXED);
+	if (addr >= EMU_REG_BASE && addr < EMU_REG_END)
+		return emu_reg_read(addr, data, size);
+	__atomic_add_fetch(&emu.mem_reads, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&emu.mem_read_bytes, size, __ATOMIC_RELAXED);
+	return emu_mem_read(addr, data, size);
+}
+
+static int emu_write(uint64_t addr, void *data, size_t size)
+{
+	__atomic_add_fetch(&emu.submissions, 1, __ATOMIC_RELAXED);
+	if (addr >= EMU_REG_BASE && addr < EMU_REG_END)
+		return emu_reg_write(addr, data, size);
+	__atomic_add_fetch(&emu.mem_writes, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&emu.mem_write_bytes, size, __ATOMIC_RELAXED);
+	return emu_mem_write(addr, data, size);
+}
+
+static int emu_readv(const struct qdma_iov *iov, int n)
+{
+	int ret = 0;
+	__atomic_add_fetch(&emu.submissions, 1, __ATOMIC_RELAXED);
+	for (int i = 0; i < n; i++) {
+		int res;
+		if (iov[i].addr >= EMU_REG_BASE && iov[i].addr < EMU_REG_END)
+			res = emu_reg_read(iov[i].addr, iov[i].data, iov[i].size);
+		else
+			res = emu_mem_read(iov[i].addr, iov[i].data, iov[i].size);
+		if (res < 0)
+			ret = -1;
+	}
+	return ret;
+}
+
+// Earliest modeled completion after "after", or UINT64_MAX if none is pending.
+static uint64_t emu_next_event_ns(uint64_t after)
+{
+	uint64_t next = UINT64_MAX;
+	for (int i = 0; i < NUM_SPMV; i++) {
+		struct emu_spmv *e = &emu.spmv[i];
+		for (int j = 0; j < 4; j++) {
+			struct emu_dma_chan *ch = &emu.dma[i][j].chan[0];
+			if (ch->busy && ch->done_ns > after)
+				next = MIN(next, ch->done_ns);
+		}
+		if (!e->running)
+			continue;
+		struct emu_dma_chan *out = &e->dma[EMU_DMA_OUT]->chan[1];
+		uint64_t done = 0;
+		if (!e->computed) {
+			struct emu_dma_chan *row = &e->dma[EMU_DMA_ROW]->chan[0];
+			struct emu_dma_chan *col = &e->dma[EMU_DMA_COL]->chan[0];
+			struct emu_dma_chan *val = &e->dma[EMU_DMA_VAL]->chan[0];
+			if (row->bytes >= (e->regs[2] + 1) * sizeof(uint32_t) &&
+				col->bytes >= e->regs[1] * sizeof(uint32_t) &&
+				val->bytes >= e->regs[1] * sizeof(float))
+				done = MAX(MAX(MAX(row->last_ns, col->last_ns), val->last_ns),
+							e->start_ns + e->regs[1] * 1000UL / emu.clk);
+		} else if (out->busy) {
+			done = MAX(out->done_ns, e->compute_done_ns);
+		}
+		if (done > after)
+			next = MIN(next, done);
+	}
+	return next;
+}
+
+// A timerfd armed for the next modeled completion. Completions up to the
+// previous arming have been seen by the check that preceded this call.
+static int emu_event_fd(void)
+{
+	uint64_t now = emu_now_ns();
+	struct itimerspec its;
+
+	if (emu.timerfd < 0) {
+		emu.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (emu.timerfd < 0)
+			return -1;
+	}
+	pthread_mutex_lock(&emu.lock);
+	emu_advance(now);
+	uint64_t next = emu_next_event_ns(emu.event_armed_ns);
+	emu.event_armed_ns = now;
+	pthread_mutex_unlock(&emu.lock);
+
+	memset(&its, 0, sizeof(its));
+	if (next != UINT64_MAX) {
+		next = MAX(next, 1);
+		its.it_value.tv_sec = next / 1000000000UL;
+		its.it_value.tv_nsec = next % 1000000000UL;
+	}
+	timerfd_settime(emu.timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+	return emu.timerfd;
+}
+
+static void emu_close(void)
+{
+	printf("emu: %lu submissions, %lu register reads, %lu register writes, "
+			"%lu writes (%.1f MB) to device memory, %lu reads (%.1f MB) from device memory\n",
+			emu.submissions, emu.reg_reads, emu.reg_writes,
+			emu.mem_writes, emu.mem_write_bytes / 1048576.0,
+			emu.mem_reads, emu.mem_read_bytes / 1048576.0);
+	if (emu.timerfd >= 0)
+		close(emu.timerfd);
+	emu.timerfd = -1;
+	for (uint64_t i = 0; i < EMU_NUM_PAGES; i++) {
+		free(emu.pages[i]);
+		emu.pages[i] = NULL;
+	}
+	for (int i = 0; i < NUM_SPMV; i++) {
+		free(emu.spmv[i].out);
+		emu.spmv[i].out = NULL;
+		for (int j = 0; j < 4; j++) {
+			free(emu.dma[i][j].chan[0].segs);
+			free(emu.dma[i][j].chan[1].segs);
+		}
+	}
+}
+
+struct qdma_transport qdma_emu_ops = {
+	.name = "emu",
+	.read = emu_read,
+	.write = emu_write,
+	.readv = emu_readv,
+	.event_fd = emu_event_fd,
+	.close = emu_close,
+};
+
+int qdma_emu_open(const char *spec)
+{
+	char opts[256];
+	char *save = NULL;
+
+	emu.functional = 0;
+	emu.sg = 0;
+	emu.bw = 1000;
+	emu.clk = 250;
+	snprintf(opts, sizeof(opts), "%s", spec[3] == ':' ? spec + 4 : "");
+	for (char *opt = strtok_r(opts, ",", &save); opt != NULL; opt = strtok_r(NULL, ",", &save)) {
+		if (strcmp(opt, "func") == 0) {
+			emu.functional = 1;
+		} else if (strcmp(opt, "sg") == 0) {
+			emu.sg = 1;
+		} else if (strncmp(opt, "bw=", 3) == 0) {
+			emu.bw = strtoul(opt + 3, NULL, 0);
+		} else if (strncmp(opt, "clk=", 4) == 0) {
+			emu.clk = strtoul(opt + 4, NULL, 0);
+		} else {
+			fprintf(stderr, "unknown emu option %s\n", opt);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (emu.bw == 0 || emu.clk == 0) {
+		fprintf(stderr, "emu bandwidth and clock must be positive\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(emu.dma, 0, sizeof(emu.dma));
+	memset(emu.spmv, 0, sizeof(emu.spmv));
+	for (int i = 0; i < NUM_SPMV; i++) {
+		for (int j = 0; j < 4; j++) {
+			emu.dma[i][j].chan[0].halted = 1;
+			emu.dma[i][j].chan[1].halted = 1;
+			emu.spmv[i].dma[j] = &emu.dma[i][j];
+		}
+	}
+	emu.cycles_origin_ns = emu_now_ns();
+	qdma_ops = &qdma_emu_ops;
+	printf("emu: %s SpMV, %lu MB/s per DMA engine, %lu MHz\n",
+			emu.functional ? "functional" : "timing-only", emu.bw, emu.clk);
+	return 0;
+}
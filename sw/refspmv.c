@@ -0,0 +1,299 @@
+/*
+ * Host reference SpMV.
+ *
+ * Computes the expected output of every accelerator from the CSR partitions
+ * and the vector that load_data() uploaded, instead of reading it from the
+ * .exp files of util/mm_matrix_to_csr.py. The files are mapped, so the
+ * reference reads them from the page cache without another copy.
+ *
+ * ref_start() runs the computation on a thread of its own while the
+ * accelerators run, ref_wait() collects it. Rows are split into blocks of
+ * REF_ROW_BLOCK that OpenMP threads pick up dynamically. When the vector does
+ * not fit in the cache, each row block walks the columns in REF_COL_BLOCK
+ * slices, so that the part of the vector in use stays cached (this needs the
+ * column indices of a row to be sorted, which ref_prepare() checks). Sums are
+ * accumulated in double.
+ *
+ * The result is kept until ref_invalidate() is called, e.g. when the vector
+ * on the device was rewritten. ref_set_vector() computes with another vector
+ * than the one of the files, e.g. an iterate of the iterative mode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "def.h"
+
+#define REF_ROW_BLOCK	1024
+#define REF_COL_BLOCK	(MB(1) / sizeof(float))
+
+struct ref_map {
+	void *addr;
+	size_t size;
+};
+
+struct ref_csr {
+	struct ref_map row, col, val;
+	uint32_t nrows;
+	uint32_t nnz;
+	int sorted;		// column indices ascending within every row
+};
+
+static struct {
+	struct ref_csr csr[NUM_SPMV];
+	struct ref_map vec;
+	float *x;		// vector of ref_set_vector(), NULL: the one of vec
+	int nspmv;
+	uint32_t ncols;
+	int prepared;
+	int valid;		// out holds the result for the current vector
+	float **out;
+	pthread_t tid;
+	int running;
+	int failed;
+} ref;
+
+static int ref_map_file(const char *path, size_t elem_sz, struct ref_map *m)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "unable to open %s\n", path);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size % elem_sz) {
+		fprintf(stderr, "bad reference input %s\n", path);
+		close(fd);
+		return -1;
+	}
+	m->size = st.st_size;
+	m->addr = NULL;
+	if (m->size > 0) {
+		m->addr = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (m->addr == MAP_FAILED) {
+			perror("mmap reference input");
+			m->addr = NULL;
+			close(fd);
+			return -1;
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+static void ref_unmap_file(struct ref_map *m)
+{
+	if (m->addr != NULL)
+		munmap(m->addr, m->size);
+	m->addr = NULL;
+	m->size = 0;
+}
+
+void ref_close(void)
+{
+	if (ref.running) {
+		pthread_join(ref.tid, NULL);
+		ref.running = 0;
+	}
+	for (int i = 0; i < ref.nspmv; i++) {
+		ref_unmap_file(&ref.csr[i].row);
+		ref_unmap_file(&ref.csr[i].col);
+		ref_unmap_file(&ref.csr[i].val);
+	}
+	ref_unmap_file(&ref.vec);
+	free(ref.x);
+	ref.x = NULL;
+	ref.nspmv = 0;
+	ref.valid = 0;
+}
+
+// Map the partitions of folder, named like load_data() does, and compute into out[].
+int ref_open(const char *folder, const char *bench_name, int nspmv, float **out)
+{
+	char path[256];
+	ref_close();
+	snprintf(path, sizeof(path), "%s/%d/%s.vec", folder, nspmv, bench_name);
+	if (ref_map_file(path, sizeof(float), &ref.vec) < 0)
+		return -1;
+	ref.ncols = ref.vec.size / sizeof(float);
+	for (int i = 0; i < nspmv; i++) {
+		struct ref_csr *m = &ref.csr[i];
+		ref.nspmv = i + 1;
+		snprintf(path, sizeof(path), "%s/%d/%d.row", folder, nspmv, i);
+		if (ref_map_file(path, sizeof(uint32_t), &m->row) < 0)
+			goto fail;
+		snprintf(path, sizeof(path), "%s/%d/%d.col", folder, nspmv, i);
+		if (ref_map_file(path, sizeof(uint32_t), &m->col) < 0)
+			goto fail;
+		snprintf(path, sizeof(path), "%s/%d/%d.val", folder, nspmv, i);
+		if (ref_map_file(path, sizeof(float), &m->val) < 0)
+			goto fail;
+		m->nrows = m->row.size / sizeof(uint32_t) - 1;
+		m->nnz = m->val.size / sizeof(float);
+	}
+	ref.out = out;
+	ref.prepared = 0;
+	return 0;
+fail:
+	ref_close();
+	return -1;
+}
+
+// The vector changed, the next ref_start() recomputes.
+void ref_invalidate(void)
+{
+	ref.valid = 0;
+}
+
+// Compute with a copy of x, ncols long, instead of the vector of the files;
+// NULL goes back to that one. The next ref_start() recomputes.
+int ref_set_vector(const float *x)
+{
+	if (ref.running) {
+		pthread_join(ref.tid, NULL);
+		ref.running = 0;
+	}
+	ref.valid = 0;
+	if (x == NULL) {
+		free(ref.x);
+		ref.x = NULL;
+		return 0;
+	}
+	if (ref.x == NULL)
+		ref.x = malloc(MAX(ref.ncols, 1) * sizeof(float));
+	if (ref.x == NULL) {
+		perror("reference vector");
+		return -1;
+	}
+	memcpy(ref.x, x, ref.ncols * sizeof(float));
+	return 0;
+}
+
+// Check the partitions once before the first computation: the row pointers
+// must cover the column indices, which must be within the vector.
+static int ref_prepare(void)
+{
+	int failed = 0;
+	for (int i = 0; i < ref.nspmv; i++) {
+		struct ref_csr *m = &ref.csr[i];
+		const uint32_t *rowptr = m->row.addr, *col = m->col.addr;
+		if (m->row.size < sizeof(uint32_t) || m->col.size != m->val.size ||
+			rowptr[m->nrows] - rowptr[0] != m->nnz) {
+			fprintf(stderr, "spmv %d: row pointers do not match %u non-zeros\n", i, m->nnz);
+			return -1;
+		}
+		int unsorted = 0;
+		uint32_t max_col = 0;
+		#pragma omp parallel for schedule(static) reduction(|:unsorted) reduction(max:max_col)
+		for (uint32_t r = 0; r < m->nrows; r++) {
+			for (uint32_t k = rowptr[r] - rowptr[0]; k < rowptr[r + 1] - rowptr[0]; k++) {
+				max_col = MAX(max_col, col[k]);
+				unsorted |= k > rowptr[r] - rowptr[0] && col[k] < col[k - 1];
+			}
+		}
+		if (m->nnz > 0 && max_col >= ref.ncols) {
+			fprintf(stderr, "spmv %d: column %u out of a vector of %u\n", i, max_col, ref.ncols);
+			failed = 1;
+		}
+		m->sorted = !unsorted;
+	}
+	return failed ? -1 : 0;
+}
+
+// y[r0..r1) of partition m.
+static void ref_rows(const struct ref_csr *m, const float *x, uint32_t r0, uint32_t r1, float *y)
+{
+	const uint32_t *rowptr = m->row.addr, *col = m->col.addr;
+	const float *val = m->val.addr;
+	uint32_t const base = rowptr[0];
+
+	if (!m->sorted || ref.ncols <= REF_COL_BLOCK) {
+		for (uint32_t r = r0; r < r1; r++) {
+			double sum = 0;
+			for (uint32_t k = rowptr[r] - base; k < rowptr[r + 1] - base; k++)
+				sum += (double)val[k] * x[col[k]];
+			y[r] = sum;
+		}
+		return;
+	}
+
+	double sum[REF_ROW_BLOCK];
+	uint32_t pos[REF_ROW_BLOCK];
+	for (uint32_t r = r0; r < r1; r++) {
+		sum[r - r0] = 0;
+		pos[r - r0] = rowptr[r] - base;
+	}
+	for (uint64_t c1 = REF_COL_BLOCK; c1 < ref.ncols + REF_COL_BLOCK; c1 += REF_COL_BLOCK) {
+		for (uint32_t r = r0; r < r1; r++) {
+			uint32_t k = pos[r - r0], end = rowptr[r + 1] - base;
+			double s = sum[r - r0];
+			for (; k < end && col[k] < c1; k++)
+				s += (double)val[k] * x[col[k]];
+			sum[r - r0] = s;
+			pos[r - r0] = k;
+		}
+	}
+	for (uint32_t r = r0; r < r1; r++)
+		y[r] = sum[r - r0];
+}
+
+static void *ref_main(void *arg)
+{
+	(void)arg;
+	if (!ref.prepared) {
+		if (ref_prepare() < 0) {
+			ref.failed = 1;
+			return NULL;
+		}
+		ref.prepared = 1;
+	}
+	// row blocks of all partitions in one pool
+	uint64_t nblocks = 0, first[NUM_SPMV + 1];
+	for (int i = 0; i < ref.nspmv; i++) {
+		first[i] = nblocks;
+		nblocks += (ref.csr[i].nrows + REF_ROW_BLOCK - 1) / REF_ROW_BLOCK;
+	}
+	first[ref.nspmv] = nblocks;
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (uint64_t b = 0; b < nblocks; b++) {
+		int i = 0;
+		while (b >= first[i + 1])
+			i++;
+		uint32_t r0 = (b - first[i]) * REF_ROW_BLOCK;
+		ref_rows(&ref.csr[i], ref.x ? ref.x : ref.vec.addr, r0, MIN(r0 + REF_ROW_BLOCK, ref.csr[i].nrows), ref.out[i]);
+	}
+	return NULL;
+}
+
+// Start computing the reference, unless it is still valid.
+int ref_start(void)
+{
+	if (ref.valid || ref.running)
+		return 0;
+	ref.failed = 0;
+	if (pthread_create(&ref.tid, NULL, ref_main, NULL) != 0) {
+		perror("reference thread");
+		return -1;
+	}
+	ref.running = 1;
+	return 0;
+}
+
+// Wait for the reference. Returns -1 if it could not be computed.
+int ref_wait(void)
+{
+	if (ref_start() < 0)
+		return -1;
+	if (ref.running) {
+		pthread_join(ref.tid, NULL);
+		ref.running = 0;
+		ref.valid = !ref.failed;
+	}
+	return ref.valid ? 0 : -1;
+}
@@ -0,0 +1,362 @@
+/*
+ * Resident-matrix cache.
+ *
+ * The DDR window is handed out by a buddy allocator instead of fixed slots.
+ * Every file loaded into device memory is recorded with its identity (device,
+ * inode, size, mtime), a hash of its content and the layout it was written in
+ * (e.g. the HBM channel count a .col file was remapped for). A later load of
+ * the same file finds it resident and skips the upload: by identity without
+ * touching the file, or, for a file that was copied or touched, by hashing it
+ * and comparing the content. Entries that are not used by the current load
+ * are evicted least recently used first when memory runs out, or when there
+ * are more than RESIDENT_MAX records; a load that uses more files than that
+ * (the column tiles of a large matrix) grows the table instead.
+ *
+ * With resident_manifest set, the records are persisted so that repeated runs
+ * on the same board skip the upload as well. A random canary is kept in
+ * device memory next to them; when it does not match on start-up, the board
+ * lost its memory (power cycle, the stand-in device of qdma_emu.c) and the
+ * records are dropped. Anything else writing to the DDR window behind our
+ * back is not detected, delete the manifest (or run with -c off) then.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "def.h"
+#include "buddy.c"
+
+#define RESIDENT_MAX		256				// records kept, unless all are in use
+#define RESIDENT_ANY		UINT64_MAX		// resident_find(): placed by the allocator
+
+#define DEVMEM_BASE			DDR_BASE_ADDR
+#define DEVMEM_SIZE			GB(8)
+// Top block of the window: canary and the scatter-gather descriptor rings.
+#define DEVMEM_SYS_SIZE		MB(1)
+#define DEVMEM_SYS_BASE		(DEVMEM_BASE + DEVMEM_SIZE - DEVMEM_SYS_SIZE)
+#define RESIDENT_CANARY_ADDR	DEVMEM_SYS_BASE
+
+// What identifies the content of a file in device memory.
+struct resident_key {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_ns;
+	uint64_t hash;			// 0 until computed, see load_hash_block()
+	uint32_t layout;
+	char path[256];
+};
+
+struct resident {
+	struct resident_key key;
+	uint64_t addr;
+	uint64_t span;			// device memory covered, 0 for allocator placement
+	uint64_t last_use;
+	uint32_t pinned;		// slots whose last load_data() uses it, see resident_begin()
+};
+
+static struct resident *resident;
+static int nresident, resident_cap;
+static uint64_t resident_gen;
+static uint32_t resident_pin;		// slot of the current load_data()
+static uint64_t resident_canary;
+
+struct buddy devmem;
+int resident_enabled = 1;
+char resident_manifest[256];		// empty: records live as long as the process
+uint64_t resident_hit_bytes;		// skipped uploads since resident_begin()
+
+static int64_t resident_mtime_ns(const struct stat *st)
+{
+	return st->st_mtim.tv_sec * 1000000000L + st->st_mtim.tv_nsec;
+}
+
+static int resident_same_file(const struct resident_key *a, const struct resident_key *b)
+{
+	return a->dev == b->dev && a->ino == b->ino && a->size == b->size && a->mtime_ns == b->mtime_ns;
+}
+
+static uint64_t resident_span(const struct resident *r)
+{
+	return r->span ? r->span : r->key.size;
+}
+
+static void resident_remove(int i)
+{
+	if (resident[i].span == 0)
+		buddy_free(&devmem, resident[i].addr);
+	resident[i] = resident[--nresident];
+}
+
+// Forget whatever overlaps [addr, addr + size), it is about to be overwritten.
+void resident_drop_range(uint64_t addr, uint64_t size)
+{
+	for (int i = nresident - 1; i >= 0; i--) {
+		struct resident *r = &resident[i];
+		if (r->addr < addr + size && addr < r->addr + resident_span(r))
+			resident_remove(i);
+	}
+}
+
+// Device memory for size bytes, evicting unused entries as needed. Returns 0
+// when it does not fit.
+uint64_t devmem_alloc(uint64_t size)
+{
+	for (;;) {
+		uint64_t addr = buddy_alloc(&devmem, MAX(size, 1));
+		if (addr != 0)
+			return addr;
+		int lru = -1;
+		for (int i = 0; i < nresident; i++) {
+			struct resident *r = &resident[i];
+			if (!r->pinned && r->span == 0 &&
+				(lru < 0 || r->last_use < resident[lru].last_use))
+				lru = i;
+		}
+		if (lru < 0) {
+			fprintf(stderr, "out of device memory for %lu bytes\n", size);
+			return 0;
+		}
+		resident_remove(lru);
+	}
+}
+
+void devmem_free(uint64_t addr)
+{
+	if (addr != 0)
+		buddy_free(&devmem, addr);
+}
+
+// Content hash of a whole file, the same as the loaders compute chunk by chunk.
+static int resident_hash_file(const char *path, uint64_t size, uint64_t *phash)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	uint64_t hash = 0;
+	if (size > 0) {
+		char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise(map, size, MADV_SEQUENTIAL);
+		#pragma omp parallel for reduction(^:hash) schedule(static)
+		for (uint64_t off = 0; off < size; off += LOADER_CHUNK_SIZE)
+			hash ^= load_hash_block(map + off, MIN(size - off, LOADER_CHUNK_SIZE), off);
+		munmap(map, size);
+	}
+	close(fd);
+	*phash = hash;
+	return 0;
+}
+
+// Look path up, as written in layout, at device address addr or anywhere in
+// the allocator with RESIDENT_ANY. Fills *k for resident_add(). Returns 1 and
+// pins the entry if it is resident, 0 if not, -1 if the file cannot be stat'ed.
+int resident_find(const char *path, uint32_t layout, uint64_t addr, struct resident_key *k, uint64_t *paddr)
+{
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		fprintf(stderr, "fail to stat %s\n", path);
+		return -1;
+	}
+	memset(k, 0, sizeof(*k));
+	k->dev = st.st_dev;
+	k->ino = st.st_ino;
+	k->size = st.st_size;
+	k->mtime_ns = resident_mtime_ns(&st);
+	k->layout = layout;
+	snprintf(k->path, sizeof(k->path), "%s", path);
+	if (!resident_enabled)
+		return 0;
+
+	int found = -1, same_size = 0;
+	for (int i = 0; i < nresident && found < 0; i++) {
+		struct resident *r = &resident[i];
+		if (r->key.layout != layout || r->key.size != k->size ||
+			(addr == RESIDENT_ANY ? r->span != 0 : r->addr != addr))
+			continue;
+		if (resident_same_file(&r->key, k))
+			found = i;
+		same_size = 1;
+	}
+	if (found < 0 && same_size && resident_hash_file(path, k->size, &k->hash) == 0) {
+		for (int i = 0; i < nresident && found < 0; i++) {
+			struct resident *r = &resident[i];
+			if (r->key.layout == layout && r->key.size == k->size && r->key.hash == k->hash &&
+				(addr == RESIDENT_ANY ? r->span == 0 : r->addr == addr)) {
+				found = i;
+				r->key = *k;	// same content under a new identity
+			}
+		}
+		k->hash = 0;	// recomputed by the loader if it is not resident
+	}
+	if (found < 0)
+		return 0;
+	resident[found].pinned |= resident_pin;
+	resident[found].last_use = resident_gen;
+	resident_hit_bytes += k->size;
+	*paddr = resident[found].addr;
+	return 1;
+}
+
+// Room for one more record. Returns -1 on failure.
+static int resident_grow(void)
+{
+	if (nresident < resident_cap)
+		return 0;
+	int cap = resident_cap ? resident_cap * 2 : RESIDENT_MAX;
+	struct resident *r = realloc(resident, cap * sizeof(*r));
+	if (r == NULL) {
+		perror("resident records");
+		return -1;
+	}
+	resident = r;
+	resident_cap = cap;
+	return 0;
+}
+
+// Record a file that was loaded to addr. span is the device memory it covers
+// outside the allocator, 0 if addr came from devmem_alloc().
+void resident_add(const struct resident_key *k, uint64_t addr, uint64_t span)
+{
+	if (nresident >= RESIDENT_MAX) {
+		// make room by forgetting the least recently used entry
+		int lru = -1;
+		for (int i = 0; i < nresident; i++)
+			if (!resident[i].pinned && (lru < 0 || resident[i].last_use < resident[lru].last_use))
+				lru = i;
+		if (lru >= 0)
+			resident_remove(lru);
+	}
+	if (resident_grow() < 0) {
+		// still in use, so not freed: lost until the process exits
+		fprintf(stderr, "no room to record %s\n", k->path);
+		return;
+	}
+	resident[nresident++] = (struct resident){ *k, addr, span, resident_gen, resident_pin };
+}
+
+// Start a load_data() into slot (0 or 1, see batch mode in main.c): nothing
+// is in use by the slot until found or added again. What the other slot
+// uses stays pinned, it may be computing while this one loads.
+void resident_begin(int slot)
+{
+	resident_gen++;
+	resident_hit_bytes = 0;
+	resident_pin = 1 << slot;
+	for (int i = 0; i < nresident; i++)
+		resident[i].pinned &= ~resident_pin;
+}
+
+static int resident_read_canary(uint64_t *canary)
+{
+	return qdma_read(RESIDENT_CANARY_ADDR, canary, sizeof(*canary));
+}
+
+static int resident_load(void)
+{
+	FILE *f = fopen(resident_manifest, "r");
+	if (f == NULL)
+		return errno == ENOENT ? 0 : -1;
+
+	char line[512];
+	uint64_t canary = 0, dev_canary = 0;
+	if (fgets(line, sizeof(line), f) == NULL || sscanf(line, "spmvtest-resident 1 %lx", &canary) != 1) {
+		fprintf(stderr, "%s: not a resident manifest, ignored\n", resident_manifest);
+		fclose(f);
+		return 0;
+	}
+	if (resident_read_canary(&dev_canary) < 0 || dev_canary != canary) {
+		printf("device memory changed since %s was written, nothing is resident\n", resident_manifest);
+		fclose(f);
+		return 0;
+	}
+	resident_canary = canary;
+	while (fgets(line, sizeof(line), f) != NULL && nresident < RESIDENT_MAX) {
+		struct resident r = { 0 };
+		int n = 0;
+		line[strcspn(line, "\n")] = '\0';
+		if (sscanf(line, "%lx %lx %lx %u %lu %lu %ld %lx %lu %n", &r.addr, &r.span, &r.key.size,
+					&r.key.layout, &r.key.dev, &r.key.ino, &r.key.mtime_ns, &r.key.hash,
+					&r.last_use, &n) != 9 || n == 0)
+			continue;
+		snprintf(r.key.path, sizeof(r.key.path), "%s", line + n);
+		if (r.span == 0 && buddy_alloc_at(&devmem, r.addr, MAX(r.key.size, 1)) < 0) {
+			fprintf(stderr, "%s: overlapping entry for %s dropped\n", resident_manifest, r.key.path);
+			continue;
+		}
+		resident_gen = MAX(resident_gen, r.last_use);
+		if (resident_grow() < 0)
+			break;
+		resident[nresident++] = r;
+	}
+	fclose(f);
+	return 0;
+}
+
+// Persist the records if there is a manifest. Written to a temporary file and
+// renamed, so that a crash leaves the previous manifest intact.
+int resident_save(void)
+{
+	char tmp[sizeof(resident_manifest) + 8];
+	if (!resident_enabled || resident_manifest[0] == '\0')
+		return 0;
+	if (resident_canary == 0) {
+		resident_canary = load_hash_mix(timing_now() ^ ((uint64_t)getpid() << 32)) | 1;
+		if (qdma_write(RESIDENT_CANARY_ADDR, &resident_canary, sizeof(resident_canary)) < 0) {
+			perror("write resident canary");
+			resident_canary = 0;
+			return -1;
+		}
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", resident_manifest);
+	FILE *f = fopen(tmp, "w");
+	if (f == NULL) {
+		perror(tmp);
+		return -1;
+	}
+	fprintf(f, "spmvtest-resident 1 %lx\n", resident_canary);
+	for (int i = 0; i < nresident; i++) {
+		struct resident *r = &resident[i];
+		// entries whose hash is unknown cannot be matched by content, but by identity
+		fprintf(f, "%lx %lx %lx %u %lu %lu %ld %lx %lu %s\n", r->addr, r->span, r->key.size,
+				r->key.layout, r->key.dev, r->key.ino, r->key.mtime_ns, r->key.hash,
+				r->last_use, r->key.path);
+	}
+	if (fclose(f) != 0 || rename(tmp, resident_manifest) < 0) {
+		perror(resident_manifest);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+// Set up the allocator over the DDR window and restore the records of the
+// manifest. Call after qdma_open().
+int resident_init(void)
+{
+	if (buddy_init(&devmem, DEVMEM_BASE, DEVMEM_SIZE) < 0 ||
+		buddy_alloc_at(&devmem, DEVMEM_SYS_BASE, DEVMEM_SYS_SIZE) < 0) {
+		fprintf(stderr, "fail to set up the device memory allocator\n");
+		return -1;
+	}
+	if (resident_enabled && resident_manifest[0] != '\0' && resident_load() < 0) {
+		perror(resident_manifest);
+		return -1;
+	}
+	return 0;
+}
+
+void resident_report(void)
+{
+	if (resident_hit_bytes > 0)
+		printf("Resident: %.1f MB already on the device, not loaded\n", resident_hit_bytes / 1048576.0);
+}
@@ -0,0 +1,229 @@
+/*
+ * Fixed-rate sampler of the MiCache runtime counters.
+ *
+ * While the accelerators run, a thread takes a runtime sample
+ * (FPGAMSHR_Read_runtime()) every sampler_period_us of wall-clock time, so
+ * the samples form a time series no matter how fast the wait loops spin.
+ * Ticks that pass while a read is still in flight are skipped and counted as
+ * late. Each sample is stored as the difference to the previous one, zigzag
+ * varint encoded (most counters move little between samples), in a buffer of
+ * sampler_buf_size bytes. When the buffer is full, sampling stops and the
+ * samples not taken are counted, both are reported with the log.
+ *
+ * sampler_write() decodes the samples into runtime_BENCH_MMDDhhmmss.csv, one
+ * row per sample with its time since sampler_start().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "def.h"
+
+#define SAMPLER_WORDS		(sizeof(struct fpgamshr_runtime) / sizeof(uint64_t))
+// Longest encoding of a sample: the time and every counter as 10-byte varints.
+#define SAMPLER_MAX_REC		((SAMPLER_WORDS + 1) * 10)
+
+uint32_t sampler_period_us;			// 0: no sampling
+uint64_t sampler_buf_size = MB(64);
+
+static struct {
+	uint8_t *buf;
+	uint64_t used;
+	struct fpgamshr_runtime prev;
+	uint64_t start_ns;
+	uint64_t prev_ns;
+	uint64_t samples;
+	uint64_t late;
+	uint64_t missed;			// not taken, the buffer was full
+	int running;
+	int stop;
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} sampler = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint8_t *sampler_put(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static const uint8_t *sampler_get(const uint8_t *p, uint64_t *v)
+{
+	uint64_t x = 0;
+	for (int shift = 0; ; shift += 7) {
+		x |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			break;
+	}
+	*v = x;
+	return p;
+}
+
+// Take one sample and append it to the buffer.
+static int sampler_take(void)
+{
+	struct fpgamshr_runtime cur;
+	if (sampler.used + SAMPLER_MAX_REC > sampler_buf_size) {
+		sampler.missed++;
+		return 0;
+	}
+	uint64_t now = timing_now();
+	if (FPGAMSHR_Read_runtime(&cur) < 0)
+		return -1;
+	const uint64_t *c = (const uint64_t *)&cur, *p = (const uint64_t *)&sampler.prev;
+	uint8_t *out = sampler_put(sampler.buf + sampler.used, now - sampler.prev_ns);
+	for (int i = 0; i < SAMPLER_WORDS; i++) {
+		int64_t d = c[i] - p[i];
+		out = sampler_put(out, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+	}
+	sampler.used = out - sampler.buf;
+	sampler.prev = cur;
+	sampler.prev_ns = now;
+	sampler.samples++;
+	return 0;
+}
+
+static void *sampler_main(void *arg)
+{
+	(void)arg;
+	uint64_t const period = sampler_period_us * 1000UL;
+	uint64_t next = sampler.start_ns;
+	pthread_mutex_lock(&sampler.lock);
+	while (!sampler.stop) {
+		pthread_mutex_unlock(&sampler.lock);
+		if (sampler_take() < 0) {
+			pthread_mutex_lock(&sampler.lock);
+			break;
+		}
+		next += period;
+		uint64_t now = timing_now();
+		if (now >= next) {
+			uint64_t skipped = (now - next) / period + 1;
+			sampler.late += skipped;
+			next += skipped * period;
+		}
+		// a condition variable cannot wait on timing_now()'s clock, so the
+		// deadline is moved over to CLOCK_MONOTONIC
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		uint64_t until = ts.tv_sec * 1000000000UL + ts.tv_nsec + (next - now);
+		ts = (struct timespec){ until / 1000000000UL, until % 1000000000UL };
+		pthread_mutex_lock(&sampler.lock);
+		while (!sampler.stop && pthread_cond_timedwait(&sampler.cond, &sampler.lock, &ts) == 0)
+			;
+	}
+	pthread_mutex_unlock(&sampler.lock);
+	return NULL;
+}
+
+// Stop sampling. A last sample is taken, so the series ends with the run.
+void sampler_stop(void)
+{
+	if (!sampler.running)
+		return;
+	pthread_mutex_lock(&sampler.lock);
+	sampler.stop = 1;
+	pthread_cond_signal(&sampler.cond);
+	pthread_mutex_unlock(&sampler.lock);
+	pthread_join(sampler.tid, NULL);
+	sampler.running = 0;
+	sampler_take();
+}
+
+// Start sampling a new run, dropping the samples of the previous one.
+int sampler_start(void)
+{
+	if (sampler_period_us == 0)
+		return 0;
+	sampler_stop();
+	if (sampler.buf == NULL) {
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&sampler.cond, &attr);
+		pthread_condattr_destroy(&attr);
+		sampler.buf = malloc(sampler_buf_size);
+		if (sampler.buf == NULL) {
+			perror("sampler buffer");
+			return -1;
+		}
+	}
+	sampler.used = 0;
+	sampler.samples = sampler.late = sampler.missed = 0;
+	memset(&sampler.prev, 0, sizeof(sampler.prev));
+	sampler.start_ns = sampler.prev_ns = timing_now();
+	sampler.stop = 0;
+	if (pthread_create(&sampler.tid, NULL, sampler_main, NULL) != 0) {
+		perror("sampler thread");
+		return -1;
+	}
+	sampler.running = 1;
+	return 0;
+}
+
+// Decode the samples of the last run into the runtime log of benchname.
+void sampler_write(const char *benchname)
+{
+	if (sampler_period_us == 0 || sampler.buf == NULL)
+		return;
+	sampler_stop();
+	time_t now;
+	time(&now);
+	struct tm *t = localtime(&now);
+	char filename[256];
+	snprintf(filename, sizeof(filename), "runtime_%s_%02d%02d%02d%02d%02d.csv", benchname, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+	FILE *flog = fopen(filename, "w");
+	if (flog == NULL) {
+		perror(filename);
+		return;
+	}
+
+	fprintf(flog, "time us,");
+	FPGAMSHR_Write_runtime_header(flog);
+	struct fpgamshr_runtime cur;
+	uint64_t *c = (uint64_t *)&cur;
+	uint64_t time_ns = sampler.start_ns, v;
+	const uint8_t *p = sampler.buf, *end = sampler.buf + sampler.used;
+	memset(&cur, 0, sizeof(cur));
+	while (p < end) {
+		p = sampler_get(p, &v);
+		time_ns += v;
+		for (int i = 0; i < SAMPLER_WORDS; i++) {
+			p = sampler_get(p, &v);
+			c[i] += (v >> 1) ^ -(v & 1);
+		}
+		fprintf(flog, "\n%.1f,", (time_ns - sampler.start_ns) / 1000.0);
+		FPGAMSHR_Write_runtime_row(flog, &cur);
+	}
+	fprintf(flog, "\n");
+	fclose(flog);
+	printf("Runtime log: %lu samples every %u us in %.1f KB to %s", sampler.samples, sampler_period_us,
+			sampler.used / 1024.0, filename);
+	if (sampler.late > 0)
+		printf(", %lu ticks late", sampler.late);
+	if (sampler.missed > 0)
+		printf(", buffer full, %lu samples not taken", sampler.missed);
+	printf("\n");
+}
+
+// "US[:MB]"
+int sampler_parse(const char *spec)
+{
+	char *end;
+	sampler_period_us = strtoul(spec, &end, 0);
+	if (end == spec)
+		return -1;
+	if (*end == ':')
+		sampler_buf_size = MB(strtoull(end + 1, &end, 0));
+	return *end == '\0' && sampler_buf_size >= SAMPLER_MAX_REC ? 0 : -1;
+}
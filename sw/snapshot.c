@@ -0,0 +1,192 @@
+/*
+ * Binary stream of MiCache profiling snapshots.
+ *
+ * snap_stats() reads the counters of FPGAMSHR_Read_stats() straight into a
+ * slot of a single-producer single-consumer ring and returns; a writer thread
+ * drains the ring into the stream file. The poll loops therefore pay for the
+ * register reads only, not for formatting or file I/O. When the writer falls
+ * behind, snapshots are dropped (and counted) rather than stalling the run.
+ * Only the thread that waits for the accelerators may produce.
+ *
+ * File layout, little endian:
+ *   "SPMVSNAP", u32 version, u32 length of the header text, header text
+ *   records: struct snap_rec followed by len bytes of payload
+ * The header text has one line per counter block:
+ *   NAME INSTANCES WORDS ITEM|ITEM|...
+ * and a stats record holds the counters of all blocks in that order, instance
+ * by instance. util/snap2csv.py converts a stream to CSV or Parquet.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "def.h"
+
+#define SNAP_VERSION		1
+#define SNAP_RING_SLOTS		1024		// power of two
+#define SNAP_SLOT_SIZE		MAX(sizeof(struct fpgamshr_stats), 256)
+
+enum snap_type {
+	SNAP_RUN = 1,		// payload: name of the run, e.g. the log name
+	SNAP_PERIODIC = 2,	// payload: counters, taken while the accelerators run
+	SNAP_FINAL = 3,		// payload: counters, taken when they are done
+};
+
+struct snap_rec {
+	uint32_t type;
+	uint32_t len;			// payload bytes
+	uint64_t time_ns;		// timing_now()
+	uint32_t run;
+	uint32_t seq;
+};
+
+struct snap_slot {
+	struct snap_rec rec;
+	uint64_t data[(SNAP_SLOT_SIZE + 7) / 8];
+};
+
+static struct {
+	FILE *f;
+	struct snap_slot *slots;
+	uint32_t head;			// written by the producer
+	uint32_t tail;			// written by the writer
+	uint32_t run;
+	uint32_t seq;
+	uint64_t written;
+	uint64_t dropped;
+	int stop;
+	pthread_t tid;
+} snap;
+
+char snap_path[256];		// default set in main()
+int snap_enabled = 1;
+
+static void *snap_writer(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		uint32_t tail = snap.tail;
+		uint32_t head = __atomic_load_n(&snap.head, __ATOMIC_ACQUIRE);
+		if (tail == head) {
+			if (__atomic_load_n(&snap.stop, __ATOMIC_ACQUIRE) &&
+				tail == __atomic_load_n(&snap.head, __ATOMIC_ACQUIRE))
+				break;
+			struct timespec ts = { 0, 1000000 };
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		for (; tail != head; tail++) {
+			struct snap_slot *s = &snap.slots[tail % SNAP_RING_SLOTS];
+			if (fwrite(&s->rec, sizeof(s->rec) + s->rec.len, 1, snap.f) == 1)
+				snap.written++;
+		}
+		__atomic_store_n(&snap.tail, tail, __ATOMIC_RELEASE);
+	}
+	fflush(snap.f);
+	return NULL;
+}
+
+// A free slot, or NULL if the ring is full.
+static struct snap_slot *snap_reserve(void)
+{
+	if (snap.f == NULL)
+		return NULL;
+	if (snap.head - __atomic_load_n(&snap.tail, __ATOMIC_ACQUIRE) == SNAP_RING_SLOTS) {
+		snap.dropped++;
+		return NULL;
+	}
+	return &snap.slots[snap.head % SNAP_RING_SLOTS];
+}
+
+static void snap_commit(struct snap_slot *s, uint32_t type, uint32_t len)
+{
+	s->rec = (struct snap_rec){ type, len, timing_now(), snap.run, snap.seq++ };
+	__atomic_store_n(&snap.head, snap.head + 1, __ATOMIC_RELEASE);
+}
+
+// Start a new run, its snapshots are tagged with name.
+void snap_run(const char *name)
+{
+	snap.run++;
+	snap.seq = 0;
+	struct snap_slot *s = snap_reserve();
+	if (s == NULL)
+		return;
+	size_t len = MIN(strlen(name), SNAP_SLOT_SIZE);
+	memcpy(s->data, name, len);
+	snap_commit(s, SNAP_RUN, len);
+}
+
+// Read the counters into the stream. If stats is not NULL, it receives a copy.
+int snap_stats(enum snap_type type, struct fpgamshr_stats *stats)
+{
+	struct snap_slot *s = snap_reserve();
+	if (s == NULL)
+		return stats ? FPGAMSHR_Read_stats(stats) : 0;
+	if (FPGAMSHR_Read_stats((struct fpgamshr_stats *)s->data) < 0)
+		return -1;
+	if (stats)
+		memcpy(stats, s->data, sizeof(*stats));
+	snap_commit(s, type, sizeof(struct fpgamshr_stats));
+	return 0;
+}
+
+static int snap_write_header(void)
+{
+	char text[8192];
+	int n = 0;
+	for (int b = 0; b < FPGAMSHR_STATS_BLOCKS; b++) {
+		const struct fpgamshr_stats_block *blk = &fpgamshr_stats_blocks[b];
+		n += snprintf(text + n, sizeof(text) - n, "%s %u %u ", blk->name, blk->instances, blk->words);
+		for (int i = 0; i < blk->words; i++)
+			n += snprintf(text + n, sizeof(text) - n, "%s%s", i ? "|" : "", blk->items[i]);
+		n += snprintf(text + n, sizeof(text) - n, "\n");
+		if (n >= sizeof(text))
+			return -1;
+	}
+	uint32_t hdr[2] = { SNAP_VERSION, n };
+	if (fwrite("SPMVSNAP", 8, 1, snap.f) != 1 || fwrite(hdr, sizeof(hdr), 1, snap.f) != 1 ||
+		fwrite(text, n, 1, snap.f) != 1)
+		return -1;
+	return 0;
+}
+
+int snap_open(void)
+{
+	snap.f = fopen(snap_path, "w");
+	if (snap.f == NULL) {
+		perror(snap_path);
+		return -1;
+	}
+	snap.slots = malloc(SNAP_RING_SLOTS * sizeof(struct snap_slot));
+	if (snap.slots == NULL || snap_write_header() < 0) {
+		fprintf(stderr, "fail to start snapshot stream %s\n", snap_path);
+		goto fail;
+	}
+	if (pthread_create(&snap.tid, NULL, snap_writer, NULL) != 0) {
+		perror("snapshot writer");
+		goto fail;
+	}
+	return 0;
+fail:
+	free(snap.slots);
+	fclose(snap.f);
+	snap.f = NULL;
+	return -1;
+}
+
+void snap_close(void)
+{
+	if (snap.f == NULL)
+		return;
+	__atomic_store_n(&snap.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(snap.tid, NULL);
+	printf("Snapshots: %lu written to %s, %lu dropped\n", snap.written, snap_path, snap.dropped);
+	fclose(snap.f);
+	free(snap.slots);
+	snap.f = NULL;
+}
@@ -0,0 +1,277 @@
+/*
+ * Design-space sweep.
+ *
+ * A sweep runs every benchmark given on the command line at every point of
+ * the cartesian product of the axes set with -x:
+ *   cache  cache divider, the cache holds 1/2^N of its size (CACHE_SIZE_REDUCTION_VALUES: disabled)
+ *   mshr   maxAllowedMSHRs, MSHRs the request handlers may allocate (default: as reset)
+ *   hbm    HBM channels the vector is striped over (0: one channel, host layout)
+ * The points of a benchmark are ordered by HBM channel count, so its data is
+ * loaded once per channel count and stays on the device for all cache and MSHR
+ * settings (and, with the resident cache, for the next sweep as well).
+ *
+ * With sweep_db_path set, results go to a CSV database, one row per attempt.
+ * Before a point runs, a "running" row is appended and synced, afterwards a
+ * row with its status and results; the file is only ever appended to. A sweep
+ * started again on the same database skips the points that have a result and
+ * retries the others, so a sweep killed by a crash or a timeout is resumed by
+ * running the same command again. A point that has been attempted
+ * SWEEP_MAX_ATTEMPTS times without a result (it hung the board, say) is given
+ * up on.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include "def.h"
+
+#define SWEEP_MAX_VALUES	32
+#define SWEEP_MAX_ATTEMPTS	2
+
+enum sweep_axis { SWEEP_CACHE, SWEEP_MSHR, SWEEP_HBM, SWEEP_AXES };
+
+static const char *sweep_axis_names[SWEEP_AXES] = { "cache", "mshr", "hbm" };
+
+struct sweep_point {
+	const char *bench;
+	uint32_t v[SWEEP_AXES];
+};
+
+// Results of a point, see sweep_record().
+struct sweep_result {
+	const char *status;			// "ok", "mismatch", "noref" (no reference to verify with) or "fail"
+	const char *logname;
+	uint64_t cost_us;
+	struct verify_result verify;	// summed over the accelerators
+	struct prof_metrics prof;
+};
+
+struct sweep_entry {
+	char key[320];
+	int attempts;
+	int done;
+};
+
+uint32_t sweep_values[SWEEP_AXES][SWEEP_MAX_VALUES];
+int sweep_nvalues[SWEEP_AXES];		// 0: the axis is not swept
+char sweep_db_path[256];
+
+static struct {
+	FILE *db;
+	struct sweep_entry *entries;
+	int nentries;
+	int cap;
+	int skipped;
+} sweep;
+
+// "AXIS=V,V,...", one axis per -x
+int sweep_parse(const char *spec)
+{
+	int a;
+	const char *eq = strchr(spec, '=');
+	if (eq == NULL)
+		return -1;
+	for (a = 0; a < SWEEP_AXES; a++) {
+		if (strlen(sweep_axis_names[a]) == eq - spec && strncmp(spec, sweep_axis_names[a], eq - spec) == 0)
+			break;
+	}
+	if (a == SWEEP_AXES)
+		return -1;
+	sweep_nvalues[a] = 0;
+	for (const char *p = eq + 1; ; p++) {
+		char *end;
+		if (sweep_nvalues[a] == SWEEP_MAX_VALUES)
+			return -1;
+		sweep_values[a][sweep_nvalues[a]++] = strtoul(p, &end, 0);
+		if (end == p)
+			return -1;
+		p = end;
+		if (*p == '\0')
+			break;
+		if (*p != ',')
+			return -1;
+	}
+	for (int i = 0; i < sweep_nvalues[a]; i++) {
+		uint32_t v = sweep_values[a][i];
+		if ((a == SWEEP_CACHE && v > CACHE_SIZE_REDUCTION_VALUES) || (a == SWEEP_MSHR && v == 0) ||
+			(a == SWEEP_HBM && (v > HBM_CHANNEL_NUM || (v & (v - 1)) != 0)))
+			return -1;
+	}
+	return 0;
+}
+
+// Axes left unset take the values of a run without -x.
+void sweep_defaults(void)
+{
+	if (sweep_nvalues[SWEEP_CACHE] == 0) {
+		for (int i = 0; i < CACHE_SIZE_REDUCTION_VALUES; i++)
+			sweep_values[SWEEP_CACHE][i] = i;
+		sweep_nvalues[SWEEP_CACHE] = CACHE_SIZE_REDUCTION_VALUES;
+	}
+	if (sweep_nvalues[SWEEP_HBM] == 0) {
+		sweep_values[SWEEP_HBM][0] = 0;
+		sweep_nvalues[SWEEP_HBM] = 1;
+	}
+}
+
+static void sweep_key(const struct sweep_point *p, int nspmv, char *key, size_t size)
+{
+	snprintf(key, size, "%s,%d,%u,%u,%u", p->bench, nspmv, p->v[SWEEP_HBM], p->v[SWEEP_CACHE], p->v[SWEEP_MSHR]);
+}
+
+static struct sweep_entry *sweep_entry(const char *key, int create)
+{
+	for (int i = 0; i < sweep.nentries; i++) {
+		if (strcmp(sweep.entries[i].key, key) == 0)
+			return &sweep.entries[i];
+	}
+	if (!create)
+		return NULL;
+	if (sweep.nentries == sweep.cap) {
+		int cap = sweep.cap ? sweep.cap * 2 : 256;
+		struct sweep_entry *e = realloc(sweep.entries, cap * sizeof(*e));
+		if (e == NULL)
+			return NULL;
+		sweep.entries = e;
+		sweep.cap = cap;
+	}
+	struct sweep_entry *e = &sweep.entries[sweep.nentries++];
+	snprintf(e->key, sizeof(e->key), "%s", key);
+	e->attempts = e->done = 0;
+	return e;
+}
+
+// Open the results database and learn which points it has.
+int sweep_open(void)
+{
+	char line[1024];
+	if (sweep_db_path[0] == '\0')
+		return 0;
+	FILE *f = fopen(sweep_db_path, "r");
+	if (f != NULL) {
+		// key,status,...: the key is the first five fields
+		while (fgets(line, sizeof(line), f) != NULL) {
+			char *s = line;
+			for (int i = 0; i < 5 && s != NULL; i++)
+				s = strchr(s + 1, ',');
+			if (s == NULL || strncmp(line, "bench,", 6) == 0)
+				continue;
+			*s++ = '\0';
+			struct sweep_entry *e = sweep_entry(line, 1);
+			if (e == NULL)
+				break;
+			if (strncmp(s, "running,", 8) == 0)
+				e->attempts++;
+			else if (strncmp(s, "ok,", 3) == 0 || strncmp(s, "mismatch,", 9) == 0)
+				e->done = 1;
+		}
+		fclose(f);
+	}
+	sweep.db = fopen(sweep_db_path, "a");
+	if (sweep.db == NULL) {
+		perror(sweep_db_path);
+		return -1;
+	}
+	if (ftell(sweep.db) == 0)
+		fprintf(sweep.db, "bench,spmv,hbm,cache,mshr,status,time,logname,cost us,cache KB,mismatches,max ulp,max rel err,"
+					"cycles,hit rate,mshr occupancy,alloc stall,mem not ready\n");
+	fflush(sweep.db);
+	if (sweep.nentries > 0)
+		printf("Sweep: resuming from %s, %d points recorded\n", sweep_db_path, sweep.nentries);
+	return 0;
+}
+
+static int sweep_todo(const struct sweep_entry *e)
+{
+	return e == NULL || (!e->done && e->attempts < SWEEP_MAX_ATTEMPTS);
+}
+
+// Whether p still has to run. Counts the points that are skipped.
+int sweep_pending(const struct sweep_point *p, int nspmv)
+{
+	char key[320];
+	sweep_key(p, nspmv, key, sizeof(key));
+	struct sweep_entry *e = sweep_entry(key, 0);
+	if (sweep_todo(e))
+		return 1;
+	if (!e->done)
+		printf("Sweep: giving up on %s after %d attempts\n", key, e->attempts);
+	sweep.skipped++;
+	return 0;
+}
+
+// Whether any point of bench with hbm channels still has to run.
+int sweep_pending_load(const char *bench, uint32_t hbm, int nspmv)
+{
+	int pending = 0, points = 0;
+	struct sweep_point p = { bench, { 0 } };
+	p.v[SWEEP_HBM] = hbm;
+	for (int c = 0; c < sweep_nvalues[SWEEP_CACHE]; c++) {
+		p.v[SWEEP_CACHE] = sweep_values[SWEEP_CACHE][c];
+		for (int m = 0; m < MAX(sweep_nvalues[SWEEP_MSHR], 1); m++) {
+			p.v[SWEEP_MSHR] = sweep_nvalues[SWEEP_MSHR] ? sweep_values[SWEEP_MSHR][m] : 0;
+			char key[320];
+			sweep_key(&p, nspmv, key, sizeof(key));
+			pending |= sweep_todo(sweep_entry(key, 0));
+			points++;
+		}
+	}
+	if (!pending)
+		sweep.skipped += points;
+	return pending;
+}
+
+// Append a row and make sure it reaches the disk before the board is touched again.
+static void sweep_append(const char *key, const char *fmt, ...)
+{
+	va_list ap;
+	fprintf(sweep.db, "%s,", key);
+	va_start(ap, fmt);
+	vfprintf(sweep.db, fmt, ap);
+	va_end(ap);
+	fflush(sweep.db);
+	fsync(fileno(sweep.db));
+}
+
+// Mark p as started, so that a crash counts as an attempt.
+void sweep_begin(const struct sweep_point *p, int nspmv)
+{
+	char key[320], stamp[32];
+	if (sweep.db == NULL)
+		return;
+	time_t now = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	sweep_key(p, nspmv, key, sizeof(key));
+	sweep_append(key, "running,%s\n", stamp);
+}
+
+void sweep_record(const struct sweep_point *p, int nspmv, const struct sweep_result *r)
+{
+	char key[320], stamp[32];
+	if (sweep.db == NULL)
+		return;
+	time_t now = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	sweep_key(p, nspmv, key, sizeof(key));
+	uint32_t cache_kb = p->v[SWEEP_CACHE] == CACHE_SIZE_REDUCTION_VALUES ? 0 :
+						(CACHE_SIZE / 1024) * NUM_REQ_HANDLERS >> p->v[SWEEP_CACHE];
+	sweep_append(key, "%s,%s,%s,%lu,%u,%lu,%u,%.3g,%lu,%.4f,%.2f,%.4f,%.4f\n", r->status, stamp, r->logname,
+					r->cost_us, cache_kb, r->verify.mismatches, r->verify.max_ulp, r->verify.max_rel,
+					r->prof.cycles, r->prof.hit_rate, r->prof.mshr_occupancy, r->prof.alloc_stall, r->prof.mem_not_ready);
+}
+
+void sweep_close(void)
+{
+	if (sweep.skipped > 0)
+		printf("Sweep: %d points skipped, recorded in %s\n", sweep.skipped, sweep_db_path);
+	if (sweep.db != NULL)
+		fclose(sweep.db);
+	sweep.db = NULL;
+	free(sweep.entries);
+	sweep.entries = NULL;
+	sweep.nentries = sweep.cap = 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Phase timing.
+ *
+ * Runs are timed in phases with CLOCK_MONOTONIC_RAW, which NTP does not slew:
+ *   load     load_data(), i.e. uploading what is not resident on the device
+ *   program  setting up the accelerators and their DMA engines
+ *   compute  from starting the accelerators until they are all idle
+ *   drain    waiting for the output DMA engines after that
+ *   fetch    reading the outputs back to the host
+ * With the dynamic scheduler, programming and draining happen chunk by chunk
+ * and count as compute; so do they with column tiles, together with fetching
+ * and adding up the partial outputs of the tiles.
+ * timing_now() is also the clock of the snapshots, the runtime samples, the
+ * loader stages and the waits, so all of them line up with the phases.
+ *
+ * To set host time against FPGA time, timing_sync() reads the "total cycles"
+ * counter of MiCache and stamps it with the midpoint of the host times taken
+ * around the read; half the round trip is the uncertainty of the stamp. Two
+ * syncs around the compute phase give the cycles it took and the FPGA clock
+ * as seen from the host, which timing_run_report() prints with the phases of
+ * the run.
+ *
+ * Every phase time also goes to a log2 histogram over all runs of the program
+ * (the points of a sweep, the matrices of a batch, the iterations of the
+ * iterative mode), printed by timing_report() at the end. Phases may be added
+ * from any thread; the run totals belong to the thread that runs the
+ * accelerators.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "def.h"
+
+#define TIMING_BUCKETS		32		// bucket b: [2^b, 2^(b+1)) us, bucket 0 from 0
+#define TIMING_BAR			40
+
+enum timing_phase { TIMING_LOAD, TIMING_PROGRAM, TIMING_COMPUTE, TIMING_DRAIN, TIMING_FETCH, TIMING_PHASES };
+
+static const char *timing_phase_names[TIMING_PHASES] = { "load", "program", "compute", "drain", "fetch" };
+
+// A reading of the FPGA cycle counter, see timing_sync().
+struct timing_sync {
+	uint64_t host_ns;
+	uint64_t err_ns;
+	uint64_t cycles;
+	int valid;
+};
+
+struct timing_hist {
+	uint64_t count;
+	uint64_t sum_ns, min_ns, max_ns;
+	uint64_t buckets[TIMING_BUCKETS];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct timing_hist phase[TIMING_PHASES];
+	uint64_t run_ns[TIMING_PHASES];			// of the current run
+	uint64_t nclock;						// runs with a clock estimate
+	double clock_sum, clock_min, clock_max;	// MHz
+} timing = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+uint64_t timing_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int timing_bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int b = 0;
+	while (us > 1 && b < TIMING_BUCKETS - 1) {
+		us >>= 1;
+		b++;
+	}
+	return b;
+}
+
+// Start the totals of a new run.
+void timing_run_begin(void)
+{
+	memset(timing.run_ns, 0, sizeof(timing.run_ns));
+}
+
+void timing_add(enum timing_phase p, uint64_t ns)
+{
+	struct timing_hist *h = &timing.phase[p];
+	pthread_mutex_lock(&timing.lock);
+	timing.run_ns[p] += ns;
+	if (h->count == 0 || ns < h->min_ns)
+		h->min_ns = ns;
+	h->max_ns = MAX(h->max_ns, ns);
+	h->sum_ns += ns;
+	h->count++;
+	h->buckets[timing_bucket(ns)]++;
+	pthread_mutex_unlock(&timing.lock);
+}
+
+// Read the FPGA cycle counter and stamp it with host time.
+int timing_sync(struct timing_sync *s)
+{
+	uint64_t t0 = timing_now();
+	s->valid = prof_cycles(&s->cycles) == 0;
+	uint64_t t1 = timing_now();
+	s->host_ns = t0 + (t1 - t0) / 2;
+	s->err_ns = (t1 - t0) / 2;
+	return s->valid ? 0 : -1;
+}
+
+// Print the phases of the current run and the cycles between the syncs a and b.
+void timing_run_report(const struct timing_sync *a, const struct timing_sync *b)
+{
+	const char *sep = " ";
+	printf("Phases:");
+	for (int p = TIMING_PROGRAM; p <= TIMING_DRAIN; p++) {
+		if (p != TIMING_COMPUTE && timing.run_ns[p] == 0)
+			continue;
+		printf("%s%s %.1f us", sep, timing_phase_names[p], timing.run_ns[p] / 1e3);
+		sep = ", ";
+	}
+	uint64_t host_ns = b->host_ns - a->host_ns;
+	if (a->valid && b->valid && b->cycles >= a->cycles && host_ns > 0) {
+		uint64_t cycles = b->cycles - a->cycles;
+		double mhz = cycles * 1e3 / host_ns;
+		printf("; FPGA %lu cycles in %.1f us, %.2f MHz +- %.2f", cycles, host_ns / 1e3, mhz,
+				mhz * (a->err_ns + b->err_ns) / host_ns);
+		if (cycles > 0) {
+			if (timing.nclock == 0 || mhz < timing.clock_min)
+				timing.clock_min = mhz;
+			timing.clock_max = MAX(timing.clock_max, mhz);
+			timing.clock_sum += mhz;
+			timing.nclock++;
+		}
+	}
+	printf("\n");
+}
+
+// Histograms of all phases over the runs so far.
+void timing_report(void)
+{
+	if (timing.phase[TIMING_COMPUTE].count == 0)
+		return;
+	printf("Phase timing over all runs:\n");
+	for (int p = 0; p < TIMING_PHASES; p++) {
+		struct timing_hist *h = &timing.phase[p];
+		uint64_t peak = 0;
+		if (h->count == 0)
+			continue;
+		printf("%s: %lu times, min %.1f us, avg %.1f us, max %.1f us\n", timing_phase_names[p], h->count,
+				h->min_ns / 1e3, h->sum_ns / 1e3 / h->count, h->max_ns / 1e3);
+		for (int b = 0; b < TIMING_BUCKETS; b++)
+			peak = MAX(peak, h->buckets[b]);
+		for (int b = timing_bucket(h->min_ns); b <= timing_bucket(h->max_ns); b++) {
+			char bar[TIMING_BAR + 1];
+			int n = (h->buckets[b] * TIMING_BAR + peak - 1) / peak;
+			memset(bar, '#', n);
+			bar[n] = '\0';
+			printf("  %8lu - %8lu us %6lu %s\n", b ? 1UL << b : 0, 1UL << (b + 1), h->buckets[b], bar);
+		}
+	}
+	if (timing.nclock > 0)
+		printf("FPGA clock seen from the host: min %.2f MHz, avg %.2f MHz, max %.2f MHz over %lu runs\n",
+				timing.clock_min, timing.clock_sum / timing.nclock, timing.clock_max, timing.nclock);
+}
@@ -0,0 +1,193 @@
+/*
+ * Minimal io_uring wrapper on top of the raw system calls, so that the host
+ * program does not depend on liburing.
+ *
+ * uring_init() fails with ENOSYS when the headers or the running kernel do
+ * not support io_uring; callers then fall back to plain pread/pwrite.
+ */
+
+#ifndef URING_C
+#define URING_C
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "def.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+struct uring {
+	int fd;
+	unsigned entries;
+	unsigned inflight;
+#ifdef HAVE_IO_URING
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_sz, cq_ring_sz;
+	struct iovec *iovs;			// one per sqe, readv/writev need stable iovecs
+#endif
+};
+
+#ifdef HAVE_IO_URING
+
+static void uring_exit(struct uring *r)
+{
+	if (r->fd < 0)
+		return;
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+	if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_sz);
+	if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_ring_sz);
+	free(r->iovs);
+	close(r->fd);
+	r->fd = -1;
+}
+
+static int uring_init(struct uring *r, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -1;
+	r->entries = p.sq_entries;
+
+	r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_ring_sz = r->cq_ring_sz = MAX(r->sq_ring_sz, r->cq_ring_sz);
+	r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else
+		r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+							r->fd, IORING_OFF_CQ_RING);
+	if (r->cq_ring == MAP_FAILED)
+		goto fail;
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto fail;
+	r->iovs = calloc(p.sq_entries, sizeof(struct iovec));
+	if (r->iovs == NULL)
+		goto fail;
+
+	r->sq_head = (unsigned *)((char *)r->sq_ring + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ring + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->cq_ring + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ring + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+	return 0;
+fail:
+	uring_exit(r);
+	return -1;
+}
+
+// Queue a readv/writev of one buffer. Returns -1 if the submission queue is full.
+static int uring_queue_rw(struct uring *r, int write, int fd, void *buf, size_t len,
+							uint64_t off, uint64_t user_data)
+{
+	unsigned tail = *r->sq_tail;
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries ||
+		r->inflight >= r->entries)
+		return -1;
+	unsigned idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	r->iovs[idx].iov_base = buf;
+	r->iovs[idx].iov_len = len;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)&r->iovs[idx];
+	sqe->len = 1;
+	sqe->off = off;
+	sqe->user_data = user_data;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->inflight++;
+	return 0;
+}
+
+// Submit all queued requests and wait until at least wait_nr completions are available.
+static int uring_submit(struct uring *r, unsigned wait_nr)
+{
+	unsigned to_submit = *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	int ret;
+	do {
+		ret = syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr,
+						wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret < 0 ? -1 : 0;
+}
+
+// Pop one completion if available. Returns 1 and fills res/user_data, 0 otherwise.
+static int uring_reap(struct uring *r, int *res, uint64_t *user_data)
+{
+	unsigned head = *r->cq_head;
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+	*res = cqe->res;
+	*user_data = cqe->user_data;
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	r->inflight--;
+	return 1;
+}
+
+#else // HAVE_IO_URING
+
+static int uring_init(struct uring *r, unsigned entries)
+{
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	errno = ENOSYS;
+	return -1;
+}
+
+static void uring_exit(struct uring *r)
+{
+}
+
+static int uring_queue_rw(struct uring *r, int write, int fd, void *buf, size_t len,
+							uint64_t off, uint64_t user_data)
+{
+	return -1;
+}
+
+static int uring_submit(struct uring *r, unsigned wait_nr)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+static int uring_reap(struct uring *r, int *res, uint64_t *user_data)
+{
+	return 0;
+}
+
+#endif // HAVE_IO_URING
+
+#endif // URING_C
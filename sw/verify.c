@@ -0,0 +1,197 @@
+/*
+ * Result verification.
+ *
+ * Compares the output of an accelerator with the reference, element by
+ * element, and reports the largest error in units in the last place (ULP) and
+ * relative to the reference, and the number of mismatches. An element is a
+ * mismatch when it is more than verify_max_ulp ULP and more than
+ * verify_max_abs away from the reference, or NaN. The accelerator sums in a
+ * different order than the reference, so small errors are expected.
+ *
+ * The comparison is vectorized and split over OpenMP threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "def.h"
+
+uint32_t verify_max_ulp = 167772;	// ~2% of the value
+float verify_max_abs = 1e-5f;
+
+struct verify_result {
+	uint64_t mismatches;
+	uint64_t first;			// index of the first mismatch, if any
+	uint32_t max_ulp;
+	float max_rel;
+};
+
+#define VERIFY_BLOCK	(1 << 14)
+
+// Map the bits of a float to an integer that is ordered like the floats, so
+// that the distance of two of them is their distance in ULP.
+static inline int32_t verify_ordered(float f)
+{
+	int32_t i;
+	memcpy(&i, &f, sizeof(i));
+	return i ^ ((i >> 31) & 0x7fffffff);
+}
+
+static void verify_block_scalar(const float *out, const float *ref, uint64_t n, uint64_t base,
+								struct verify_result *r)
+{
+	for (uint64_t i = 0; i < n; i++) {
+		int32_t a = verify_ordered(out[i]), b = verify_ordered(ref[i]);
+		uint32_t ulp = a > b ? (uint32_t)a - (uint32_t)b : (uint32_t)b - (uint32_t)a;
+		float diff = fabsf(out[i] - ref[i]);
+		r->max_ulp = MAX(r->max_ulp, ulp);
+		if (ref[i] != 0 && diff / fabsf(ref[i]) > r->max_rel)
+			r->max_rel = diff / fabsf(ref[i]);
+		if (ulp > verify_max_ulp && !(diff <= verify_max_abs)) {
+			if (r->mismatches++ == 0)
+				r->first = base + i;
+		}
+	}
+}
+
+typedef void (*verify_block_fn)(const float *out, const float *ref, uint64_t n, uint64_t base,
+								struct verify_result *r);
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static void verify_block_avx2(const float *out, const float *ref, uint64_t n, uint64_t base,
+								struct verify_result *r)
+{
+	__m256i const mag = _mm256_set1_epi32(0x7fffffff);
+	__m256i const max_ulp = _mm256_set1_epi32(verify_max_ulp ^ 0x80000000);	// for signed compares
+	__m256i const flip = _mm256_set1_epi32(0x80000000);
+	__m256 const abs_mask = _mm256_castsi256_ps(mag);
+	__m256 const max_abs = _mm256_set1_ps(verify_max_abs);
+	__m256i ulp_acc = _mm256_setzero_si256();
+	__m256 rel_acc = _mm256_setzero_ps();
+	uint64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 a = _mm256_loadu_ps(out + i), b = _mm256_loadu_ps(ref + i);
+		__m256i ai = _mm256_castps_si256(a), bi = _mm256_castps_si256(b);
+		ai = _mm256_xor_si256(ai, _mm256_and_si256(_mm256_srai_epi32(ai, 31), mag));
+		bi = _mm256_xor_si256(bi, _mm256_and_si256(_mm256_srai_epi32(bi, 31), mag));
+		__m256i ulp = _mm256_sub_epi32(_mm256_max_epi32(ai, bi), _mm256_min_epi32(ai, bi));
+		ulp_acc = _mm256_max_epu32(ulp_acc, ulp);
+		__m256 diff = _mm256_and_ps(_mm256_sub_ps(a, b), abs_mask);
+		__m256 babs = _mm256_and_ps(b, abs_mask);
+		// zero references give inf or NaN here, which the max drops
+		__m256 rel = _mm256_div_ps(diff, babs);
+		rel_acc = _mm256_max_ps(_mm256_blendv_ps(rel, _mm256_setzero_ps(),
+								_mm256_cmp_ps(babs, _mm256_setzero_ps(), _CMP_EQ_OQ)), rel_acc);
+		__m256i far = _mm256_cmpgt_epi32(_mm256_xor_si256(ulp, flip), max_ulp);
+		__m256 bad = _mm256_and_ps(_mm256_castsi256_ps(far), _mm256_cmp_ps(diff, max_abs, _CMP_NLE_UQ));
+		int mask = _mm256_movemask_ps(bad);
+		if (mask) {
+			if (r->mismatches == 0)
+				r->first = base + i + __builtin_ctz(mask);
+			r->mismatches += __builtin_popcount(mask);
+		}
+	}
+	uint32_t ulps[8];
+	float rels[8];
+	_mm256_storeu_si256((__m256i *)ulps, ulp_acc);
+	_mm256_storeu_ps(rels, rel_acc);
+	for (int l = 0; l < 8; l++) {
+		r->max_ulp = MAX(r->max_ulp, ulps[l]);
+		r->max_rel = MAX(r->max_rel, rels[l]);
+	}
+	verify_block_scalar(out + i, ref + i, n - i, base + i, r);
+}
+
+__attribute__((target("avx512f")))
+static void verify_block_avx512(const float *out, const float *ref, uint64_t n, uint64_t base,
+								struct verify_result *r)
+{
+	__m512i const mag = _mm512_set1_epi32(0x7fffffff);
+	__m512i const max_ulp = _mm512_set1_epi32(verify_max_ulp);
+	__m512 const max_abs = _mm512_set1_ps(verify_max_abs);
+	__m512i ulp_acc = _mm512_setzero_si512();
+	__m512 rel_acc = _mm512_setzero_ps();
+	uint64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512 a = _mm512_loadu_ps(out + i), b = _mm512_loadu_ps(ref + i);
+		__m512i ai = _mm512_castps_si512(a), bi = _mm512_castps_si512(b);
+		ai = _mm512_xor_si512(ai, _mm512_and_si512(_mm512_srai_epi32(ai, 31), mag));
+		bi = _mm512_xor_si512(bi, _mm512_and_si512(_mm512_srai_epi32(bi, 31), mag));
+		__m512i ulp = _mm512_sub_epi32(_mm512_max_epi32(ai, bi), _mm512_min_epi32(ai, bi));
+		ulp_acc = _mm512_max_epu32(ulp_acc, ulp);
+		__m512 diff = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(_mm512_sub_ps(a, b)), mag));
+		__m512 babs = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(b), mag));
+		__mmask16 nonzero = _mm512_cmp_ps_mask(babs, _mm512_setzero_ps(), _CMP_NEQ_OQ);
+		rel_acc = _mm512_mask_max_ps(rel_acc, nonzero, _mm512_div_ps(diff, babs), rel_acc);
+		__mmask16 bad = _mm512_cmpgt_epu32_mask(ulp, max_ulp) &
+						_mm512_cmp_ps_mask(diff, max_abs, _CMP_NLE_UQ);
+		if (bad) {
+			if (r->mismatches == 0)
+				r->first = base + i + __builtin_ctz(bad);
+			r->mismatches += __builtin_popcount(bad);
+		}
+	}
+	r->max_ulp = MAX(r->max_ulp, (uint32_t)_mm512_reduce_max_epu32(ulp_acc));
+	r->max_rel = MAX(r->max_rel, _mm512_reduce_max_ps(rel_acc));
+	verify_block_scalar(out + i, ref + i, n - i, base + i, r);
+}
+#endif
+
+static verify_block_fn verify_select(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return verify_block_avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return verify_block_avx2;
+#endif
+	return verify_block_scalar;
+}
+
+// Compare n outputs with the reference.
+void verify(const float *out, const float *ref, uint64_t n, struct verify_result *res)
+{
+	static verify_block_fn block;
+	if (block == NULL)
+		block = verify_select();
+
+	uint64_t nblock = (n + VERIFY_BLOCK - 1) / VERIFY_BLOCK;
+	uint64_t mismatches = 0, first = UINT64_MAX;
+	uint32_t max_ulp = 0;
+	float max_rel = 0;
+	#pragma omp parallel for schedule(static) if (nblock > 1) \
+			reduction(+:mismatches) reduction(min:first) reduction(max:max_ulp, max_rel)
+	for (uint64_t b = 0; b < nblock; b++) {
+		struct verify_result r = { 0 };
+		block(out + b * VERIFY_BLOCK, ref + b * VERIFY_BLOCK, MIN(n - b * VERIFY_BLOCK, VERIFY_BLOCK),
+				b * VERIFY_BLOCK, &r);
+		mismatches += r.mismatches;
+		if (r.mismatches)
+			first = MIN(first, r.first);
+		max_ulp = MAX(max_ulp, r.max_ulp);
+		max_rel = MAX(max_rel, r.max_rel);
+	}
+	res->mismatches = mismatches;
+	res->first = first;
+	res->max_ulp = max_ulp;
+	res->max_rel = max_rel;
+}
+
+// "ULP[:ABS]"
+int verify_parse_tolerance(const char *spec)
+{
+	char *end;
+	verify_max_ulp = strtoul(spec, &end, 0);
+	if (end == spec)
+		return -1;
+	if (*end == ':')
+		verify_max_abs = strtof(end + 1, &end);
+	return *end == '\0' ? 0 : -1;
+}
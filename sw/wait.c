@@ -0,0 +1,162 @@
+/*
+ * Completion waiting for the host poll loops.
+ *
+ * wait_until() calls a check function until it reports that the awaited
+ * condition holds, in one of three modes:
+ *   poll       re-check immediately (busy spinning, lowest latency)
+ *   backoff    sleep between checks, doubling the sleep up to
+ *              wait_backoff_max_us and restarting from 1us whenever the
+ *              check observed a completion
+ *   event      sleep in poll() on the completion fd of the transport and
+ *              re-check when it fires (falls back to backoff without one)
+ * Timeouts are wall-clock based. For every mode the time from the last
+ * check that saw nothing (or from the wake-up by the completion fd) to the
+ * check that observed a completion, an upper bound on the latency to detect
+ * it, and the CPU time the waiting thread spent are recorded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include "def.h"
+
+enum wait_mode {
+	WAIT_POLL,
+	WAIT_BACKOFF,
+	WAIT_EVENT,
+};
+
+static const char *wait_mode_names[] = { "poll", "backoff", "event" };
+
+enum wait_mode wait_mode = WAIT_POLL;
+uint64_t wait_timeout_ms = 60000;		// 0: wait forever
+uint64_t wait_backoff_max_us = 200;
+
+struct wait_stats {
+	uint64_t checks;
+	uint64_t events;
+	uint64_t detect_ns;		// sum over events
+	uint64_t detect_max_ns;
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+};
+
+struct wait_stats wait_stats;
+
+// CPU time of the calling thread only: the reference, the loaders of batch
+// mode and the samplers keep running while it waits. Unlike getrusage(), it
+// is not rounded to scheduler ticks, which are as long as a short wait.
+static uint64_t wait_cpu_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void wait_sleep_ns(uint64_t ns)
+{
+	struct timespec ts = { ns / 1000000000UL, ns % 1000000000UL };
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+void wait_stats_reset(void)
+{
+	memset(&wait_stats, 0, sizeof(wait_stats));
+}
+
+void wait_stats_report(void)
+{
+	struct wait_stats *s = &wait_stats;
+	printf("  wait %s: %lu checks, %lu completions detected within %.1f us avg %.1f us max, cpu %.1f%%\n",
+			wait_mode_names[wait_mode], s->checks, s->events,
+			s->events ? s->detect_ns / 1e3 / s->events : 0.0, s->detect_max_ns / 1e3,
+			s->wall_ns ? 100.0 * s->cpu_ns / s->wall_ns : 0.0);
+}
+
+// check() returns the number of completions it observed, or -1 on error, and
+// sets *done once the awaited condition holds. iter counts the calls.
+// Returns -1 on error or timeout.
+int wait_until(const char *what, int (*check)(void *arg, uint64_t iter, int *done), void *arg)
+{
+	uint64_t start = timing_now();
+	uint64_t cpu_start = wait_cpu_ns();
+	uint64_t deadline = wait_timeout_ms ? start + wait_timeout_ms * 1000000UL : UINT64_MAX;
+	uint64_t last = start;
+	uint64_t backoff_ns = 1000;
+	enum wait_mode mode = wait_mode;
+	int res = 0;
+	int done = 0;
+
+	for (uint64_t iter = 1; ; iter++) {
+		int events = check(arg, iter, &done);
+		uint64_t now = timing_now();
+		wait_stats.checks++;
+		if (events < 0) {
+			res = -1;
+			break;
+		}
+		if (events > 0) {
+			wait_stats.events += events;
+			wait_stats.detect_ns += (now - last) * events;
+			wait_stats.detect_max_ns = MAX(wait_stats.detect_max_ns, now - last);
+			backoff_ns = 1000;
+		}
+		last = now;
+		if (done)
+			break;
+		if (now >= deadline) {
+			fprintf(stderr, "%s timed out after %lu ms\n", what, wait_timeout_ms);
+			res = -1;
+			break;
+		}
+
+		if (mode == WAIT_EVENT) {
+			int fd = qdma_event_fd();
+			if (fd < 0) {
+				fprintf(stderr, "no completion fd on %s, waiting with backoff\n", qdma_ops->name);
+				mode = wait_mode = WAIT_BACKOFF;
+			} else {
+				// wake up now and then anyway, the fd may miss a completion
+				struct pollfd pfd = { .fd = fd, .events = POLLIN };
+				uint64_t ev;
+				if (poll(&pfd, 1, MIN((deadline - now) / 1000000UL + 1, 10)) > 0) {
+					(void)!read(fd, &ev, sizeof(ev));
+					last = timing_now();	// the completion was signalled now
+				}
+				continue;
+			}
+		}
+		if (mode == WAIT_BACKOFF) {
+			wait_sleep_ns(MIN(backoff_ns, deadline - now));
+			backoff_ns = MIN(backoff_ns * 2, wait_backoff_max_us * 1000);
+		}
+	}
+
+	wait_stats.wall_ns += timing_now() - start;
+	wait_stats.cpu_ns += wait_cpu_ns() - cpu_start;
+	return res;
+}
+
+// "poll", "backoff[:MAX_US]" or "event[:PATH]"
+int wait_parse_mode(const char *spec)
+{
+	if (strcmp(spec, "poll") == 0) {
+		wait_mode = WAIT_POLL;
+	} else if (strncmp(spec, "backoff", 7) == 0 && (spec[7] == '\0' || spec[7] == ':')) {
+		wait_mode = WAIT_BACKOFF;
+		if (spec[7] == ':')
+			wait_backoff_max_us = strtoul(spec + 8, NULL, 0);
+	} else if (strncmp(spec, "event", 5) == 0 && (spec[5] == '\0' || spec[5] == ':')) {
+		wait_mode = WAIT_EVENT;
+		if (spec[5] == ':')
+			snprintf(qdma_event_path, sizeof(qdma_event_path), "%s", spec + 6);
+	} else {
+		return -1;
+	}
+	return 0;
+}
@@ -1,4 +1,4 @@
-// Only support direct-mode and after-mmap.
+// Supports direct mode and, for engines built with c_include_sg, scatter-gather mode.
 
 #include "def.h"
 
@@ -15,6 +15,23 @@
 #define S2MM_DA_MSB		0x4c	// S2MM Destination Address. Upper 32 bit address.
 #define S2MM_LENGTH		0x58	// S2MM Buffer Length (Bytes)
 
+// Scatter-gather mode registers, only present when the engine is built with c_include_sg.
+#define MM2S_CURDESC		0x08	// MM2S Current Descriptor Pointer
+#define MM2S_CURDESC_MSB	0x0c
+#define MM2S_TAILDESC		0x10	// MM2S Tail Descriptor Pointer
+#define MM2S_TAILDESC_MSB	0x14
+#define S2MM_CURDESC		0x38	// S2MM Current Descriptor Pointer
+#define S2MM_CURDESC_MSB	0x3c
+#define S2MM_TAILDESC		0x40	// S2MM Tail Descriptor Pointer
+#define S2MM_TAILDESC_MSB	0x44
+
+#define XAXIDMA_SR_SGINCLD	0x8		// DMASR: scatter-gather engine included
+
+#define XAXIDMA_DESC_SOF	(1U << 27)	// CONTROL: start/end of frame (MM2S)
+#define XAXIDMA_DESC_EOF	(1U << 26)
+#define XAXIDMA_DESC_CMPLT	(1U << 31)	// STATUS: descriptor completed
+#define XAXIDMA_DESC_ALIGN	0x40
+
 #define XAXIDMA_DMA_TO_DEVICE	1
 #define XAXIDMA_DEVICE_TO_DMA	2
 
@@ -35,6 +52,19 @@ struct XAXI_DMA_reg_config {
 	uint32_t s2mm_length;
 };
 
+// Scatter-gather buffer descriptor, XAXIDMA_DESC_ALIGN aligned in device memory.
+struct XAXI_DMA_desc {
+	uint32_t nxtdesc;
+	uint32_t nxtdesc_msb;
+	uint32_t buffer_address;
+	uint32_t buffer_address_msb;
+	uint32_t reserved[2];
+	uint32_t control;
+	uint32_t status;
+	uint32_t app[5];
+	uint32_t pad[3];
+};
+
 uint32_t XAXI_DMA_ReadReg(uint64_t dma_base, uint32_t offset) {
 	uint32_t data;
 	if (qdma_read(dma_base + offset, &data, sizeof(data)) < 0) {
@@ -53,11 +83,22 @@ void XAXI_DMA_WriteReg(uint64_t dma_base, uint32_t offset, uint32_t data) {
 	// *(volatile uint32_t *)(dma_base + offset) = data;
 }
 
+uint32_t XAXI_DMA_StatusReg(int direction)
+{
+	return (direction == XAXIDMA_DMA_TO_DEVICE) ? MM2S_DMASR : S2MM_DMASR;
+}
+
+// Decode a DMASR value, e.g. one gathered by a batched register read.
+uint32_t XAXI_DMA_StatusBusy(uint32_t status)
+{
+	return (status & 0x3) == 0;
+}
+
 uint32_t XAXI_DMA_Busy(uint64_t dma_base, int direction)
 {
 	uint32_t status;
-	status = XAXI_DMA_ReadReg(dma_base, (direction == XAXIDMA_DMA_TO_DEVICE) ? MM2S_DMASR : S2MM_DMASR);
-	return (status & 0x3) == 0;
+	status = XAXI_DMA_ReadReg(dma_base, XAXI_DMA_StatusReg(direction));
+	return XAXI_DMA_StatusBusy(status);
 }
 
 int XAXI_DMA_SimpleTransfer(uint64_t dma_base, uint64_t addr, uint32_t length, int direction)
@@ -153,4 +194,61 @@ int XAXI_DMA_WriteConfig(uint64_t dma_base, struct XAXI_DMA_reg_config *config,
 		config->s2mm_dmacr = 1;
 		return qdma_write(dma_base, &config->s2mm_dmacr, sizeof(*config)/2);
 	}
-}
\ No newline at end of file
+}
+uint32_t XAXI_DMA_HasSG(uint64_t dma_base, int direction)
+{
+	return XAXI_DMA_ReadReg(dma_base, XAXI_DMA_StatusReg(direction)) & XAXIDMA_SR_SGINCLD;
+}
+
+// Describe bytes at addr as a chain of descriptors of at most max_len bytes
+// each, to be placed at desc_addr. Returns the number of descriptors, or -1
+// if more than ndesc are needed.
+int XAXI_DMA_SgBuild(struct XAXI_DMA_desc *desc, int ndesc, uint64_t desc_addr,
+					uint64_t addr, uint64_t bytes, uint32_t max_len, int direction)
+{
+	int n = 0;
+	do {
+		uint32_t len = MIN(bytes, max_len);
+		uint64_t next = desc_addr + (n + 1) * sizeof(*desc);
+		if (n == ndesc)
+			return -1;
+		memset(&desc[n], 0, sizeof(*desc));
+		desc[n].nxtdesc = next & 0xffffffff;
+		desc[n].nxtdesc_msb = next >> 32;
+		desc[n].buffer_address = addr & 0xffffffff;
+		desc[n].buffer_address_msb = addr >> 32;
+		// every chunk is a frame of its own, as in direct mode
+		desc[n].control = len | (direction == XAXIDMA_DMA_TO_DEVICE ? XAXIDMA_DESC_SOF | XAXIDMA_DESC_EOF : 0);
+		addr += len;
+		bytes -= len;
+		n++;
+	} while (bytes > 0);
+	return n;
+}
+
+// Run the descriptors at desc_addr, already written to device memory. The
+// current descriptor can only be set while the channel is halted, so the
+// channel is reset first.
+int XAXI_DMA_SgStart(uint64_t dma_base, uint64_t desc_addr, int ndesc, int direction)
+{
+	uint32_t cr = direction == XAXIDMA_DMA_TO_DEVICE ? MM2S_DMACR : S2MM_DMACR;
+	uint32_t cur = direction == XAXIDMA_DMA_TO_DEVICE ? MM2S_CURDESC : S2MM_CURDESC;
+	uint32_t tail = direction == XAXIDMA_DMA_TO_DEVICE ? MM2S_TAILDESC : S2MM_TAILDESC;
+	uint64_t tail_addr = desc_addr + (ndesc - 1) * sizeof(struct XAXI_DMA_desc);
+	int count = 0;
+
+	XAXI_DMA_Reset(dma_base, direction);
+	while (XAXI_DMA_ReadReg(dma_base, cr) & 0x4) {
+		if (++count > 1000) {
+			fprintf(stderr, "DMA 0x%lx reset timeout\n", dma_base);
+			return -1;
+		}
+	}
+	XAXI_DMA_WriteReg(dma_base, cur, desc_addr & 0xffffffff);
+	XAXI_DMA_WriteReg(dma_base, cur + 4, desc_addr >> 32);
+	XAXI_DMA_Enable(dma_base, direction);
+	// writing the lower half of TAILDESC starts the fetch
+	XAXI_DMA_WriteReg(dma_base, tail + 4, tail_addr >> 32);
+	XAXI_DMA_WriteReg(dma_base, tail, tail_addr & 0xffffffff);
+	return 0;
+}
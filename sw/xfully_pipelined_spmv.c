@@ -48,6 +48,15 @@ static void XSpmv_mult_axis_WriteReg(uint64_t base, uint32_t offset, uint32_t da
 	// *(volatile uint32_t *)(base + offset) = data;
 }
 
+// Decode an AP_CTRL value, e.g. one gathered by a batched register read.
+uint32_t XSpmv_mult_axis_CtrlIdle(uint32_t ctrl) {
+#ifdef SPLIT_INPUT_VECTORS
+	return ctrl & 0x1;
+#else
+	return (ctrl >> 2) & 0x1;
+#endif
+}
+
 uint32_t XSpmv_mult_axis_IsIdle(uint64_t base) {
 	uint32_t data[4];
 	if (qdma_read(base, data, sizeof(data[0])) < 0) {
@@ -55,11 +64,7 @@ uint32_t XSpmv_mult_axis_IsIdle(uint64_t base) {
 		return -1;
 	}
 	// data = XSpmv_mult_axis_ReadReg(base, XSPMV_MULT_AXIS_AXILITES_ADDR_AP_CTRL);
-#ifdef SPLIT_INPUT_VECTORS
-	return data[0] & 0x1;
-#else
-	return (data >> 2) & 0x1;
-#endif
+	return XSpmv_mult_axis_CtrlIdle(data[0]);
 }
 
 void XSpmv_mult_axis_Set_val_size(uint64_t base, uint32_t data) {
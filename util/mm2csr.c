@@ -0,0 +1,1383 @@
+/*
+ * Out-of-core MatrixMarket to CSR partition converter.
+ *
+ * Writes the same files as mm_matrix_to_csr.py (same options, folders and
+ * partitioning), but streams the .mtx file instead of loading it whole:
+ *   pass 1  parse the file in blocks, count the non-zeros of every row
+ *   pass 2  parse it again and append every entry to the bucket of its row;
+ *           buckets are runs of rows small enough for the memory budget and
+ *           are kept in temporary files (in memory if there is only one)
+ *   pass 3  bucket by bucket, place the entries by row, sort every row by
+ *           column and append the rows of every partition to its files
+ * Blocks are parsed by all threads, each taking the lines of a slice; rows
+ * are sorted and the expected output is computed in parallel as well. Memory
+ * is bounded by the budget (-m), plus 4 bytes per row and, with -v, 4 bytes
+ * per column for the vector. Symmetric and skew-symmetric matrices are
+ * expanded, pattern matrices get 1.0 as value; duplicate entries are kept as
+ * they are, which gives the same product as summing them.
+ *
+ * With -r, the rows and/or columns are reordered for the locality of x, see
+ * reorder.c. The order is computed on the pattern of the matrix, read by
+ * another pass over the file and held in memory: about 12 bytes per non-zero
+ * for the columns, the rows of the transpose and the uint32 Fenwick tree of
+ * the reuse profile. The reuse profile of x before and after goes to
+ * reuse.csv in the output folder, and the permutations from new to old
+ * indices to rows.perm and cols.perm (uint32 each): result i of the
+ * converted matrix is row rows.perm[i] of the original one, element i of its
+ * vector is element cols.perm[i] of x.
+ *
+ * Rows are partitioned among the accelerators as mm_matrix_to_csr.py does
+ * (-p rows: equal row counts, or round-robin with -i), or in contiguous
+ * blocks of about equal non-zeros (-p nnz) or equal cost (-p cost[=W]). The
+ * cost of a row is its non-zeros plus W (default 4) times the cache misses on
+ * x the reuse profile predicts for it, as if one accelerator walked all rows.
+ * The load and predicted imbalance of every partition are printed.
+ *
+ * With -T, every partition is also cut into column tiles, for matrices whose
+ * x is much larger than MiCache: tile t of partition p (<p>.<t>.row, .col,
+ * .val or .dat) holds the entries of columns [t * W, (t + 1) * W), numbered
+ * from the first column of the tile, and a row pointer for every row of the
+ * partition. The "tiles" file of the folder lists the first and end column
+ * of every tile and the byte offset of its slice in the vector, which the
+ * host adds to vect_mem. W is a multiple of MM_TILE_ALIGN columns, so tiles
+ * start on a cache line of every channel of a vector striped over HBM too;
+ * "auto" sizes it to the accelerator's share of the cache (-c).
+ *
+ * With -H, the vector and the column indices are also written striped over
+ * the given number of HBM channels, as spmvtest would stripe them at load
+ * time (load_vec_hbm() and col_preprocess() in sw/main.c): <name>.hbm<N>.vec
+ * holds the lines of every channel, channel after channel and each padded to
+ * the same size, and <p>.hbm<N>.col (<p>.<t>.hbm<N>.col for a tile) the
+ * addresses of the columns in those channels. The "hbm<N>" file of the folder
+ * records the layout, which the host checks before uploading them as they are.
+ *
+ * Build with "make" in util/, e.g.
+ *   ./mm2csr -a 1..4 -i -s -v example-matrix.mtx
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define MM_BLOCK_SIZE	(64UL << 20)	// text parsed at a time
+#define MM_MAX_ACC		64
+#define MM_TILE_ALIGN	256				// columns, 16 channels of 16 floats
+#define MM_HBM_CHANNEL_SIZE	(256UL << 20)	// HBM_CHANNEL_SIZE of sw/def.h
+#define MM_HBM_MAX_CHANNELS	16
+
+enum { MM_REAL, MM_INTEGER, MM_PATTERN };
+enum { MM_GENERAL, MM_SYMMETRIC, MM_SKEW };
+
+struct mm_entry {
+	uint32_t row, col;
+	float val;
+};
+
+// An entry of a placed row, also the record of a .dat file.
+struct mm_pair {
+	float val;
+	uint32_t col;
+};
+
+static struct {
+	const char *path;
+	uint32_t nrows, ncols;
+	uint64_t nlines;			// entries in the file
+	int field, symmetry;
+	off_t data_off;				// of the first entry line
+} mm;
+
+static struct {
+	int vec, interleaved, split;
+	int acc_first, acc_last;
+	uint64_t budget;			// bytes
+	const char *tmpdir;
+	int order, window;
+	uint64_t cache_kb;			// for the predicted hit rate
+	int partition;
+	double miss_weight;			// of the cost model, in non-zeros
+	uint64_t tile_cols;			// -T, 0: no tiles
+	int tile_auto;
+	uint32_t hbm_channels;		// -H, 0: host layout only
+	uint32_t hbm_line;			// bytes
+} opt = { .acc_first = 1, .acc_last = 1, .budget = 1024UL << 20, .window = 5, .cache_kb = 1024, .miss_weight = 4,
+		.hbm_line = 64 };
+
+enum { MM_PART_ROWS, MM_PART_NNZ, MM_PART_COST, MM_PARTITIONERS };
+
+static const char *mm_part_names[MM_PARTITIONERS] = { "rows", "nnz", "cost" };
+
+#include "reorder.c"
+
+// Old to new row and column indices, NULL: not reordered.
+static uint32_t *row_new, *col_new;
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const char *p = buf;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t size)
+{
+	char *p = buf;
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int mm_read_header(void)
+{
+	char line[1024], object[64], format[64], field[64], symmetry[64];
+	FILE *f = fopen(mm.path, "r");
+	if (f == NULL) {
+		perror(mm.path);
+		return -1;
+	}
+	if (fgets(line, sizeof(line), f) == NULL ||
+		sscanf(line, "%%%%MatrixMarket %63s %63s %63s %63s", object, format, field, symmetry) != 4 ||
+		strcasecmp(object, "matrix") != 0 || strcasecmp(format, "coordinate") != 0) {
+		fprintf(stderr, "%s: not a MatrixMarket coordinate matrix\n", mm.path);
+		goto fail;
+	}
+	if (strcasecmp(field, "real") == 0)
+		mm.field = MM_REAL;
+	else if (strcasecmp(field, "integer") == 0)
+		mm.field = MM_INTEGER;
+	else if (strcasecmp(field, "pattern") == 0)
+		mm.field = MM_PATTERN;
+	else {
+		fprintf(stderr, "%s: unsupported field %s\n", mm.path, field);
+		goto fail;
+	}
+	if (strcasecmp(symmetry, "general") == 0)
+		mm.symmetry = MM_GENERAL;
+	else if (strcasecmp(symmetry, "symmetric") == 0)
+		mm.symmetry = MM_SYMMETRIC;
+	else if (strcasecmp(symmetry, "skew-symmetric") == 0)
+		mm.symmetry = MM_SKEW;
+	else {
+		fprintf(stderr, "%s: unsupported symmetry %s\n", mm.path, symmetry);
+		goto fail;
+	}
+	do {
+		if (fgets(line, sizeof(line), f) == NULL) {
+			fprintf(stderr, "%s: no size line\n", mm.path);
+			goto fail;
+		}
+	} while (line[0] == '%' || line[strspn(line, " \t\r\n")] == '\0');
+	unsigned long long rows, cols, nlines;
+	if (sscanf(line, "%llu %llu %llu", &rows, &cols, &nlines) != 3 || rows > UINT32_MAX || cols > UINT32_MAX) {
+		fprintf(stderr, "%s: bad size line %s", mm.path, line);
+		goto fail;
+	}
+	mm.nrows = rows;
+	mm.ncols = cols;
+	mm.nlines = nlines;
+	mm.data_off = ftello(f);
+	fclose(f);
+	return 0;
+fail:
+	fclose(f);
+	return -1;
+}
+
+// Block-wise reader of the entry lines; a block always ends with a whole line.
+struct mm_reader {
+	int fd;
+	char *buf;
+	size_t len;					// of the block
+	size_t carry;				// bytes of an incomplete line after it
+};
+
+static int mm_open(struct mm_reader *r)
+{
+	r->fd = open(mm.path, O_RDONLY);
+	if (r->fd < 0 || lseek(r->fd, mm.data_off, SEEK_SET) < 0) {
+		perror(mm.path);
+		return -1;
+	}
+	posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	r->buf = malloc(MM_BLOCK_SIZE + 1);
+	r->len = r->carry = 0;
+	if (r->buf == NULL) {
+		perror("read buffer");
+		close(r->fd);
+		return -1;
+	}
+	return 0;
+}
+
+// Next block into r->buf[0, r->len), 0 at the end of the file.
+static ssize_t mm_next(struct mm_reader *r)
+{
+	memmove(r->buf, r->buf + r->len, r->carry);
+	size_t have = r->carry;
+	while (have < MM_BLOCK_SIZE) {
+		ssize_t n = read(r->fd, r->buf + have, MM_BLOCK_SIZE - have);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror(mm.path);
+			return -1;
+		}
+		if (n == 0)
+			break;
+		have += n;
+	}
+	if (have == MM_BLOCK_SIZE) {
+		char *nl = memrchr(r->buf, '\n', have);
+		if (nl == NULL) {
+			fprintf(stderr, "%s: line longer than %lu bytes\n", mm.path, MM_BLOCK_SIZE);
+			return -1;
+		}
+		r->len = nl + 1 - r->buf;
+	} else {
+		if (have > 0 && r->buf[have - 1] != '\n')
+			r->buf[have++] = '\n';	// a last line without newline
+		r->len = have;
+	}
+	r->carry = have - r->len;
+	return r->len;
+}
+
+static void mm_close(struct mm_reader *r)
+{
+	free(r->buf);
+	close(r->fd);
+}
+
+// Entries of the lines in [p, end), twice the lines at most. Returns the
+// number of entries, -1 on a bad line.
+static int64_t mm_parse(const char *p, const char *end, struct mm_entry *e)
+{
+	int64_t n = 0;
+	while (p < end) {
+		char *q;
+		const char *eol = memchr(p, '\n', end - p);
+		p += strspn(p, " \t\r");
+		if (p == eol || *p == '%') {
+			p = eol + 1;
+			continue;
+		}
+		unsigned long i = strtoul(p, &q, 10);
+		unsigned long j = strtoul(q, &q, 10);
+		double v = 1.0;
+		if (mm.field != MM_PATTERN) {
+			const char *s = q;
+			v = strtod(s, &q);
+			if (q == s)
+				return -1;
+		}
+		if (i == 0 || j == 0 || i > mm.nrows || j > mm.ncols || q > eol)
+			return -1;
+		e[n++] = (struct mm_entry){ i - 1, j - 1, v };
+		if (mm.symmetry != MM_GENERAL && i != j)
+			e[n++] = (struct mm_entry){ j - 1, i - 1, mm.symmetry == MM_SKEW ? -v : v };
+		p = eol + 1;
+	}
+	return n;
+}
+
+// Parse a block with all threads. *e grows as needed; returns the entries.
+static int64_t mm_parse_block(const char *buf, size_t len, struct mm_entry **e, size_t *cap)
+{
+	int nthreads = omp_get_max_threads();
+	size_t start[nthreads + 1];
+	int64_t count[nthreads], first[nthreads + 1];
+	// slices end at line ends
+	start[0] = 0;
+	for (int t = 1; t < nthreads; t++) {
+		size_t s = MAX(len * t / nthreads, start[t - 1]);
+		const char *nl = s < len ? memchr(buf + s, '\n', len - s) : NULL;
+		start[t] = nl ? (size_t)(nl + 1 - buf) : len;
+	}
+	start[nthreads] = len;
+	// each slice parses into the place its lines would take at most
+	first[0] = 0;
+	for (int t = 0; t < nthreads; t++) {
+		size_t n = 0;
+		for (const char *p = buf + start[t]; (p = memchr(p, '\n', buf + start[t + 1] - p)) != NULL; p++)
+			n++;
+		first[t + 1] = first[t] + 2 * n;
+	}
+	if ((size_t)first[nthreads] > *cap) {
+		struct mm_entry *n = realloc(*e, first[nthreads] * sizeof(**e));
+		if (n == NULL) {
+			perror("entries");
+			return -1;
+		}
+		*e = n;
+		*cap = first[nthreads];
+	}
+	#pragma omp parallel num_threads(nthreads)
+	{
+		int t = omp_get_thread_num();
+		count[t] = mm_parse(buf + start[t], buf + start[t + 1], *e + first[t]);
+	}
+	int64_t n = 0;
+	for (int t = 0; t < nthreads; t++) {
+		if (count[t] < 0) {
+			fprintf(stderr, "%s: bad entry line\n", mm.path);
+			return -1;
+		}
+		memmove(*e + n, *e + first[t], count[t] * sizeof(**e));
+		n += count[t];
+	}
+	return n;
+}
+
+// Prefix sums of the row costs of -p nnz and -p cost, NULL: equal rows.
+static double *cost_prefix;
+
+// Row at which block p of acc starts: of equal rows as in mm_matrix_to_csr.py,
+// or where the cost prefix comes closest to p/acc of the total.
+static uint64_t mm_cut(int acc, int p)
+{
+	if (p == acc)
+		return mm.nrows;
+	if (cost_prefix == NULL)
+		return (uint64_t)p * (mm.nrows + 1) / acc;
+	double const target = cost_prefix[mm.nrows] * p / acc;
+	uint64_t lo = 0, hi = mm.nrows;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (cost_prefix[mid] < target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo > 0 && target - cost_prefix[lo - 1] < cost_prefix[lo] - target)
+		lo--;
+	return lo;
+}
+
+// Partitioning of the rows among acc accelerators: rows first, first +
+// stride, ... below end go to accelerator p.
+static void mm_partition(int acc, int p, uint64_t *first, uint64_t *end, uint64_t *stride)
+{
+	if (opt.interleaved) {
+		*first = p;
+		*end = mm.nrows;
+		*stride = acc;
+	} else {
+		*first = mm_cut(acc, p);
+		*end = mm_cut(acc, p + 1);
+		*stride = 1;
+	}
+}
+
+// Print the load of every partition and the predicted imbalance, the largest
+// cost over the mean. Without misses, the cost is the non-zeros.
+static void mm_report_partitions(const uint32_t *counts, const uint32_t *misses)
+{
+	for (int acc = MAX(opt.acc_first, 2); acc <= opt.acc_last; acc++) {
+		double cost[acc], max = 0, sum = 0;
+		printf("Partitions of %d (%s%s):\n", acc, opt.interleaved ? "interleaved " : "", mm_part_names[opt.partition]);
+		for (int p = 0; p < acc; p++) {
+			uint64_t first, end, stride, rows = 0, nnz = 0, miss = 0;
+			mm_partition(acc, p, &first, &end, &stride);
+			for (uint64_t r = first; r < end; r += stride, rows++) {
+				nnz += counts[r];
+				miss += misses ? misses[r] : 0;
+			}
+			cost[p] = nnz + opt.miss_weight * miss;
+			max = MAX(max, cost[p]);
+			sum += cost[p];
+			if (misses != NULL)
+				printf("  %d: %lu rows, %lu non-zeros, %lu misses, cost %.0f\n", p, rows, nnz, miss, cost[p]);
+			else
+				printf("  %d: %lu rows, %lu non-zeros\n", p, rows, nnz);
+		}
+		printf("  predicted imbalance %.3f\n", sum > 0 ? max * acc / sum : 1.0);
+	}
+}
+
+// Output files of one partition.
+struct mm_part {
+	int row, col, val, exp;		// fds, -1 if not written
+	int hbm_col;
+	uint64_t first, end, stride;
+	uint64_t nnz;				// written so far
+	uint64_t *tile_nnz;			// of every tile
+};
+
+static struct mm_part parts[MM_MAX_ACC + 1][MM_MAX_ACC];
+static const char *out_root;
+
+// Column tiles of every accelerator count, 0 tiles: not tiled.
+static uint32_t tile_width[MM_MAX_ACC + 1], tile_count[MM_MAX_ACC + 1];
+
+static void mm_plan_tiles(void)
+{
+	// a line of every channel of -H, which may be wider than the default
+	uint64_t const align = MAX(MM_TILE_ALIGN, (uint64_t)opt.hbm_line / sizeof(float) * opt.hbm_channels);
+	for (int acc = opt.acc_first; acc <= opt.acc_last && (opt.tile_cols || opt.tile_auto); acc++) {
+		uint64_t w = opt.tile_auto ? opt.cache_kb * 1024 / sizeof(float) / acc / align * align :
+									(opt.tile_cols + align - 1) / align * align;
+		w = MIN(MAX(w, align), (uint64_t)UINT32_MAX / align * align);
+		uint64_t n = (mm.ncols + w - 1) / w;
+		tile_width[acc] = w;
+		tile_count[acc] = n > 1 ? n : 0;
+		if (n > 1)
+			printf("%d accelerators: %lu column tiles of %lu columns\n", acc, n, w);
+		else
+			printf("%d accelerators: x fits in a tile of %lu columns, not tiled\n", acc, w);
+	}
+}
+
+// Append to file name of the folder of acc accelerators.
+static int mm_append(int acc, const char *name, const void *buf, size_t size)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%d/%s", out_root, acc, name);
+	int fd = open(path, O_WRONLY | O_APPEND);
+	if (fd < 0 || write_all(fd, buf, size) < 0) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static int mm_create(const char *dir, const char *name, int *fd)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	printf("Creating file %s\n", path);
+	*fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (*fd < 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+// Address of column c in the vector striped over the channels of -H, in
+// floats from the start of channel 0, as col_preprocess() computes it.
+static uint32_t mm_hbm_col(uint32_t c)
+{
+	uint32_t const line = opt.hbm_line / sizeof(float);
+	uint32_t const strip = c / line;
+	return (strip % opt.hbm_channels) * (MM_HBM_CHANNEL_SIZE / sizeof(float)) +
+			strip / opt.hbm_channels * line + c % line;
+}
+
+// Append the n columns of col to fd, remapped for -H in place.
+static int mm_write_hbm_col(int fd, uint32_t *col, uint64_t n)
+{
+	#pragma omp parallel for if (n > 65536)
+	for (uint64_t k = 0; k < n; k++)
+		col[k] = mm_hbm_col(col[k]);
+	return write_all(fd, col, n * sizeof(*col));
+}
+
+// The vector striped over the channels of -H, each channel holding its lines
+// in a run of the same size, and the hbm<N> file with the layout.
+static int mm_write_hbm_vec(const char *dir, const char *name, const float *x)
+{
+	uint64_t const line = opt.hbm_line / sizeof(float), nch = opt.hbm_channels;
+	uint64_t const lines = (mm.ncols + line - 1) / line, per_ch = (lines + nch - 1) / nch;
+	uint64_t const chunk = MAX((1UL << 20) / opt.hbm_line, 1);
+	char path[4096];
+	int fd, res = -1;
+
+	if (per_ch * opt.hbm_line > MM_HBM_CHANNEL_SIZE) {
+		fprintf(stderr, "%u columns do not fit in %u HBM channels\n", mm.ncols, opt.hbm_channels);
+		return -1;
+	}
+	float *buf = calloc(chunk * line, sizeof(float));
+	if (buf == NULL) {
+		perror("striped vector");
+		return -1;
+	}
+	if (mm_create(dir, name, &fd) < 0)
+		goto out;
+	for (uint64_t ch = 0; ch < nch; ch++) {
+		for (uint64_t j = 0; j < per_ch; j += chunk) {
+			uint64_t n = MIN(per_ch - j, chunk);
+			for (uint64_t l = 0; l < n; l++) {
+				uint64_t c = ((j + l) * nch + ch) * line;
+				uint64_t m = c < mm.ncols ? MIN(line, mm.ncols - c) : 0;
+				memcpy(buf + l * line, x + c, m * sizeof(float));
+				memset(buf + l * line + m, 0, (line - m) * sizeof(float));
+			}
+			if (write_all(fd, buf, n * opt.hbm_line) < 0) {
+				perror(name);
+				close(fd);
+				goto out;
+			}
+		}
+	}
+	close(fd);
+
+	snprintf(path, sizeof(path), "%s/hbm%u", dir, opt.hbm_channels);
+	printf("Creating file %s\n", path);
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		goto out;
+	}
+	// channels, line and channel bytes, columns
+	fprintf(f, "%u %u %lu %u\n", opt.hbm_channels, opt.hbm_line, MM_HBM_CHANNEL_SIZE, mm.ncols);
+	if (fclose(f) != 0) {
+		perror(path);
+		goto out;
+	}
+	res = 0;
+out:
+	free(buf);
+	return res;
+}
+
+// Files of the tiles of a partition, empty but for the first row pointer.
+static int mm_create_tiles(const char *dir, int acc, int p)
+{
+	static const char *const ext[] = { "row", "col", "val", "dat" };
+	struct mm_part *m = &parts[acc][p];
+	char name[512];
+	m->tile_nnz = calloc(MAX(tile_count[acc], 1), sizeof(*m->tile_nnz));
+	if (m->tile_nnz == NULL) {
+		perror("tiles");
+		return -1;
+	}
+	for (uint32_t t = 0; t < tile_count[acc]; t++) {
+		for (int i = 0; i < 5; i++) {
+			uint32_t zero = 0;
+			int fd;
+			if (i > 0 && i < 4 && (i == 3) == opt.split)
+				continue;
+			if (i == 4 && !opt.hbm_channels)
+				continue;
+			if (i == 4)
+				snprintf(name, sizeof(name), "%d.%u.hbm%u.col", p, t, opt.hbm_channels);
+			else
+				snprintf(name, sizeof(name), "%d.%u.%s", p, t, ext[i]);
+			if (mm_create(dir, name, &fd) < 0)
+				return -1;
+			int res = i == 0 ? write_all(fd, &zero, sizeof(zero)) : 0;
+			close(fd);
+			if (res < 0) {
+				perror(name);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+// The tiles file: first column, end column and byte offset in x of every tile.
+static int mm_write_tile_list(const char *dir, int acc)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/tiles", dir);
+	printf("Creating file %s\n", path);
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	for (uint32_t t = 0; t < tile_count[acc]; t++) {
+		uint64_t c0 = (uint64_t)t * tile_width[acc];
+		fprintf(f, "%lu %lu %lu\n", c0, MIN(c0 + tile_width[acc], (uint64_t)mm.ncols), c0 * sizeof(float));
+	}
+	if (fclose(f) != 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+static int mm_open_outputs(const char *root, const float *x)
+{
+	char dir[4096], name[512];
+	for (int acc = opt.acc_first; acc <= opt.acc_last; acc++) {
+		snprintf(dir, sizeof(dir), "%s/%d", root, acc);
+		printf("Creating folder %s\n", dir);
+		if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+			perror(dir);
+			return -1;
+		}
+		// a tiles file of an earlier conversion would not match
+		snprintf(name, sizeof(name), "%s/tiles", dir);
+		if (unlink(name) < 0 && errno != ENOENT) {
+			perror(name);
+			return -1;
+		}
+		if (tile_count[acc] > 0 && mm_write_tile_list(dir, acc) < 0)
+			return -1;
+		// so are the layouts of -H of an earlier conversion
+		for (uint32_t nch = 1; nch <= MM_HBM_MAX_CHANNELS; nch *= 2) {
+			snprintf(name, sizeof(name), "%s/hbm%u", dir, nch);
+			if (unlink(name) < 0 && errno != ENOENT) {
+				perror(name);
+				return -1;
+			}
+		}
+		for (int p = 0; p < acc; p++) {
+			struct mm_part *m = &parts[acc][p];
+			uint32_t zero = 0;
+			m->row = m->col = m->val = m->exp = m->hbm_col = -1;
+			mm_partition(acc, p, &m->first, &m->end, &m->stride);
+			if (opt.split) {
+				snprintf(name, sizeof(name), "%d.val", p);
+				if (mm_create(dir, name, &m->val) < 0)
+					return -1;
+				snprintf(name, sizeof(name), "%d.col", p);
+				if (mm_create(dir, name, &m->col) < 0)
+					return -1;
+				snprintf(name, sizeof(name), "%d.hbm%u.col", p, opt.hbm_channels);
+				if (opt.hbm_channels && mm_create(dir, name, &m->hbm_col) < 0)
+					return -1;
+			} else {
+				snprintf(name, sizeof(name), "%d.dat", p);
+				if (mm_create(dir, name, &m->val) < 0)
+					return -1;
+			}
+			snprintf(name, sizeof(name), "%d.row", p);
+			if (mm_create(dir, name, &m->row) < 0 || write_all(m->row, &zero, sizeof(zero)) < 0)
+				return -1;
+			if (opt.vec) {
+				snprintf(name, sizeof(name), "%d.exp", p);
+				if (mm_create(dir, name, &m->exp) < 0)
+					return -1;
+			}
+			if (mm_create_tiles(dir, acc, p) < 0)
+				return -1;
+		}
+		if (opt.vec) {
+			int fd;
+			char *base = strdup(root);
+			snprintf(name, sizeof(name), "%s.vec", basename(base));
+			free(base);
+			if (mm_create(dir, name, &fd) < 0)
+				return -1;
+			int res = write_all(fd, x, (size_t)mm.ncols * sizeof(float));
+			close(fd);
+			if (res < 0) {
+				perror("write vector");
+				return -1;
+			}
+			base = strdup(root);
+			snprintf(name, sizeof(name), "%s.hbm%u.vec", basename(base), opt.hbm_channels);
+			free(base);
+			if (opt.hbm_channels && mm_write_hbm_vec(dir, name, x) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static void mm_close_outputs(void)
+{
+	for (int acc = opt.acc_first; acc <= opt.acc_last; acc++) {
+		for (int p = 0; p < acc; p++) {
+			struct mm_part *m = &parts[acc][p];
+			int fds[5] = { m->row, m->col, m->val, m->exp, m->hbm_col };
+			for (int i = 0; i < 5; i++) {
+				if (fds[i] >= 0)
+					close(fds[i]);
+			}
+			free(m->tile_nnz);
+			m->tile_nnz = NULL;
+		}
+	}
+}
+
+// Rows [r0, r1) of the matrix, in memory.
+struct mm_bucket {
+	uint64_t r0, r1;
+	uint64_t nnz;
+	int fd;						// temporary file, -1 if in memory
+	struct mm_entry *mem;
+	uint64_t fill;
+};
+
+static int mm_bucket_of(const struct mm_bucket *b, int nbuckets, uint32_t row)
+{
+	int lo = 0, hi = nbuckets - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (b[mid].r0 <= row)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+static int mm_pair_cmp(const void *a, const void *b)
+{
+	const struct mm_pair *x = a, *y = b;
+	return x->col < y->col ? -1 : x->col > y->col;
+}
+
+// Append nr rows of partition p of acc in bucket b, from row r0 on, to the
+// column tiles of the partition. cur, col and rowptr are scratch space of
+// the bucket's size.
+static int mm_flush_tiles(int acc, int p, const struct mm_bucket *b, const uint64_t *off, const struct mm_pair *pairs,
+						uint64_t r0, uint64_t nr, uint64_t *cur, uint32_t *col, uint32_t *rowptr)
+{
+	struct mm_part *m = &parts[acc][p];
+	uint32_t const width = tile_width[acc];
+	float *val = (float *)(col + b->nnz);
+	char name[512];
+
+	for (uint64_t j = 0; j < nr; j++)
+		cur[j] = off[r0 + j * m->stride - b->r0];
+	for (uint32_t t = 0; t < tile_count[acc]; t++) {
+		uint64_t const c0 = (uint64_t)t * width, c1 = c0 + width;
+		uint64_t nnz = 0;
+		// the rows are sorted, every tile takes up where the last one stopped
+		for (uint64_t j = 0; j < nr; j++) {
+			uint64_t const end = off[r0 + j * m->stride - b->r0 + 1];
+			for (; cur[j] < end && pairs[cur[j]].col < c1; cur[j]++, nnz++) {
+				if (opt.split) {
+					col[nnz] = pairs[cur[j]].col - c0;
+					val[nnz] = pairs[cur[j]].val;
+				} else {
+					((struct mm_pair *)col)[nnz] = (struct mm_pair){ pairs[cur[j]].val, pairs[cur[j]].col - c0 };
+				}
+			}
+			if (m->tile_nnz[t] + nnz > UINT32_MAX) {
+				fprintf(stderr, "tile %u of partition %d of %d has more than %u non-zeros\n", t, p, acc, UINT32_MAX);
+				return -1;
+			}
+			rowptr[j] = m->tile_nnz[t] + nnz;
+		}
+		if (opt.split) {
+			snprintf(name, sizeof(name), "%d.%u.col", p, t);
+			if (mm_append(acc, name, col, nnz * sizeof(*col)) < 0)
+				return -1;
+			snprintf(name, sizeof(name), "%d.%u.val", p, t);
+			if (mm_append(acc, name, val, nnz * sizeof(*val)) < 0)
+				return -1;
+			if (opt.hbm_channels) {
+				for (uint64_t k = 0; k < nnz; k++)
+					col[k] = mm_hbm_col(col[k]);
+				snprintf(name, sizeof(name), "%d.%u.hbm%u.col", p, t, opt.hbm_channels);
+				if (mm_append(acc, name, col, nnz * sizeof(*col)) < 0)
+					return -1;
+			}
+		} else {
+			snprintf(name, sizeof(name), "%d.%u.dat", p, t);
+			if (mm_append(acc, name, col, nnz * sizeof(struct mm_pair)) < 0)
+				return -1;
+		}
+		snprintf(name, sizeof(name), "%d.%u.row", p, t);
+		if (mm_append(acc, name, rowptr, nr * sizeof(*rowptr)) < 0)
+			return -1;
+		m->tile_nnz[t] += nnz;
+	}
+	return 0;
+}
+
+// Place the entries of bucket b by row, sort the rows and append them to the
+// partitions.
+static int mm_flush_bucket(struct mm_bucket *b, const uint32_t *counts, const float *x)
+{
+	uint64_t const nrows = b->r1 - b->r0;
+	struct mm_entry *e = b->mem;
+	uint64_t *off = malloc((nrows + 1) * sizeof(*off));
+	struct mm_pair *pairs = malloc(MAX(b->nnz, 1) * sizeof(*pairs));
+	// gathered rows: columns and values, or pairs of an interleaved .dat
+	uint32_t *col = malloc(MAX(b->nnz, 1) * sizeof(struct mm_pair));
+	float *val = (float *)(col + b->nnz);
+	uint32_t *rowptr = malloc(MAX(nrows, 1) * sizeof(*rowptr));
+	float *y = malloc(MAX(nrows, 1) * sizeof(*y)), *ys = malloc(MAX(nrows, 1) * sizeof(*ys));
+	uint64_t *cur = opt.tile_cols || opt.tile_auto ? malloc(MAX(nrows, 1) * sizeof(*cur)) : NULL;
+	int res = -1;
+
+	if (off == NULL || pairs == NULL || col == NULL || rowptr == NULL || y == NULL || ys == NULL ||
+		((opt.tile_cols || opt.tile_auto) && cur == NULL)) {
+		perror("bucket");
+		goto out;
+	}
+	if (b->fd >= 0) {
+		e = malloc(MAX(b->nnz, 1) * sizeof(*e));
+		if (e == NULL || lseek(b->fd, 0, SEEK_SET) < 0 || read_all(b->fd, e, b->nnz * sizeof(*e)) < 0) {
+			perror("read bucket");
+			goto out;
+		}
+	}
+	off[0] = 0;
+	for (uint64_t r = 0; r < nrows; r++)
+		off[r + 1] = off[r] + counts[b->r0 + r];
+	for (uint64_t k = 0; k < b->nnz; k++) {
+		uint64_t r = e[k].row - b->r0;
+		pairs[off[r]++] = (struct mm_pair){ e[k].val, e[k].col };
+	}
+	for (uint64_t r = nrows; r > 0; r--)
+		off[r] = off[r - 1];
+	off[0] = 0;
+
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (uint64_t r = 0; r < nrows; r++) {
+		struct mm_pair *row = pairs + off[r];
+		uint64_t n = off[r + 1] - off[r];
+		if (n > 1)
+			qsort(row, n, sizeof(*row), mm_pair_cmp);
+		if (x != NULL) {
+			double sum = 0;
+			for (uint64_t k = 0; k < n; k++)
+				sum += (double)row[k].val * x[row[k].col];
+			y[r] = sum;
+		}
+	}
+
+	for (int acc = opt.acc_first; acc <= opt.acc_last; acc++) {
+		for (int p = 0; p < acc; p++) {
+			struct mm_part *m = &parts[acc][p];
+			uint64_t r = MAX(m->first, b->r0);
+			uint64_t nr = 0, nnz = 0;
+			r += (m->stride - (r - m->first) % m->stride) % m->stride;
+			uint64_t const r0 = r;
+			// gather the rows of the partition
+			for (; r < MIN(m->end, b->r1); r += m->stride, nr++) {
+				uint64_t k0 = off[r - b->r0], n = off[r - b->r0 + 1] - k0;
+				if (opt.split) {
+					for (uint64_t k = 0; k < n; k++) {
+						col[nnz + k] = pairs[k0 + k].col;
+						val[nnz + k] = pairs[k0 + k].val;
+					}
+				} else if (m->stride != 1) {
+					memcpy((struct mm_pair *)col + nnz, pairs + k0, n * sizeof(*pairs));
+				}
+				nnz += n;
+				if (m->nnz + nnz > UINT32_MAX) {
+					fprintf(stderr, "partition %d of %d has more than %u non-zeros\n", p, acc, UINT32_MAX);
+					goto out;
+				}
+				rowptr[nr] = m->nnz + nnz;
+				if (x != NULL)
+					ys[nr] = y[r - b->r0];
+			}
+			if (nr == 0)
+				continue;
+			// a blocked partition takes a slice of pairs as it is
+			const void *dat = m->stride == 1 ? (const void *)(pairs + off[MAX(m->first, b->r0) - b->r0]) : (const void *)col;
+			if ((opt.split ? write_all(m->col, col, nnz * sizeof(*col)) < 0 || write_all(m->val, val, nnz * sizeof(*val)) < 0 :
+							write_all(m->val, dat, nnz * sizeof(*pairs)) < 0) ||
+				write_all(m->row, rowptr, nr * sizeof(*rowptr)) < 0 ||
+				(x != NULL && write_all(m->exp, ys, nr * sizeof(*ys)) < 0) ||
+				(m->hbm_col >= 0 && mm_write_hbm_col(m->hbm_col, col, nnz) < 0)) {
+				perror("write partition");
+				goto out;
+			}
+			m->nnz += nnz;
+			if (tile_count[acc] > 0 && mm_flush_tiles(acc, p, b, off, pairs, r0, nr, cur, col, rowptr) < 0)
+				goto out;
+		}
+	}
+	res = 0;
+out:
+	if (e != b->mem)
+		free(e);
+	free(off);
+	free(pairs);
+	free(col);
+	free(rowptr);
+	free(y);
+	free(ys);
+	free(cur);
+	return res;
+}
+
+static int mm_write_perm(const char *root, const char *name, const uint32_t *perm, uint64_t n)
+{
+	int fd;
+	if (mm_create(root, name, &fd) < 0)
+		return -1;
+	int res = write_all(fd, perm, n * sizeof(*perm));
+	close(fd);
+	if (res < 0)
+		perror(name);
+	return res;
+}
+
+// Read the pattern, compute the order and write its permutations. Renumbers
+// counts to the new rows and sets row_new and col_new. Without an order, only
+// profiles the reuse of x. misses, if given, gets the predicted cache misses
+// of every (new) row.
+static int mm_reorder(const char *root, uint32_t *counts, uint64_t nnz, uint32_t *misses)
+{
+	struct reorder_graph g = { .nrows = mm.nrows, .ncols = mm.ncols };
+	struct mm_reader rd;
+	struct mm_entry *e = NULL;
+	size_t cap = 0;
+	uint64_t *cursor = NULL;
+	uint32_t *rperm = NULL, *cperm = NULL;
+	FILE *csv = NULL;
+	ssize_t len;
+	int64_t n;
+	int const reordered = opt.order != REORDER_NONE, symmetric = reorder_symmetric(opt.order);
+	int res = -1;
+
+	if (symmetric && mm.nrows != mm.ncols) {
+		fprintf(stderr, "%s order needs a square matrix\n", reorder_names[opt.order]);
+		return -1;
+	}
+	g.rowptr = malloc(((uint64_t)mm.nrows + 1) * sizeof(*g.rowptr));
+	cursor = malloc(MAX((uint64_t)mm.nrows, 1) * sizeof(*cursor));
+	g.col = malloc(MAX(nnz, 1) * sizeof(*g.col));
+	if (reordered) {
+		rperm = malloc(MAX((uint64_t)mm.nrows, 1) * sizeof(*rperm));
+		cperm = malloc(MAX((uint64_t)mm.ncols, 1) * sizeof(*cperm));
+		row_new = symmetric ? malloc(MAX((uint64_t)mm.nrows, 1) * sizeof(*row_new)) : NULL;
+		col_new = malloc(MAX((uint64_t)mm.ncols, 1) * sizeof(*col_new));
+	}
+	if (g.rowptr == NULL || cursor == NULL || g.col == NULL ||
+		(reordered && (rperm == NULL || cperm == NULL || (symmetric && row_new == NULL) || col_new == NULL))) {
+		perror("reorder");
+		goto out;
+	}
+	g.rowptr[0] = 0;
+	for (uint64_t r = 0; r < mm.nrows; r++) {
+		cursor[r] = g.rowptr[r];
+		g.rowptr[r + 1] = g.rowptr[r] + counts[r];
+	}
+	if (mm_open(&rd) < 0)
+		goto out;
+	while ((len = mm_next(&rd)) > 0) {
+		if ((n = mm_parse_block(rd.buf, len, &e, &cap)) < 0)
+			break;
+		#pragma omp parallel for
+		for (int64_t k = 0; k < n; k++)
+			g.col[__atomic_fetch_add(&cursor[e[k].row], 1, __ATOMIC_RELAXED)] = e[k].col;
+	}
+	mm_close(&rd);
+	if (len != 0)
+		goto out;
+	#pragma omp parallel for schedule(dynamic, 1024)
+	for (uint64_t r = 0; r < mm.nrows; r++)
+		qsort(g.col + g.rowptr[r], g.rowptr[r + 1] - g.rowptr[r], sizeof(*g.col), reorder_u32_cmp);
+	if (reorder_transpose(&g) < 0)
+		goto out;
+
+	if (reordered) {
+		double t = omp_get_wtime();
+		for (uint64_t r = 0; r < mm.nrows; r++)
+			rperm[r] = r;
+		if (reorder(&g, opt.order, opt.window, rperm, cperm) < 0)
+			goto out;
+		printf("Reordered with %s in %.2f s\n", reorder_names[opt.order], omp_get_wtime() - t);
+		for (uint64_t i = 0; i < mm.ncols; i++)
+			col_new[cperm[i]] = i;
+		for (uint64_t i = 0; symmetric && i < mm.nrows; i++)
+			row_new[rperm[i]] = i;
+	}
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/reuse.csv", root);
+	csv = fopen(path, "w");
+	if (csv == NULL) {
+		perror(path);
+		goto out;
+	}
+	fprintf(csv, "order,distance from,distance to,accesses\n");
+	uint64_t const lines = opt.cache_kb * 1024 / (REORDER_LINE_FLOATS * sizeof(float));
+	if (reorder_profile(&g, "original", NULL, NULL, lines, csv, reordered ? NULL : misses) < 0 ||
+		(reordered && reorder_profile(&g, reorder_names[opt.order], symmetric ? rperm : NULL, col_new, lines, csv, misses) < 0))
+		goto out;
+	if (reordered && ((symmetric && mm_write_perm(root, "rows.perm", rperm, mm.nrows) < 0) ||
+						mm_write_perm(root, "cols.perm", cperm, mm.ncols) < 0))
+		goto out;
+	// the rows of the new order
+	if (symmetric) {
+		memcpy(cursor, counts, (uint64_t)mm.nrows * sizeof(*counts));
+		for (uint64_t i = 0; i < mm.nrows; i++)
+			counts[i] = ((uint32_t *)cursor)[rperm[i]];
+	}
+	res = 0;
+out:
+	if (csv != NULL)
+		fclose(csv);
+	free(e);
+	free(g.rowptr);
+	free(g.col);
+	free(g.colptr);
+	free(g.row);
+	free(cursor);
+	free(rperm);
+	free(cperm);
+	return res;
+}
+
+static int mm_parse_acc(const char *s)
+{
+	char *end;
+	opt.acc_first = strtol(s, &end, 10);
+	opt.acc_last = opt.acc_first;
+	if (strncmp(end, "..", 2) == 0)
+		opt.acc_last = strtol(end + 2, &end, 10);
+	if (*end != '\0' || opt.acc_first < 1 || opt.acc_last < opt.acc_first || opt.acc_last > MM_MAX_ACC)
+		return -1;
+	return 0;
+}
+
+// "rows", "nnz" or "cost[=MISS_WEIGHT]"
+static int mm_parse_partitioner(const char *spec)
+{
+	size_t len = strcspn(spec, "=");
+	for (int p = 0; p < MM_PARTITIONERS; p++) {
+		if (strlen(mm_part_names[p]) == len && strncmp(spec, mm_part_names[p], len) == 0) {
+			opt.partition = p;
+			if (spec[len] == '=') {
+				char *end;
+				opt.miss_weight = strtod(spec + len + 1, &end);
+				if (p != MM_PART_COST || *end != '\0' || opt.miss_weight < 0)
+					return -1;
+			}
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: mm2csr [-v] [-a N|A..B] [-i] [-s] [-m BUDGET_MB] [-t TMPDIR] [-j THREADS] [-r ORDER] [-c CACHE_KB]\n"
+			"              [-p PARTITIONER] [-T COLS|auto] [-H CHANNELS[:LINE_BYTES]] INPUT.mtx\n"
+			"  -v  also generate a random vector and the expected output of every partition\n"
+			"  -a  number of accelerators among which the matrix is partitioned, or a range of them\n"
+			"  -i  partition rows interleaved instead of in blocks\n"
+			"  -s  split values and column indices into .val and .col instead of one .dat\n"
+			"  -m  memory for the entries of the rows converted at a time (default 1024)\n"
+			"  -t  directory of the temporary bucket files (default: the output folder)\n"
+			"  -j  threads (default: OpenMP's)\n"
+			"  -r  reorder for the locality of x: rcm, degree, gorder[=WINDOW] (default 5) or cluster\n"
+			"  -c  cache size the reuse profile predicts a hit rate for (default 1024)\n"
+			"  -p  partition rows: rows (default), nnz or cost[=MISS_WEIGHT] (default 4)\n"
+			"  -T  also cut the partitions into column tiles of COLS columns, or sized to the cache\n"
+			"  -H  also write the vector and column indices striped over CHANNELS HBM channels in\n"
+			"      lines of LINE_BYTES (default 64), needs -s and -v\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+	while ((c = getopt(argc, argv, "va:ism:t:j:r:c:p:T:H:")) != -1) {
+		switch (c) {
+		case 'v':
+			opt.vec = 1;
+			break;
+		case 'a':
+			if (mm_parse_acc(optarg) < 0) {
+				fprintf(stderr, "bad accelerator count %s (1..%d)\n", optarg, MM_MAX_ACC);
+				return 1;
+			}
+			break;
+		case 'i':
+			opt.interleaved = 1;
+			break;
+		case 's':
+			opt.split = 1;
+			break;
+		case 'm':
+			opt.budget = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 't':
+			opt.tmpdir = optarg;
+			break;
+		case 'j':
+			omp_set_num_threads(atoi(optarg));
+			break;
+		case 'r':
+			if (reorder_parse(optarg, &opt.order, &opt.window) < 0) {
+				fprintf(stderr, "bad order %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			opt.cache_kb = strtoull(optarg, NULL, 0);
+			break;
+		case 'T':
+			if (strcmp(optarg, "auto") == 0)
+				opt.tile_auto = 1;
+			else if ((opt.tile_cols = strtoull(optarg, NULL, 0)) == 0) {
+				fprintf(stderr, "bad tile width %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'H': {
+			char *end;
+			opt.hbm_channels = strtoul(optarg, &end, 0);
+			if (*end == ':')
+				opt.hbm_line = strtoul(end + 1, &end, 0);
+			// as load_vec_hbm() takes them, lines of whole floats
+			if (*end != '\0' || opt.hbm_channels == 0 || opt.hbm_channels > MM_HBM_MAX_CHANNELS ||
+				(opt.hbm_channels & (opt.hbm_channels - 1)) || opt.hbm_line < sizeof(float) ||
+				(opt.hbm_line & (opt.hbm_line - 1))) {
+				fprintf(stderr, "bad HBM layout %s\n", optarg);
+				return 1;
+			}
+			break;
+		}
+		case 'p':
+			if (mm_parse_partitioner(optarg) < 0) {
+				fprintf(stderr, "bad partitioner %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (argc - optind != 1 || opt.budget == 0) {
+		usage();
+		return 1;
+	}
+	if (opt.hbm_channels && !(opt.split && opt.vec)) {
+		fprintf(stderr, "-H writes the .col files and the vector of -s and -v\n");
+		return 1;
+	}
+	if (opt.interleaved && opt.partition != MM_PART_ROWS) {
+		fprintf(stderr, "-p %s partitions in blocks, not interleaved\n", mm_part_names[opt.partition]);
+		return 1;
+	}
+	mm.path = argv[optind];
+
+	char root[4096], *name = strdup(mm.path);
+	char *dot = strrchr(basename(name), '.');
+	if (dot != NULL)
+		*dot = '\0';
+	snprintf(root, sizeof(root), "%s%s", basename(name),
+			opt.interleaved ? "" : opt.partition == MM_PART_ROWS ? "_blocked" : opt.partition == MM_PART_NNZ ? "_nnz" : "_cost");
+	free(name);
+	if (mkdir(root, 0755) < 0 && errno != EEXIST) {
+		perror(root);
+		return 1;
+	}
+
+	struct mm_reader rd;
+	struct mm_entry *e = NULL;
+	size_t cap = 0;
+	uint32_t *counts = NULL, *misses = NULL;
+	float *x = NULL;
+	struct mm_bucket *buckets = NULL;
+	struct mm_entry *sorted = NULL;
+	size_t sorted_cap = 0;
+	uint64_t *fill = NULL;
+	int nbuckets = 0, res = 1;
+	ssize_t len;
+	int64_t n;
+	uint64_t nnz = 0;
+
+	if (mm_read_header() < 0)
+		return 1;
+	counts = calloc((uint64_t)mm.nrows + 1, sizeof(*counts));
+	if (counts == NULL) {
+		perror("row counts");
+		return 1;
+	}
+
+	// pass 1: non-zeros per row
+	if (mm_open(&rd) < 0)
+		goto out;
+	while ((len = mm_next(&rd)) > 0) {
+		if ((n = mm_parse_block(rd.buf, len, &e, &cap)) < 0)
+			break;
+		#pragma omp parallel for
+		for (int64_t k = 0; k < n; k++)
+			__atomic_fetch_add(&counts[e[k].row], 1, __ATOMIC_RELAXED);
+		nnz += n;
+	}
+	mm_close(&rd);
+	if (len != 0)
+		goto out;
+	printf("Imported (%u, %u) matrix with %lu non-zero elements\n", mm.nrows, mm.ncols, nnz);
+	if (opt.partition == MM_PART_COST) {
+		misses = malloc(MAX((uint64_t)mm.nrows, 1) * sizeof(*misses));
+		if (misses == NULL) {
+			perror("row misses");
+			goto out;
+		}
+	}
+	if ((opt.order != REORDER_NONE || misses != NULL) && mm_reorder(root, counts, nnz, misses) < 0)
+		goto out;
+	if (opt.partition != MM_PART_ROWS) {
+		cost_prefix = malloc(((uint64_t)mm.nrows + 1) * sizeof(*cost_prefix));
+		if (cost_prefix == NULL) {
+			perror("row costs");
+			goto out;
+		}
+		cost_prefix[0] = 0;
+		for (uint64_t r = 0; r < mm.nrows; r++)
+			cost_prefix[r + 1] = cost_prefix[r] + counts[r] + (misses ? opt.miss_weight * misses[r] : 0);
+	}
+	mm_report_partitions(counts, misses);
+
+	// buckets of rows whose entries fit in the budget; placing a bucket needs
+	// the entries, their pairs and the gathered columns and values
+	uint64_t const per_bucket = MAX(opt.budget / (sizeof(struct mm_entry) + 2 * sizeof(struct mm_pair)), 1);
+	for (uint64_t r = 0; r < mm.nrows || nbuckets == 0; ) {
+		struct mm_bucket *nb = realloc(buckets, (nbuckets + 1) * sizeof(*nb));
+		if (nb == NULL) {
+			perror("buckets");
+			goto out;
+		}
+		buckets = nb;
+		struct mm_bucket *b = &buckets[nbuckets++];
+		*b = (struct mm_bucket){ .r0 = r, .fd = -1 };
+		for (; r < mm.nrows && (b->nnz == 0 || b->nnz + counts[r] <= per_bucket); r++)
+			b->nnz += counts[r];
+		b->r1 = r;
+	}
+	for (int i = 0; i < nbuckets; i++) {
+		struct mm_bucket *b = &buckets[i];
+		if (nbuckets == 1) {
+			b->mem = malloc(MAX(b->nnz, 1) * sizeof(*b->mem));
+			if (b->mem == NULL) {
+				perror("bucket");
+				goto out;
+			}
+			continue;
+		}
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/mm2csr-%d-XXXXXX", opt.tmpdir ? opt.tmpdir : root, (int)getpid());
+		b->fd = mkstemp(path);
+		if (b->fd < 0) {
+			perror(path);
+			goto out;
+		}
+		unlink(path);
+	}
+	if (nbuckets > 1)
+		printf("Converting in %d buckets of rows\n", nbuckets);
+	fill = malloc((nbuckets + 1) * sizeof(*fill));
+	if (fill == NULL) {
+		perror("buckets");
+		goto out;
+	}
+
+	if (opt.vec) {
+		printf("Generating random vector of size %u\n", mm.ncols);
+		x = malloc(MAX((uint64_t)mm.ncols, 1) * sizeof(*x));
+		if (x == NULL) {
+			perror("vector");
+			goto out;
+		}
+		srand48(1);
+		for (uint64_t i = 0; i < mm.ncols; i++)
+			x[i] = drand48();
+	}
+	out_root = root;
+	mm_plan_tiles();
+	if (mm_open_outputs(root, x) < 0)
+		goto out;
+
+	// pass 2: entries to the buckets of their rows
+	if (mm_open(&rd) < 0)
+		goto out;
+	while ((len = mm_next(&rd)) > 0) {
+		if ((n = mm_parse_block(rd.buf, len, &e, &cap)) < 0)
+			break;
+		if (row_new != NULL || col_new != NULL) {
+			#pragma omp parallel for
+			for (int64_t k = 0; k < n; k++) {
+				if (row_new != NULL)
+					e[k].row = row_new[e[k].row];
+				e[k].col = col_new[e[k].col];
+			}
+		}
+		if (nbuckets == 1) {
+			memcpy(buckets[0].mem + buckets[0].fill, e, n * sizeof(*e));
+			buckets[0].fill += n;
+			continue;
+		}
+		if (sorted_cap < cap) {
+			free(sorted);
+			sorted = malloc(cap * sizeof(*sorted));
+			sorted_cap = cap;
+			if (sorted == NULL) {
+				perror("entries");
+				len = -1;
+				break;
+			}
+		}
+		memset(fill, 0, (nbuckets + 1) * sizeof(*fill));
+		for (int64_t k = 0; k < n; k++)
+			fill[mm_bucket_of(buckets, nbuckets, e[k].row) + 1]++;
+		for (int i = 0; i < nbuckets; i++)
+			fill[i + 1] += fill[i];
+		for (int64_t k = 0; k < n; k++)
+			sorted[fill[mm_bucket_of(buckets, nbuckets, e[k].row)]++] = e[k];
+		int failed = 0;
+		#pragma omp parallel for schedule(dynamic, 1) reduction(|:failed)
+		for (int i = 0; i < nbuckets; i++) {
+			uint64_t from = i ? fill[i - 1] : 0;
+			failed |= write_all(buckets[i].fd, sorted + from, (fill[i] - from) * sizeof(*sorted)) < 0;
+		}
+		if (failed) {
+			perror("write bucket");
+			len = -1;
+			break;
+		}
+	}
+	mm_close(&rd);
+	if (len != 0)
+		goto out;
+	free(e);
+	e = NULL;
+
+	// pass 3: bucket by bucket into the partitions
+	for (int i = 0; i < nbuckets; i++) {
+		if (mm_flush_bucket(&buckets[i], counts, x) < 0)
+			goto out;
+		free(buckets[i].mem);
+		buckets[i].mem = NULL;
+		if (buckets[i].fd >= 0)
+			close(buckets[i].fd);
+		buckets[i].fd = -1;
+	}
+	res = 0;
+out:
+	mm_close_outputs();
+	for (int i = 0; i < nbuckets; i++) {
+		free(buckets[i].mem);
+		if (buckets[i].fd >= 0)
+			close(buckets[i].fd);
+	}
+	free(buckets);
+	free(fill);
+	free(sorted);
+	free(e);
+	free(x);
+	free(counts);
+	free(row_new);
+	free(col_new);
+	free(misses);
+	free(cost_prefix);
+	return res;
+}
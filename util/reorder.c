@@ -0,0 +1,473 @@
+/*
+ * Locality-enhancing reordering for mm2csr.
+ *
+ * Orders are computed on the pattern of the matrix and given as permutations
+ * from new to old indices:
+ *   rcm     reverse Cuthill-McKee on the pattern of A + A^T; narrows the band
+ *           so that consecutive rows use columns close to each other
+ *   degree  by column non-zeros, densest first; packs the hot part of x into
+ *           few cache lines
+ *   gorder  Gorder-style greedy windowed ordering: the next row is the one
+ *           sharing the most columns (and edges) with the last W rows
+ *   cluster columns in the order the rows first use them; the columns a row
+ *           needs share cache lines with those of the rows around it
+ * rcm, degree and gorder order the vertices of a square matrix and permute
+ * rows and columns alike, so results are permuted like x and the iterative
+ * mode stays meaningful. cluster only permutes the columns, i.e. x, and works
+ * for any matrix.
+ *
+ * reorder_profile() predicts the reuse of x in MiCache: it replays the cache
+ * line accesses of one accelerator walking the rows in order and prints the
+ * LRU stack distance of every access as a log2 histogram, with the hit rate a
+ * fully associative cache of the given size would reach.
+ */
+
+#include <math.h>
+
+enum { REORDER_NONE, REORDER_RCM, REORDER_DEGREE, REORDER_GORDER, REORDER_CLUSTER, REORDER_ORDERS };
+
+static const char *reorder_names[REORDER_ORDERS] = { "none", "rcm", "degree", "gorder", "cluster" };
+
+#define REORDER_LINE_FLOATS		16		// 64 byte lines
+#define REORDER_BUCKETS			34		// bucket b: distance in [2^(b-1), 2^b), bucket 0: distance 0
+#define REORDER_BAR				40
+
+// Pattern of the matrix, by rows and by columns.
+struct reorder_graph {
+	uint32_t nrows, ncols;
+	uint64_t *rowptr;
+	uint32_t *col;
+	uint64_t *colptr;
+	uint32_t *row;
+};
+
+// "NAME[=WINDOW]"
+static int reorder_parse(const char *spec, int *order, int *window)
+{
+	size_t len = strcspn(spec, "=");
+	for (int o = 0; o < REORDER_ORDERS; o++) {
+		if (strlen(reorder_names[o]) == len && strncmp(spec, reorder_names[o], len) == 0) {
+			*order = o;
+			if (spec[len] == '=') {
+				if (o != REORDER_GORDER || (*window = atoi(spec + len + 1)) < 1)
+					return -1;
+			}
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int reorder_symmetric(int order)
+{
+	return order == REORDER_RCM || order == REORDER_DEGREE || order == REORDER_GORDER;
+}
+
+static int reorder_transpose(struct reorder_graph *g)
+{
+	g->colptr = calloc((uint64_t)g->ncols + 1, sizeof(*g->colptr));
+	g->row = malloc(MAX(g->rowptr[g->nrows], 1) * sizeof(*g->row));
+	if (g->colptr == NULL || g->row == NULL) {
+		perror("transpose");
+		return -1;
+	}
+	for (uint64_t k = 0; k < g->rowptr[g->nrows]; k++)
+		g->colptr[g->col[k] + 1]++;
+	for (uint64_t c = 0; c < g->ncols; c++)
+		g->colptr[c + 1] += g->colptr[c];
+	for (uint64_t r = 0; r < g->nrows; r++) {
+		for (uint64_t k = g->rowptr[r]; k < g->rowptr[r + 1]; k++)
+			g->row[g->colptr[g->col[k]]++] = r;
+	}
+	for (uint64_t c = g->ncols; c > 0; c--)
+		g->colptr[c] = g->colptr[c - 1];
+	g->colptr[0] = 0;
+	return 0;
+}
+
+// Degree in A + A^T, counting entries of both as the neighbour lists do.
+static uint64_t reorder_degree(const struct reorder_graph *g, uint32_t v)
+{
+	return g->rowptr[v + 1] - g->rowptr[v] + g->colptr[v + 1] - g->colptr[v];
+}
+
+// Vertices by ascending degree, ties by index.
+static uint32_t *reorder_by_degree(const struct reorder_graph *g, int in_only)
+{
+	uint64_t maxdeg = 0, n = g->nrows;
+	uint32_t *out = malloc(MAX(n, 1) * sizeof(*out));
+	uint64_t *count;
+	for (uint64_t v = 0; v < n; v++)
+		maxdeg = MAX(maxdeg, in_only ? g->colptr[v + 1] - g->colptr[v] : reorder_degree(g, v));
+	count = calloc(maxdeg + 2, sizeof(*count));
+	if (out == NULL || count == NULL) {
+		perror("degree sort");
+		free(out);
+		free(count);
+		return NULL;
+	}
+	for (uint64_t v = 0; v < n; v++)
+		count[(in_only ? g->colptr[v + 1] - g->colptr[v] : reorder_degree(g, v)) + 1]++;
+	for (uint64_t d = 0; d <= maxdeg; d++)
+		count[d + 1] += count[d];
+	for (uint64_t v = 0; v < n; v++)
+		out[count[in_only ? g->colptr[v + 1] - g->colptr[v] : reorder_degree(g, v)]++] = v;
+	free(count);
+	return out;
+}
+
+static int reorder_degree_sort(const struct reorder_graph *g, uint32_t *perm)
+{
+	uint32_t *asc = reorder_by_degree(g, 1);
+	if (asc == NULL)
+		return -1;
+	// densest first, ties keep their order
+	for (uint64_t i = 0, n = g->nrows; i < n; ) {
+		uint64_t j = i, d = g->colptr[asc[n - 1 - i] + 1] - g->colptr[asc[n - 1 - i]];
+		while (j < n && g->colptr[asc[n - 1 - j] + 1] - g->colptr[asc[n - 1 - j]] == d)
+			j++;
+		for (uint64_t k = i; k < j; k++)
+			perm[k] = asc[n - j + (k - i)];
+		i = j;
+	}
+	free(asc);
+	return 0;
+}
+
+// Breadth-first search from start over the vertices not yet in an order,
+// marking them with stamp; the visited vertices go to queue. With sorted,
+// every vertex's unvisited neighbours are taken by ascending degree (the
+// Cuthill-McKee order). Returns the vertices found, *last_level the index of
+// the first one of the deepest level and *depth the number of levels.
+static uint64_t reorder_bfs(const struct reorder_graph *g, uint32_t start, uint32_t *mark, uint32_t stamp,
+							uint32_t *queue, int sorted, uint64_t *last_level, uint64_t *depth)
+{
+	uint64_t head = 0, tail = 0, level_end = 1;
+	queue[tail++] = start;
+	mark[start] = stamp;
+	*last_level = 0;
+	*depth = 1;
+	while (head < tail) {
+		uint32_t v = queue[head++];
+		uint64_t first = tail;
+		for (int t = 0; t < 2; t++) {
+			const uint32_t *adj = t ? g->row + g->colptr[v] : g->col + g->rowptr[v];
+			uint64_t n = t ? g->colptr[v + 1] - g->colptr[v] : g->rowptr[v + 1] - g->rowptr[v];
+			for (uint64_t k = 0; k < n; k++) {
+				if (mark[adj[k]] == stamp || mark[adj[k]] == UINT32_MAX)
+					continue;
+				mark[adj[k]] = stamp;
+				queue[tail++] = adj[k];
+			}
+		}
+		if (sorted) {
+			// insertion sort: most lists are short
+			for (uint64_t i = first + 1; i < tail; i++) {
+				uint32_t u = queue[i];
+				uint64_t d = reorder_degree(g, u), j = i;
+				for (; j > first && reorder_degree(g, queue[j - 1]) > d; j--)
+					queue[j] = queue[j - 1];
+				queue[j] = u;
+			}
+		}
+		if (head == level_end && head < tail) {
+			*last_level = head;
+			level_end = tail;
+			(*depth)++;
+		}
+	}
+	return tail;
+}
+
+static int reorder_rcm(const struct reorder_graph *g, uint32_t *perm)
+{
+	uint64_t n = g->nrows, placed = 0;
+	uint32_t *asc = reorder_by_degree(g, 0);
+	uint32_t *mark = calloc(MAX(n, 1), sizeof(*mark));
+	uint32_t stamp = 0;
+	if (asc == NULL || mark == NULL) {
+		perror("rcm");
+		free(asc);
+		free(mark);
+		return -1;
+	}
+	// every component from a pseudo-peripheral vertex (George and Liu),
+	// starting the search at its vertex of least degree
+	for (uint64_t i = 0; i < n; i++) {
+		uint32_t start = asc[i];
+		uint64_t last, depth, prev_depth = 0, found;
+		if (mark[start] == UINT32_MAX)
+			continue;
+		for (int tries = 0; tries < 8; tries++) {
+			found = reorder_bfs(g, start, mark, ++stamp, perm + placed, 0, &last, &depth);
+			if (depth <= prev_depth)
+				break;
+			prev_depth = depth;
+			uint32_t best = perm[placed + last];
+			for (uint64_t k = placed + last; k < placed + found; k++) {
+				if (reorder_degree(g, perm[k]) < reorder_degree(g, best))
+					best = perm[k];
+			}
+			start = best;
+		}
+		found = reorder_bfs(g, start, mark, ++stamp, perm + placed, 1, &last, &depth);
+		for (uint64_t k = placed; k < placed + found; k++)
+			mark[perm[k]] = UINT32_MAX;
+		placed += found;
+	}
+	for (uint64_t i = 0; i < n / 2; i++) {
+		uint32_t t = perm[i];
+		perm[i] = perm[n - 1 - i];
+		perm[n - 1 - i] = t;
+	}
+	free(asc);
+	free(mark);
+	return 0;
+}
+
+// Unplaced vertices by key in doubly linked lists, one per key, as the unit
+// heap of Gorder: a key changes by one at a time, which moves a vertex to the
+// neighbouring list.
+struct reorder_heap {
+	uint32_t *key, *next, *prev;
+	uint32_t *head;				// per key, UINT32_MAX: empty
+	uint32_t nkeys;
+	uint32_t top;				// no list above is populated
+	uint8_t *placed;
+};
+
+static void reorder_unlink(struct reorder_heap *h, uint32_t v)
+{
+	if (h->prev[v] != UINT32_MAX)
+		h->next[h->prev[v]] = h->next[v];
+	else
+		h->head[h->key[v]] = h->next[v];
+	if (h->next[v] != UINT32_MAX)
+		h->prev[h->next[v]] = h->prev[v];
+}
+
+static void reorder_push(struct reorder_heap *h, uint32_t v)
+{
+	uint32_t k = h->key[v];
+	h->prev[v] = UINT32_MAX;
+	h->next[v] = h->head[k];
+	if (h->head[k] != UINT32_MAX)
+		h->prev[h->head[k]] = v;
+	h->head[k] = v;
+	h->top = MAX(h->top, k);
+}
+
+static int reorder_change(struct reorder_heap *h, uint32_t v, int inc)
+{
+	if (h->placed[v])
+		return 0;
+	if (inc && h->key[v] + 1 == h->nkeys) {
+		uint32_t *head = realloc(h->head, 2 * h->nkeys * sizeof(*head));
+		if (head == NULL)
+			return -1;
+		memset(head + h->nkeys, 0xff, h->nkeys * sizeof(*head));
+		h->head = head;
+		h->nkeys *= 2;
+	}
+	reorder_unlink(h, v);
+	h->key[v] += inc ? 1 : -1;
+	reorder_push(h, v);
+	return 0;
+}
+
+// Scores of vertex v with the others: edges either way, plus a row sharing
+// a column with v, for the columns used by no more than hub rows.
+static int reorder_score(const struct reorder_graph *g, struct reorder_heap *h, uint32_t v, int inc, uint64_t hub)
+{
+	int res = 0;
+	for (uint64_t k = g->rowptr[v]; k < g->rowptr[v + 1]; k++) {
+		uint32_t c = g->col[k];
+		res |= reorder_change(h, c, inc);
+		if (g->colptr[c + 1] - g->colptr[c] > hub)
+			continue;
+		for (uint64_t j = g->colptr[c]; j < g->colptr[c + 1]; j++) {
+			if (g->row[j] != v)
+				res |= reorder_change(h, g->row[j], inc);
+		}
+	}
+	for (uint64_t k = g->colptr[v]; k < g->colptr[v + 1]; k++)
+		res |= reorder_change(h, g->row[k], inc);
+	return res;
+}
+
+static int reorder_gorder(const struct reorder_graph *g, uint32_t *perm, int window)
+{
+	uint64_t n = g->nrows;
+	uint64_t hub = MAX((uint64_t)sqrt(n), 16);
+	struct reorder_heap h = { .nkeys = 64 };
+	uint32_t *asc = reorder_by_degree(g, 1);
+	int res = -1;
+
+	h.key = calloc(MAX(n, 1), sizeof(*h.key));
+	h.next = malloc(MAX(n, 1) * sizeof(*h.next));
+	h.prev = malloc(MAX(n, 1) * sizeof(*h.prev));
+	h.placed = calloc(MAX(n, 1), sizeof(*h.placed));
+	h.head = malloc(h.nkeys * sizeof(*h.head));
+	if (asc == NULL || h.key == NULL || h.next == NULL || h.prev == NULL || h.placed == NULL || h.head == NULL) {
+		perror("gorder");
+		goto out;
+	}
+	memset(h.head, 0xff, h.nkeys * sizeof(*h.head));
+	// among equal keys, the densest column comes first
+	for (uint64_t i = 0; i < n; i++)
+		reorder_push(&h, asc[i]);
+	for (uint64_t i = 0; i < n; i++) {
+		while (h.head[h.top] == UINT32_MAX)
+			h.top--;
+		uint32_t v = h.head[h.top];
+		reorder_unlink(&h, v);
+		h.placed[v] = 1;
+		perm[i] = v;
+		if (reorder_score(g, &h, v, 1, hub) < 0 ||
+			(i >= (uint64_t)window && reorder_score(g, &h, perm[i - window], 0, hub) < 0)) {
+			perror("gorder");
+			goto out;
+		}
+	}
+	res = 0;
+out:
+	free(asc);
+	free(h.key);
+	free(h.next);
+	free(h.prev);
+	free(h.placed);
+	free(h.head);
+	return res;
+}
+
+static int reorder_cluster(const struct reorder_graph *g, uint32_t *perm)
+{
+	uint64_t next = 0;
+	uint8_t *seen = calloc(MAX((uint64_t)g->ncols, 1), sizeof(*seen));
+	if (seen == NULL) {
+		perror("cluster");
+		return -1;
+	}
+	for (uint64_t k = 0; k < g->rowptr[g->nrows]; k++) {
+		if (!seen[g->col[k]]) {
+			seen[g->col[k]] = 1;
+			perm[next++] = g->col[k];
+		}
+	}
+	for (uint64_t c = 0; c < g->ncols; c++) {
+		if (!seen[c])
+			perm[next++] = c;
+	}
+	free(seen);
+	return 0;
+}
+
+// Row and column permutations (new to old) of order; rperm is left alone by
+// the column-only orders.
+static int reorder(const struct reorder_graph *g, int order, int window, uint32_t *rperm, uint32_t *cperm)
+{
+	int res = -1;
+	switch (order) {
+	case REORDER_RCM:
+		res = reorder_rcm(g, rperm);
+		break;
+	case REORDER_DEGREE:
+		res = reorder_degree_sort(g, rperm);
+		break;
+	case REORDER_GORDER:
+		res = reorder_gorder(g, rperm, window);
+		break;
+	case REORDER_CLUSTER:
+		return reorder_cluster(g, cperm);
+	}
+	if (res == 0)
+		memcpy(cperm, rperm, (uint64_t)g->nrows * sizeof(*cperm));
+	return res;
+}
+
+static int reorder_u32_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Print the reuse distance profile of x with rows rperm and columns cnew
+// (old to new), either NULL for the identity, and append it to csv. misses,
+// if given, gets the predicted misses of every row, in the order of rperm.
+static int reorder_profile(const struct reorder_graph *g, const char *name, const uint32_t *rperm, const uint32_t *cnew,
+							uint64_t cache_lines, FILE *csv, uint32_t *misses)
+{
+	uint64_t const nnz = g->rowptr[g->nrows], nlines = (g->ncols + REORDER_LINE_FLOATS - 1) / REORDER_LINE_FLOATS;
+	uint64_t hist[REORDER_BUCKETS] = { 0 }, cold = 0, hits = 0, maxlen = 0, t = 0, peak = 0;
+	uint32_t *fen = calloc(nnz + 1, sizeof(*fen));		// 1 at the last access of every line
+	uint64_t *last = calloc(MAX(nlines, 1), sizeof(*last));	// time + 1 of its last access, 0: none
+	uint32_t *tmp;
+	for (uint64_t r = 0; r < g->nrows; r++)
+		maxlen = MAX(maxlen, g->rowptr[r + 1] - g->rowptr[r]);
+	tmp = malloc(MAX(maxlen, 1) * sizeof(*tmp));
+	if (fen == NULL || last == NULL || tmp == NULL) {
+		perror("reuse profile");
+		free(fen);
+		free(last);
+		free(tmp);
+		return -1;
+	}
+	for (uint64_t i = 0; i < g->nrows; i++) {
+		uint64_t r = rperm ? rperm[i] : i, n = g->rowptr[r + 1] - g->rowptr[r];
+		for (uint64_t k = 0; k < n; k++)
+			tmp[k] = cnew ? cnew[g->col[g->rowptr[r] + k]] : g->col[g->rowptr[r] + k];
+		if (cnew != NULL)
+			qsort(tmp, n, sizeof(*tmp), reorder_u32_cmp);
+		if (misses != NULL)
+			misses[i] = 0;
+		for (uint64_t k = 0; k < n; k++, t++) {
+			uint64_t line = tmp[k] / REORDER_LINE_FLOATS, p = last[line];
+			if (p == 0) {
+				cold++;
+				if (misses != NULL)
+					misses[i]++;
+			} else {
+				// lines last accessed after p: prefix sums over (p, t]
+				uint64_t d = 0;
+				for (uint64_t j = t; j > 0; j -= j & -j)
+					d += fen[j];
+				for (uint64_t j = p; j > 0; j -= j & -j)
+					d -= fen[j];
+				int b = 0;
+				while (b < REORDER_BUCKETS - 1 && d >= 1UL << b)
+					b++;
+				hist[b]++;
+				hits += d < cache_lines;
+				if (misses != NULL)
+					misses[i] += d >= cache_lines;
+				for (uint64_t j = p; j <= nnz; j += j & -j)
+					fen[j]--;
+			}
+			for (uint64_t j = t + 1; j <= nnz; j += j & -j)
+				fen[j]++;
+			last[line] = t + 1;
+		}
+	}
+	printf("Reuse of x with %s order: %lu accesses, %lu cold, predicted hit rate %.4f in %lu KB\n", name, nnz, cold,
+			nnz ? (double)hits / nnz : 0, cache_lines * REORDER_LINE_FLOATS * sizeof(float) / 1024);
+	for (int b = 0; b < REORDER_BUCKETS; b++)
+		peak = MAX(peak, hist[b]);
+	for (int b = 0; b < REORDER_BUCKETS; b++) {
+		char bar[REORDER_BAR + 1];
+		uint64_t lo = b ? 1UL << (b - 1) : 0, hi = 1UL << b;
+		if (csv != NULL)
+			fprintf(csv, "%s,%lu,%lu,%lu\n", name, lo, hi, hist[b]);
+		if (hist[b] == 0)
+			continue;
+		int n = (hist[b] * REORDER_BAR + peak - 1) / peak;
+		memset(bar, '#', n);
+		bar[n] = '\0';
+		printf("  %10lu - %10lu lines %10lu %s\n", lo, hi, hist[b], bar);
+	}
+	if (csv != NULL)
+		fprintf(csv, "%s,cold,,%lu\n", name, cold);
+	free(fen);
+	free(last);
+	free(tmp);
+	return 0;
+}
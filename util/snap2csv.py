@@ -0,0 +1,68 @@
+import struct
+import argparse
+import csv
+import sys
+
+# Record types, see sw/snapshot.c
+SNAP_RUN = 1
+SNAP_PERIODIC = 2
+SNAP_FINAL = 3
+TYPE_NAMES = {SNAP_PERIODIC: 'periodic', SNAP_FINAL: 'final'}
+
+REC = struct.Struct('<IIQII')
+
+def read_header(fh):
+    magic = fh.read(8)
+    if magic != b'SPMVSNAP':
+        sys.exit('%s: not a snapshot stream' % fh.name)
+    version, length = struct.unpack('<II', fh.read(8))
+    if version != 1:
+        sys.exit('%s: unsupported version %d' % (fh.name, version))
+    columns = []
+    for line in fh.read(length).decode().splitlines():
+        name, instances, words, items = line.split(' ', 3)
+        items = items.split('|')
+        assert len(items) == int(words)
+        for inst in range(int(instances)):
+            columns += ['%s[%d] %s' % (name, inst, item) for item in items]
+    return columns
+
+def records(fh, columns):
+    runs = {}
+    while True:
+        hdr = fh.read(REC.size)
+        if len(hdr) < REC.size:
+            break
+        rtype, length, time_ns, run, seq = REC.unpack(hdr)
+        payload = fh.read(length)
+        if len(payload) < length:
+            break   # stream cut short, e.g. the run was killed
+        if rtype == SNAP_RUN:
+            runs[run] = payload.decode(errors='replace')
+            continue
+        counters = struct.unpack('<%dQ' % (length // 8), payload)
+        if len(counters) != len(columns):
+            sys.exit('%s: record with %d counters, header has %d' % (fh.name, len(counters), len(columns)))
+        yield [time_ns, runs.get(run, str(run)), seq, TYPE_NAMES.get(rtype, str(rtype))] + list(counters)
+
+parser = argparse.ArgumentParser(description='Convert a profiling snapshot stream of spmvtest (*.snap) into CSV or Parquet, one row per snapshot.')
+parser.add_argument('-o', '--output', type=str, help='Output file, *.csv or *.parquet (needs pyarrow). Default: the input with a .csv extension')
+parser.add_argument('-f', '--final', action='store_true', help='Only the final snapshot of every run')
+parser.add_argument('input_file', help='Snapshot stream written by spmvtest')
+args=parser.parse_args()
+
+output = args.output or args.input_file.rsplit('.', 1)[0] + '.csv'
+with open(args.input_file, 'rb') as fh:
+    columns = read_header(fh)
+    header = ['time_ns', 'run', 'seq', 'type'] + columns
+    rows = (r for r in records(fh, columns) if not args.final or r[3] == 'final')
+    if output.endswith('.parquet'):
+        import pyarrow
+        import pyarrow.parquet
+        table = pyarrow.Table.from_pylist([dict(zip(header, r)) for r in rows])
+        pyarrow.parquet.write_table(table, output)
+    else:
+        with open(output, 'w', newline='') as out:
+            writer = csv.writer(out)
+            writer.writerow(header)
+            writer.writerows(rows)